@@ -0,0 +1,112 @@
+/*
+ * Compare the time taken to find the changed pins among 1024 inputs when
+ * the state is held as one bool per pin, and as a pin bitmap.
+ */
+#include "../pin_bitmap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_PINS 1024
+#define NUM_WORDS (NUM_PINS / PIN_BITMAP_WORD_BITS)
+#define ITERATIONS 200000
+
+static volatile size_t change_sink;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void
+count_change(void * const ctx, size_t const pin, bool const state)
+{
+    change_sink += pin + state;
+}
+
+static double
+scan_bools(bool const * const previous, bool const * const current)
+{
+    uint64_t const start_ns = now_ns();
+
+    for (size_t iteration = 0; iteration < ITERATIONS; iteration++)
+    {
+        for (size_t pin = 0; pin < NUM_PINS; pin++)
+        {
+            if (previous[pin] != current[pin])
+            {
+                count_change(NULL, pin, current[pin]);
+            }
+        }
+        __asm__ volatile("" ::: "memory");
+    }
+
+    return (double)(now_ns() - start_ns) / ITERATIONS;
+}
+
+static double
+scan_bitmap(uint64_t const * const previous, uint64_t const * const current)
+{
+    uint64_t const start_ns = now_ns();
+
+    for (size_t iteration = 0; iteration < ITERATIONS; iteration++)
+    {
+        pin_bitmap_for_each_change(previous, current, NULL, NUM_WORDS, count_change, NULL);
+        __asm__ volatile("" ::: "memory");
+    }
+
+    return (double)(now_ns() - start_ns) / ITERATIONS;
+}
+
+int main(void)
+{
+    static size_t const changes[] = { 0, 1, 16, 256 };
+    static bool previous_bools[NUM_PINS];
+    static bool current_bools[NUM_PINS];
+    static uint64_t previous_words[NUM_WORDS];
+    static uint64_t current_words[NUM_WORDS];
+
+    printf("Change scan of %d pins (ns per scan)\n", NUM_PINS);
+    printf("%-10s %12s %12s\n", "changes", "bool", "bitmap");
+
+    for (size_t index = 0; index < sizeof changes / sizeof changes[0]; index++)
+    {
+        srand(1);
+        for (size_t pin = 0; pin < NUM_PINS; pin++)
+        {
+            bool const state = rand() & 1;
+
+            previous_bools[pin] = state;
+            pin_bitmap_assign(previous_words, pin, state);
+        }
+        for (size_t pin = 0; pin < NUM_PINS; pin++)
+        {
+            current_bools[pin] = previous_bools[pin];
+        }
+        for (size_t change = 0; change < changes[index]; change++)
+        {
+            size_t const pin = (change * 397) % NUM_PINS;
+
+            current_bools[pin] = !previous_bools[pin];
+        }
+        for (size_t pin = 0; pin < NUM_PINS; pin++)
+        {
+            pin_bitmap_assign(current_words, pin, current_bools[pin]);
+        }
+
+        double const bool_ns = scan_bools(previous_bools, current_bools);
+        double const bitmap_ns = scan_bitmap(previous_words, current_words);
+
+        printf("%-10zu %12.1f %12.1f\n", changes[index], bool_ns, bitmap_ns);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/*
+ * Compare the round trip time of reading a binary-input through the fast
+ * path socket and through UBUS. Needs a running sysfs_gpio_module with
+ * "fast_socket" configured, and is skipped when there isn't one.
+ *
+ * Usage: bench_fast_path [fast socket path] [ubus socket path]
+ */
+#include "../sysfs_gpio_fast.h"
+
+#include <libubus.h>
+#include <libubox/blobmsg.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FAST_SOCKET "/var/run/sysfs_gpio_fast.sock"
+#define ITERATIONS 10000
+
+static uint64_t samples_ns[ITERATIONS];
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int
+compare_u64(void const * const a, void const * const b)
+{
+    uint64_t const lhs = *(uint64_t const *)a;
+    uint64_t const rhs = *(uint64_t const *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void
+report(char const * const name, size_t const count)
+{
+    qsort(samples_ns, count, sizeof samples_ns[0], compare_u64);
+
+    printf("%-12s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+           name,
+           samples_ns[count / 2] / 1000.0,
+           samples_ns[count * 99 / 100] / 1000.0,
+           samples_ns[count - 1] / 1000.0);
+}
+
+static int
+connect_fast_socket(char const * const path)
+{
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    strncpy(address.sun_path, path, sizeof address.sun_path - 1);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof address) < 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+static size_t
+bench_fast_socket(int const fd)
+{
+    size_t count;
+
+    for (count = 0; count < ITERATIONS; count++)
+    {
+        sysfs_gpio_fast_request_st const request =
+        {
+            .tag = count,
+            .op = sysfs_gpio_fast_op_get,
+            .instance = 0
+        };
+        sysfs_gpio_fast_response_st response;
+        uint64_t const start_ns = now_ns();
+
+        if (send(fd, &request, sizeof request, 0) != sizeof request
+            || recv(fd, &response, sizeof response, 0) != sizeof response
+            || response.tag != request.tag)
+        {
+            break;
+        }
+        samples_ns[count] = now_ns() - start_ns;
+    }
+
+    return count;
+}
+
+static void
+ubus_reply(struct ubus_request * const req, int const type, struct blob_attr * const msg)
+{
+}
+
+static size_t
+bench_ubus(struct ubus_context * const ctx, uint32_t const id)
+{
+    static struct blob_buf request_buf;
+    size_t count;
+
+    blob_buf_init(&request_buf, 0);
+
+    void * const gpios_cookie = blobmsg_open_array(&request_buf, "gpios");
+    void * const gpio_cookie = blobmsg_open_table(&request_buf, NULL);
+
+    blobmsg_add_string(&request_buf, "io type", "binary-input");
+    blobmsg_add_u32(&request_buf, "instance", 0);
+    blobmsg_close_table(&request_buf, gpio_cookie);
+    blobmsg_close_array(&request_buf, gpios_cookie);
+
+    for (count = 0; count < ITERATIONS; count++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        if (ubus_invoke(ctx, id, "get", request_buf.head, ubus_reply, NULL, 1000) != 0)
+        {
+            break;
+        }
+        samples_ns[count] = now_ns() - start_ns;
+    }
+
+    blob_buf_free(&request_buf);
+
+    return count;
+}
+
+int
+main(int argc, char * * argv)
+{
+    char const * const fast_socket_path = argc > 1 ? argv[1] : DEFAULT_FAST_SOCKET;
+    char const * const ubus_path = argc > 2 ? argv[2] : NULL;
+    int const fd = connect_fast_socket(fast_socket_path);
+    struct ubus_context * const ctx = ubus_connect(ubus_path);
+    uint32_t id;
+
+    if (fd < 0 || ctx == NULL || ubus_lookup_id(ctx, "sysfs.gpio", &id) != 0)
+    {
+        printf("bench_fast_path: sysfs_gpio_module isn't running with a fast socket, skipped\n");
+        goto done;
+    }
+
+    printf("%d reads of binary-input 0\n", ITERATIONS);
+    report("fast socket", bench_fast_socket(fd));
+    report("ubus", bench_ubus(ctx, id));
+
+done:
+    if (ctx != NULL)
+    {
+        ubus_free(ctx);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,381 @@
+/*
+ * Load test the UBUS get and set handlers and input events of a running
+ * sysfs_gpio_module that uses the memory backend, so no hardware is needed.
+ * binary-input 0 is driven with the sysfs.gpio.ext simulate_input method,
+ * and must be configured with "edge" : "both" and no debouncing. Fails if
+ * an event, a read or the output write count doesn't match what was driven.
+ * Skipped when the module isn't running with the memory backend.
+ *
+ * Usage: bench_memory_ubus [ubus socket path]
+ */
+#include <libubus.h>
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INPUT_EVENT_ID "sysfs.gpio.input"
+#define ITERATIONS 1000
+#define EVENT_TIMEOUT_MS 1000
+
+typedef struct input_events_st
+{
+    struct ubus_event_handler handler;
+    struct uloop_timeout timeout;
+    size_t count;
+    size_t target;
+    bool state;
+    uint64_t received_ns;
+} input_events_st;
+
+/* What a reply handler found in the reply. */
+typedef struct reply_st
+{
+    char const * name;
+    bool found;
+    uint64_t value;
+} reply_st;
+
+static input_events_st input_events;
+static struct blob_buf request_buf;
+
+static uint64_t edge_samples_ns[ITERATIONS];
+static uint64_t get_samples_ns[ITERATIONS];
+static uint64_t set_samples_ns[ITERATIONS];
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int
+compare_u64(void const * const a, void const * const b)
+{
+    uint64_t const lhs = *(uint64_t const *)a;
+    uint64_t const rhs = *(uint64_t const *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void
+report(char const * const name, uint64_t * const samples_ns, size_t const count)
+{
+    if (count == 0)
+    {
+        printf("%-14s no samples\n", name);
+        goto done;
+    }
+
+    qsort(samples_ns, count, sizeof samples_ns[0], compare_u64);
+
+    printf("%-14s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n",
+           name,
+           samples_ns[count / 2] / 1000.0,
+           samples_ns[count * 99 / 100] / 1000.0,
+           samples_ns[count - 1] / 1000.0);
+
+done:
+    return;
+}
+
+/* Search a reply, including nested tables and arrays, for a named value. */
+static struct blob_attr *
+find_attr(struct blob_attr * const data, size_t const len, char const * const name)
+{
+    struct blob_attr * found = NULL;
+    struct blob_attr * cur;
+    size_t rem = len;
+
+    __blob_for_each_attr(cur, data, rem)
+    {
+        if (strcmp(blobmsg_name(cur), name) == 0)
+        {
+            found = cur;
+            break;
+        }
+        if (blobmsg_type(cur) == BLOBMSG_TYPE_TABLE || blobmsg_type(cur) == BLOBMSG_TYPE_ARRAY)
+        {
+            found = find_attr(blobmsg_data(cur), blobmsg_data_len(cur), name);
+            if (found != NULL)
+            {
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+static bool
+attr_value(struct blob_attr * const attr, uint64_t * const value)
+{
+    bool success = true;
+
+    switch (blobmsg_type(attr))
+    {
+        case BLOBMSG_TYPE_INT64:
+            *value = blobmsg_get_u64(attr);
+            break;
+        case BLOBMSG_TYPE_INT32:
+            *value = blobmsg_get_u32(attr);
+            break;
+        case BLOBMSG_TYPE_INT8:
+            *value = blobmsg_get_u8(attr);
+            break;
+        default:
+            success = false;
+            break;
+    }
+
+    return success;
+}
+
+static void
+reply_handler(struct ubus_request * const req, int const type, struct blob_attr * const msg)
+{
+    reply_st * const reply = req->priv;
+    struct blob_attr * const attr =
+        msg != NULL ? find_attr(blob_data(msg), blob_len(msg), reply->name) : NULL;
+
+    reply->found = attr != NULL && attr_value(attr, &reply->value);
+}
+
+static void
+input_event_handler(
+    struct ubus_context * const ctx,
+    struct ubus_event_handler * const handler,
+    char const * const type,
+    struct blob_attr * const msg)
+{
+    struct blob_attr * const instance = find_attr(blob_data(msg), blob_len(msg), "instance");
+    struct blob_attr * const value = find_attr(blob_data(msg), blob_len(msg), "value");
+
+    if (instance == NULL || value == NULL || blobmsg_get_u32(instance) != 0)
+    {
+        goto done;
+    }
+
+    input_events.received_ns = now_ns();
+    input_events.state = blobmsg_get_bool(value);
+    input_events.count++;
+    if (input_events.count >= input_events.target)
+    {
+        uloop_end();
+    }
+
+done:
+    return;
+}
+
+static void
+event_timeout(struct uloop_timeout * const timeout)
+{
+    uloop_end();
+}
+
+static bool
+wait_for_event(size_t const target)
+{
+    if (input_events.count < target)
+    {
+        input_events.target = target;
+        uloop_timeout_set(&input_events.timeout, EVENT_TIMEOUT_MS);
+        uloop_run();
+        uloop_timeout_cancel(&input_events.timeout);
+    }
+
+    return input_events.count >= target;
+}
+
+static int
+simulate_input(struct ubus_context * const ctx, uint32_t const ext_id, bool const state)
+{
+    reply_st reply = { .name = "result" };
+    int status;
+
+    blob_buf_init(&request_buf, 0);
+    blobmsg_add_u32(&request_buf, "instance", 0);
+    blobmsg_add_u8(&request_buf, "value", state);
+
+    status = ubus_invoke(ctx, ext_id, "simulate_input", request_buf.head, reply_handler, &reply, 1000);
+    if (status == 0 && (!reply.found || !reply.value))
+    {
+        status = UBUS_STATUS_UNKNOWN_ERROR;
+    }
+
+    return status;
+}
+
+static void
+add_gpio_request(char const * const io_type, bool const with_value, bool const state)
+{
+    blob_buf_init(&request_buf, 0);
+
+    void * const gpios_cookie = blobmsg_open_array(&request_buf, "gpios");
+    void * const gpio_cookie = blobmsg_open_table(&request_buf, NULL);
+
+    blobmsg_add_string(&request_buf, "io type", io_type);
+    blobmsg_add_u32(&request_buf, "instance", 0);
+    if (with_value)
+    {
+        blobmsg_add_u8(&request_buf, "value", state);
+    }
+    blobmsg_close_table(&request_buf, gpio_cookie);
+    blobmsg_close_array(&request_buf, gpios_cookie);
+}
+
+static bool
+get_input(struct ubus_context * const ctx, uint32_t const gpio_id, bool * const state)
+{
+    reply_st reply = { .name = "value" };
+
+    add_gpio_request("binary-input", false, false);
+
+    bool const success =
+        ubus_invoke(ctx, gpio_id, "get", request_buf.head, reply_handler, &reply, 1000) == 0
+        && reply.found;
+
+    *state = reply.value != 0;
+
+    return success;
+}
+
+static bool
+set_output(struct ubus_context * const ctx, uint32_t const gpio_id, bool const state)
+{
+    add_gpio_request("binary-output", true, state);
+
+    return ubus_invoke(ctx, gpio_id, "set", request_buf.head, NULL, NULL, 1000) == 0;
+}
+
+static bool
+writes_issued(struct ubus_context * const ctx, uint32_t const ext_id, uint64_t * const issued)
+{
+    reply_st reply = { .name = "issued" };
+
+    blob_buf_init(&request_buf, 0);
+
+    bool const success =
+        ubus_invoke(
+            ctx, ext_id, "write_counters", request_buf.head, reply_handler, &reply, 1000) == 0
+        && reply.found;
+
+    *issued = reply.value;
+
+    return success;
+}
+
+int
+main(int argc, char * * argv)
+{
+    int exit_code = EXIT_SUCCESS;
+    char const * const ubus_path = argc > 1 ? argv[1] : NULL;
+    struct ubus_context * ctx;
+    uint32_t gpio_id;
+    uint32_t ext_id;
+    size_t num_edges = 0;
+    size_t num_gets = 0;
+    size_t num_sets = 0;
+    size_t num_mismatches = 0;
+    uint64_t issued_before;
+    uint64_t issued_after;
+
+    uloop_init();
+    ctx = ubus_connect(ubus_path);
+    if (ctx == NULL
+        || ubus_lookup_id(ctx, "sysfs.gpio", &gpio_id) != 0
+        || ubus_lookup_id(ctx, "sysfs.gpio.ext", &ext_id) != 0
+        || simulate_input(ctx, ext_id, false) != 0)
+    {
+        printf("bench_memory_ubus: sysfs_gpio_module isn't running with the memory backend, skipped\n");
+        goto done;
+    }
+
+    ubus_add_uloop(ctx);
+    input_events.handler.cb = input_event_handler;
+    input_events.timeout.cb = event_timeout;
+    if (ubus_register_event_handler(ctx, &input_events.handler, INPUT_EVENT_ID) != 0
+        || !writes_issued(ctx, ext_id, &issued_before))
+    {
+        fprintf(stderr, "bench_memory_ubus: failed to set up\n");
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    /* Let the edge from setting the input low arrive, if there was one. */
+    wait_for_event(1);
+    input_events.count = 0;
+
+    for (size_t iteration = 0; iteration < ITERATIONS; iteration++)
+    {
+        /* Starting from low, every iteration is an edge. */
+        bool const state = iteration % 2 == 0;
+        uint64_t start_ns = now_ns();
+
+        if (simulate_input(ctx, ext_id, state) != 0 || !wait_for_event(iteration + 1))
+        {
+            num_mismatches++;
+            break;
+        }
+        edge_samples_ns[num_edges++] = input_events.received_ns - start_ns;
+        if (input_events.state != state)
+        {
+            num_mismatches++;
+        }
+
+        bool read_state;
+
+        start_ns = now_ns();
+        if (!get_input(ctx, gpio_id, &read_state) || read_state != state)
+        {
+            num_mismatches++;
+        }
+        get_samples_ns[num_gets++] = now_ns() - start_ns;
+
+        start_ns = now_ns();
+        if (!set_output(ctx, gpio_id, state))
+        {
+            num_mismatches++;
+        }
+        set_samples_ns[num_sets++] = now_ns() - start_ns;
+    }
+
+    /* binary-output 0 may already have been high, so the first set may be suppressed. */
+    if (!writes_issued(ctx, ext_id, &issued_after)
+        || issued_after - issued_before < num_sets - 1)
+    {
+        num_mismatches++;
+    }
+
+    printf("%d simulated edges on binary-input 0, each read back and written to binary-output 0\n",
+           ITERATIONS);
+    report("edge to event", edge_samples_ns, num_edges);
+    report("get", get_samples_ns, num_gets);
+    report("set", set_samples_ns, num_sets);
+    printf("%zu mismatches\n", num_mismatches);
+
+    if (num_mismatches > 0)
+    {
+        exit_code = EXIT_FAILURE;
+    }
+
+done:
+    if (ctx != NULL)
+    {
+        ubus_free(ctx);
+    }
+    blob_buf_free(&request_buf);
+    uloop_done();
+
+    return exit_code;
+}
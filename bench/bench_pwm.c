@@ -0,0 +1,239 @@
+/*
+ * Measure how late PWM edges are written to an output on the memory
+ * backend, when they are driven under uloop by pwm_output_set(), and when
+ * a client drives them by writing the output and sleeping for half a
+ * period (a uloop timeout) between writes.
+ * Each backend write is timestamped by wrapping gpio_backend_write() at
+ * link time (-Wl,--wrap=gpio_backend_write). A PWM edge is due at its
+ * absolute place in the schedule, and a client edge half a period after
+ * the edge before it. The client's drift from the absolute schedule, which
+ * grows with every edge, is reported separately.
+ */
+#include "../configuration.h"
+#include "../gpio_backend.h"
+#include "../output_state.h"
+#include "../pwm_output.h"
+#include "../monotonic.h"
+
+#include <libubox/uloop.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PERIOD_MS 2
+#define HALF_PERIOD_MS (PERIOD_MS / 2)
+#define HALF_PERIOD_NS (HALF_PERIOD_MS * 1000000ULL)
+#define NUM_EDGES 2000
+
+typedef struct edge_recorder_st
+{
+    bool recording;
+    bool pwm;
+    size_t num_edges;
+    uint64_t edge_ns[NUM_EDGES];
+    /* Edge number in the PWM schedule, which skips missed cycles. */
+    uint64_t schedule_edge[NUM_EDGES];
+} edge_recorder_st;
+
+static edge_recorder_st recorder;
+
+int __real_gpio_backend_write(size_t const gpio_number, bool const high);
+
+int
+__wrap_gpio_backend_write(size_t const gpio_number, bool const high)
+{
+    uint64_t const now_ns = monotonic_time_ns();
+    int const result = __real_gpio_backend_write(gpio_number, high);
+
+    if (!recorder.recording || recorder.num_edges >= NUM_EDGES)
+    {
+        goto done;
+    }
+
+    uint64_t schedule_edge = recorder.num_edges;
+
+    if (recorder.pwm)
+    {
+        pwm_output_jitter_st jitter;
+
+        /* Each missed cycle skips an on and an off edge. */
+        pwm_output_jitter(&jitter);
+        schedule_edge += 2 * jitter.missed_cycles;
+    }
+
+    recorder.edge_ns[recorder.num_edges] = now_ns;
+    recorder.schedule_edge[recorder.num_edges] = schedule_edge;
+    recorder.num_edges++;
+    if (recorder.num_edges == NUM_EDGES)
+    {
+        uloop_end();
+    }
+
+done:
+    return result;
+}
+
+static int
+compare_u64(void const * const a, void const * const b)
+{
+    uint64_t const lhs = *(uint64_t const *)a;
+    uint64_t const rhs = *(uint64_t const *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void
+report(char const * const name, uint64_t const start_ns)
+{
+    static uint64_t late_ns[NUM_EDGES];
+    size_t const count = recorder.num_edges;
+
+    if (count < 2)
+    {
+        printf("%-14s only %zu edges written\n", name, count);
+        goto done;
+    }
+
+    for (size_t edge = 0; edge < count; edge++)
+    {
+        uint64_t const due_ns = recorder.pwm
+            ? start_ns + recorder.schedule_edge[edge] * HALF_PERIOD_NS
+            : edge == 0 ? start_ns : recorder.edge_ns[edge - 1] + HALF_PERIOD_NS;
+
+        late_ns[edge] = recorder.edge_ns[edge] > due_ns ? recorder.edge_ns[edge] - due_ns : 0;
+    }
+
+    int64_t const drift_ns =
+        (int64_t)(recorder.edge_ns[count - 1] - (start_ns + (count - 1) * HALF_PERIOD_NS));
+
+    qsort(late_ns, count, sizeof late_ns[0], compare_u64);
+
+    printf("%-14s late p50 %8.1f us  p99 %8.1f us  max %8.1f us  drift %10.1f us\n",
+           name,
+           late_ns[count / 2] / 1000.0,
+           late_ns[count * 99 / 100] / 1000.0,
+           late_ns[count - 1] / 1000.0,
+           drift_ns / 1000.0);
+
+done:
+    return;
+}
+
+static void
+record_start(bool const pwm)
+{
+    recorder.recording = true;
+    recorder.pwm = pwm;
+    recorder.num_edges = 0;
+}
+
+static void
+run_pwm_output(void)
+{
+    pwm_output_jitter_st jitter;
+
+    output_state_write(0, false);
+    record_start(true);
+
+    /* Due times are taken from before the schedule starts, so are never early. */
+    uint64_t const start_ns = monotonic_time_ns();
+
+    if (!pwm_output_set(0, PERIOD_MS, 50.0))
+    {
+        fprintf(stderr, "Failed to start PWM\n");
+        exit(EXIT_FAILURE);
+    }
+    uloop_run();
+    pwm_output_cancel(0);
+    recorder.recording = false;
+
+    report("pwm_output", start_ns);
+    pwm_output_jitter(&jitter);
+    printf("%-14s missed cycles %llu\n", "", (unsigned long long)jitter.missed_cycles);
+}
+
+static bool client_level;
+
+static void
+client_timeout(struct uloop_timeout * const timeout)
+{
+    client_level = !client_level;
+    output_state_write(0, client_level);
+    uloop_timeout_set(timeout, HALF_PERIOD_MS);
+}
+
+static void
+run_client_sleep(void)
+{
+    struct uloop_timeout timeout = { .cb = client_timeout };
+
+    output_state_write(0, false);
+    client_level = false;
+    record_start(false);
+
+    uint64_t const start_ns = monotonic_time_ns();
+
+    client_timeout(&timeout);
+    uloop_run();
+    uloop_timeout_cancel(&timeout);
+    recorder.recording = false;
+
+    report("client sleep", start_ns);
+}
+
+int
+main(void)
+{
+    char config_path[] = "/tmp/bench_pwm.XXXXXX";
+    int const fd = mkstemp(config_path);
+    FILE * const file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    configuration_st * configuration;
+
+    if (file == NULL)
+    {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(file, "{\n    \"gpio\" : {\n");
+    fprintf(file, "        \"backend\" : \"memory\",\n");
+    fprintf(file, "        \"inputs\" : [ { \"gpio\" : 0 } ],\n");
+    fprintf(file, "        \"outputs\" : [ { \"gpio\" : 1, \"pwm_period_ms\" : %d } ]\n", PERIOD_MS);
+    fprintf(file, "    }\n}\n");
+    fclose(file);
+
+    configuration = configuration_load(config_path);
+    unlink(config_path);
+    if (configuration == NULL
+        || !gpio_backend_select(configuration_backend_name(configuration))
+        || !enable_gpio_pins(configuration)
+        || !output_state_start(configuration))
+    {
+        fprintf(stderr, "Failed to set up the memory backend\n");
+        return EXIT_FAILURE;
+    }
+
+    uloop_init();
+    if (!pwm_output_start(configuration))
+    {
+        fprintf(stderr, "Failed to start PWM outputs\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%d edges of a %d ms period, 50%% duty PWM on the memory backend\n",
+           NUM_EDGES, PERIOD_MS);
+
+    run_pwm_output();
+    run_client_sleep();
+
+    pwm_output_stop();
+    uloop_done();
+    output_state_stop();
+    disable_gpio_pins(configuration);
+    configuration_free(configuration);
+
+    return EXIT_SUCCESS;
+}
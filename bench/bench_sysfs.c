@@ -0,0 +1,537 @@
+/*
+ * Measure the sysfs backend against a fake /sys/class/gpio tree built on
+ * tmpfs, and the in-memory backend for comparison. Covers:
+ * - loading configurations of 16, 256 and 4096 pins,
+ * - export and direction setup of that many pins, where the pins already
+ *   exported are skipped, and the 4096 pins are spread over four chips
+ *   that are set up in parallel,
+ * - single and bulk GPIO reads and writes, with bulk operations issued
+ *   one pin at a time through the cached value fds, and batched with
+ *   io_uring,
+ * - the same operations run on the worker pool, timed until their
+ *   completions are called from uloop, on pins spread over two chips.
+ * Files in the fake tree behave as plain files, so this measures the cost
+ * of the application's own file handling rather than of any GPIO driver.
+ *
+ * Usage: bench_sysfs [directory to build the fake tree in]
+ */
+#include "../configuration.h"
+#include "../gpio_backend.h"
+#include "../sysfs_gpio_module.h"
+#include "../gpio_worker_pool.h"
+#include "../pin_bitmap.h"
+
+#include <libubox/uloop.h>
+
+#include <ftw.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PINS 4096
+#define PINS_PER_CHIP 1024
+#define CONFIG_LOADS 50
+#define SETUP_RUNS 5
+#define IO_PINS 256
+#define BULK_PINS (IO_PINS / 2)
+#define IO_ITERATIONS 100000
+#define BULK_ITERATIONS 2000
+#define POOL_ITERATIONS 10000
+
+static size_t const pin_counts[] = { 16, 256, 4096 };
+static size_t const bulk_counts[] = { 8, 32, BULK_PINS };
+
+static uint64_t samples_ns[IO_ITERATIONS];
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int
+compare_u64(void const * const a, void const * const b)
+{
+    uint64_t const lhs = *(uint64_t const *)a;
+    uint64_t const rhs = *(uint64_t const *)b;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/* Also reports throughput, from the total time taken by count operations. */
+static void
+report(char const * const name, size_t const count, size_t const ops_per_sample)
+{
+    uint64_t total_ns = 0;
+
+    for (size_t index = 0; index < count; index++)
+    {
+        total_ns += samples_ns[index];
+    }
+    qsort(samples_ns, count, sizeof samples_ns[0], compare_u64);
+
+    printf("%-32s p50 %9.2f us  p99 %9.2f us  max %9.2f us  %10.0f pins/s\n",
+           name,
+           samples_ns[count / 2] / 1000.0,
+           samples_ns[count * 99 / 100] / 1000.0,
+           samples_ns[count - 1] / 1000.0,
+           total_ns > 0 ? count * ops_per_sample * 1e9 / total_ns : 0.0);
+}
+
+static void
+write_file(char const * const path, char const * const contents)
+{
+    FILE * const file = fopen(path, "w");
+
+    if (file == NULL || fputs(contents, file) == EOF)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+}
+
+static void
+make_directory(char const * const path)
+{
+    if (mkdir(path, 0755) < 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * The files the sysfs backend uses, for pins 0 to MAX_PINS - 1 spread over
+ * chips of PINS_PER_CHIP. Every pin is already exported.
+ */
+static void
+make_fake_tree(char const * const root)
+{
+    char path[PATH_MAX];
+    char contents[32];
+
+    snprintf(path, sizeof path, "%s/export", root);
+    write_file(path, "");
+    snprintf(path, sizeof path, "%s/unexport", root);
+    write_file(path, "");
+
+    for (size_t base = 0; base < MAX_PINS; base += PINS_PER_CHIP)
+    {
+        snprintf(path, sizeof path, "%s/gpiochip%zu", root, base);
+        make_directory(path);
+        snprintf(path, sizeof path, "%s/gpiochip%zu/base", root, base);
+        snprintf(contents, sizeof contents, "%zu\n", base);
+        write_file(path, contents);
+        snprintf(path, sizeof path, "%s/gpiochip%zu/ngpio", root, base);
+        snprintf(contents, sizeof contents, "%d\n", PINS_PER_CHIP);
+        write_file(path, contents);
+    }
+
+    for (size_t pin = 0; pin < MAX_PINS; pin++)
+    {
+        static char const * const files[][2] =
+        {
+            { "value", "0\n" },
+            { "direction", "in\n" },
+            { "edge", "none\n" }
+        };
+
+        snprintf(path, sizeof path, "%s/gpio%zu", root, pin);
+        make_directory(path);
+        for (size_t index = 0; index < sizeof files / sizeof files[0]; index++)
+        {
+            snprintf(path, sizeof path, "%s/gpio%zu/%s", root, pin, files[index][0]);
+            write_file(path, files[index][1]);
+        }
+    }
+}
+
+static int
+remove_entry(char const * const path, struct stat const * const sb, int const flag, struct FTW * const ftw)
+{
+    return remove(path);
+}
+
+/* Half of the pins are inputs and half outputs. */
+static void
+write_config(
+    char const * const path,
+    char const * const backend,
+    char const * const base_path,
+    size_t const num_pins,
+    bool const worker_pool)
+{
+    FILE * const file = fopen(path, "w");
+
+    if (file == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file, "{\n    \"gpio\" : {\n");
+    fprintf(file, "        \"backend\" : \"%s\",\n", backend);
+    fprintf(file, "        \"base_path\" : \"%s\",\n", base_path);
+    fprintf(file, "        \"force_writes\" : true,\n");
+    fprintf(file, "        \"worker_pool\" : %s,\n", worker_pool ? "true" : "false");
+    fprintf(file, "        \"inputs\" : [\n");
+    for (size_t pin = 0; pin < num_pins / 2; pin++)
+    {
+        fprintf(file, "            { \"gpio\" : %zu }%s\n", pin, pin + 1 < num_pins / 2 ? "," : "");
+    }
+    fprintf(file, "        ],\n        \"outputs\" : [\n");
+    for (size_t pin = num_pins / 2; pin < num_pins; pin++)
+    {
+        fprintf(file, "            { \"gpio\" : %zu }%s\n", pin, pin + 1 < num_pins ? "," : "");
+    }
+    fprintf(file, "        ]\n    }\n}\n");
+    fclose(file);
+}
+
+static configuration_st *
+load_config(char const * const path)
+{
+    configuration_st * const configuration = configuration_load(path);
+
+    if (configuration == NULL)
+    {
+        fprintf(stderr, "Failed to load %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    return configuration;
+}
+
+static void
+bench_config_load(char const * const config_path, size_t const num_pins)
+{
+    char name[64];
+
+    for (size_t run = 0; run < CONFIG_LOADS; run++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        configuration_free(load_config(config_path));
+        samples_ns[run] = now_ns() - start_ns;
+    }
+
+    snprintf(name, sizeof name, "config load %zu pins", num_pins);
+    report(name, CONFIG_LOADS, num_pins);
+}
+
+static void
+bench_setup(char const * const config_path, size_t const num_pins)
+{
+    char name[64];
+    static uint64_t teardown_ns[SETUP_RUNS];
+
+    for (size_t run = 0; run < SETUP_RUNS; run++)
+    {
+        configuration_st * const configuration = load_config(config_path);
+        uint64_t const start_ns = now_ns();
+
+        if (!enable_gpio_pins(configuration))
+        {
+            fprintf(stderr, "Failed to set up %zu pins\n", num_pins);
+            exit(EXIT_FAILURE);
+        }
+        samples_ns[run] = now_ns() - start_ns;
+
+        uint64_t const stop_ns = now_ns();
+
+        disable_gpio_pins(configuration);
+        teardown_ns[run] = now_ns() - stop_ns;
+        configuration_free(configuration);
+    }
+
+    gpio_startup_st startup;
+
+    gpio_backend_startup(&startup);
+    snprintf(name, sizeof name, "setup %zu pins, %zu chips", num_pins, startup.num_chips);
+    report(name, SETUP_RUNS, num_pins);
+    memcpy(samples_ns, teardown_ns, sizeof teardown_ns);
+    snprintf(name, sizeof name, "teardown %zu pins", num_pins);
+    report(name, SETUP_RUNS, num_pins);
+}
+
+/* Inputs are read from pins 0 up, and outputs written from BULK_PINS up. */
+static void
+bench_bulk(char const * const backend, size_t const count)
+{
+    char name[64];
+    size_t gpio_numbers[BULK_PINS];
+    uint64_t state_words[(BULK_PINS + PIN_BITMAP_WORD_BITS - 1) / PIN_BITMAP_WORD_BITS];
+
+    for (size_t index = 0; index < count; index++)
+    {
+        gpio_numbers[index] = index;
+    }
+    for (size_t iteration = 0; iteration < BULK_ITERATIONS; iteration++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        gpio_backend_read_bulk(gpio_numbers, count, state_words);
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s read_bulk %zu", backend, count);
+    report(name, BULK_ITERATIONS, count);
+
+    for (size_t index = 0; index < count; index++)
+    {
+        gpio_numbers[index] = BULK_PINS + index;
+    }
+    for (size_t iteration = 0; iteration < BULK_ITERATIONS; iteration++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        memset(state_words, iteration & 1 ? 0xff : 0, sizeof state_words);
+        gpio_backend_write_bulk(gpio_numbers, state_words, count);
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s write_bulk %zu", backend, count);
+    report(name, BULK_ITERATIONS, count);
+}
+
+static void
+bench_io(char const * const backend, char const * const config_path)
+{
+    char name[64];
+    configuration_st * const configuration = load_config(config_path);
+
+    if (!gpio_backend_select(backend) || !enable_gpio_pins(configuration))
+    {
+        fprintf(stderr, "Failed to set up the %s backend\n", backend);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t iteration = 0; iteration < IO_ITERATIONS; iteration++)
+    {
+        size_t const pin = iteration % BULK_PINS;
+        bool state;
+        uint64_t const start_ns = now_ns();
+
+        gpio_backend_read(pin, &state);
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s read", backend);
+    report(name, IO_ITERATIONS, 1);
+
+    for (size_t iteration = 0; iteration < IO_ITERATIONS; iteration++)
+    {
+        size_t const pin = BULK_PINS + iteration % BULK_PINS;
+        uint64_t const start_ns = now_ns();
+
+        gpio_backend_write(pin, iteration & 1);
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s write", backend);
+    report(name, IO_ITERATIONS, 1);
+
+    for (size_t index = 0; index < sizeof bulk_counts / sizeof bulk_counts[0]; index++)
+    {
+        bench_bulk(backend, bulk_counts[index]);
+    }
+
+    disable_gpio_pins(configuration);
+    configuration_free(configuration);
+}
+
+static int pool_result;
+
+static void
+pool_done(void * const ctx, int const result)
+{
+    pool_result = result;
+    uloop_end();
+}
+
+/* Wait in uloop for the completion of an operation submitted to the pool. */
+static void
+pool_wait(bool const submitted, char const * const operation)
+{
+    if (!submitted)
+    {
+        fprintf(stderr, "Failed to submit %s to the worker pool\n", operation);
+        exit(EXIT_FAILURE);
+    }
+    uloop_run();
+    if (pool_result < 0)
+    {
+        fprintf(stderr, "Worker pool %s failed\n", operation);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* count pins from first, alternately on the first chip and the one after. */
+static void
+spread_pins(size_t * const gpio_numbers, size_t const count, size_t const first)
+{
+    for (size_t index = 0; index < count; index++)
+    {
+        gpio_numbers[index] = first + (index % 2) * PINS_PER_CHIP + index / 2;
+    }
+}
+
+static void
+bench_pool_bulk(char const * const backend, size_t const count)
+{
+    char name[64];
+    size_t gpio_numbers[BULK_PINS];
+    uint64_t state_words[(BULK_PINS + PIN_BITMAP_WORD_BITS - 1) / PIN_BITMAP_WORD_BITS];
+
+    /* Inputs are on the first two chips, and outputs on the last two. */
+    spread_pins(gpio_numbers, count, 0);
+    for (size_t iteration = 0; iteration < BULK_ITERATIONS; iteration++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        gpio_backend_read_bulk(gpio_numbers, count, state_words);
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s direct read_bulk %zu", backend, count);
+    report(name, BULK_ITERATIONS, count);
+
+    for (size_t iteration = 0; iteration < BULK_ITERATIONS; iteration++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        pool_wait(
+            gpio_worker_pool_read_bulk(
+                gpio_numbers, count, state_words, NULL, pool_done, NULL),
+            "read_bulk");
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s pool read_bulk %zu", backend, count);
+    report(name, BULK_ITERATIONS, count);
+
+    spread_pins(gpio_numbers, count, MAX_PINS / 2);
+    for (size_t iteration = 0; iteration < BULK_ITERATIONS; iteration++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        memset(state_words, iteration & 1 ? 0xff : 0, sizeof state_words);
+        gpio_backend_write_bulk(gpio_numbers, state_words, count);
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s direct write_bulk %zu", backend, count);
+    report(name, BULK_ITERATIONS, count);
+
+    for (size_t iteration = 0; iteration < BULK_ITERATIONS; iteration++)
+    {
+        uint64_t const start_ns = now_ns();
+
+        memset(state_words, iteration & 1 ? 0xff : 0, sizeof state_words);
+        pool_wait(
+            gpio_worker_pool_write_bulk(
+                gpio_numbers, state_words, count, pool_done, NULL),
+            "write_bulk");
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s pool write_bulk %zu", backend, count);
+    report(name, BULK_ITERATIONS, count);
+}
+
+/* The pool reads and writes are timed from submission to completion. */
+static void
+bench_pool(char const * const backend, char const * const config_path)
+{
+    char name[64];
+    configuration_st * const configuration = load_config(config_path);
+
+    if (!gpio_backend_select(backend)
+        || !enable_gpio_pins(configuration)
+        || !gpio_worker_pool_start(configuration)
+        || !gpio_worker_pool_is_running())
+    {
+        fprintf(stderr, "Failed to start the worker pool on the %s backend\n", backend);
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t iteration = 0; iteration < POOL_ITERATIONS; iteration++)
+    {
+        size_t const pin = MAX_PINS / 2 + iteration % BULK_PINS;
+        uint64_t const start_ns = now_ns();
+
+        pool_wait(gpio_worker_pool_write(pin, iteration & 1, pool_done, NULL), "write");
+        samples_ns[iteration] = now_ns() - start_ns;
+    }
+    snprintf(name, sizeof name, "%s pool write", backend);
+    report(name, POOL_ITERATIONS, 1);
+
+    for (size_t index = 0; index < sizeof bulk_counts / sizeof bulk_counts[0]; index++)
+    {
+        bench_pool_bulk(backend, bulk_counts[index]);
+    }
+
+    gpio_worker_pool_stop();
+    disable_gpio_pins(configuration);
+    configuration_free(configuration);
+}
+
+int
+main(int argc, char * * argv)
+{
+    char root[PATH_MAX];
+    char config_path[PATH_MAX + 32];
+    struct rlimit files;
+
+    /* tmpfs keeps the fake tree's file operations cheap, as sysfs ones are. */
+    snprintf(root, sizeof root, "%s/bench_sysfs.XXXXXX", argc > 1 ? argv[1] : "/dev/shm");
+    if (mkdtemp(root) == NULL)
+    {
+        snprintf(root, sizeof root, "/tmp/bench_sysfs.XXXXXX");
+        if (mkdtemp(root) == NULL)
+        {
+            perror("mkdtemp");
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* The sysfs backend keeps each pin's value file open. */
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < MAX_PINS + 64)
+    {
+        files.rlim_cur = files.rlim_max < MAX_PINS + 64 ? files.rlim_max : MAX_PINS + 64;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    printf("Fake GPIO tree in %s\n", root);
+    make_fake_tree(root);
+    snprintf(config_path, sizeof config_path, "%s/config.json", root);
+
+    gpio_backend_select("sysfs");
+    for (size_t index = 0; index < sizeof pin_counts / sizeof pin_counts[0]; index++)
+    {
+        write_config(config_path, "sysfs", root, pin_counts[index], false);
+        bench_config_load(config_path, pin_counts[index]);
+        bench_setup(config_path, pin_counts[index]);
+    }
+
+    write_config(config_path, "sysfs", root, IO_PINS, false);
+    bench_io("sysfs", config_path);
+    write_config(config_path, "sysfs-uring", root, IO_PINS, false);
+    bench_io("sysfs-uring", config_path);
+    write_config(config_path, "memory", root, IO_PINS, false);
+    bench_io("memory", config_path);
+
+    uloop_init();
+    write_config(config_path, "sysfs", root, MAX_PINS, true);
+    bench_pool("sysfs", config_path);
+    write_config(config_path, "sysfs-uring", root, MAX_PINS, true);
+    bench_pool("sysfs-uring", config_path);
+    uloop_done();
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    return EXIT_SUCCESS;
+}
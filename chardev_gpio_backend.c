@@ -0,0 +1,891 @@
+#include "chardev_gpio_backend.h"
+#include "pin_bitmap.h"
+
+#include <libubox/uloop.h>
+
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_CHIP_PATH "/dev/gpiochip0"
+#define CONSUMER_NAME "sysfs_gpio_module"
+
+typedef bool (*gpio_number_getter_fn)(
+    configuration_st const * configuration,
+    size_t index,
+    size_t * gpio_number);
+
+typedef bool (*initial_state_getter_fn)(
+    configuration_st const * configuration,
+    size_t index,
+    bool * state);
+
+typedef struct chardev_line_request_st
+{
+    /* Edge events for all lines in the request are read from this fd. */
+    struct uloop_fd uloop_fd;
+    bool outgoing;
+    size_t num_lines;
+    size_t num_watched;
+    unsigned int offsets[GPIO_V2_LINES_MAX];
+} chardev_line_request_st;
+
+typedef struct chardev_line_st
+{
+    /* -1 if the line hasn't been requested. */
+    int request_index;
+    unsigned int bit;
+    gpio_edge_t edge;
+    gpio_edge_callback_fn callback;
+    void * callback_ctx;
+} chardev_line_st;
+
+/* Output levels noted while the lines are requested again. */
+typedef struct chardev_held_outputs_st
+{
+    /* Indexed by line offset. */
+    size_t num_lines;
+    uint64_t * output_words;
+    uint64_t * level_words;
+} chardev_held_outputs_st;
+
+typedef struct chardev_context_st
+{
+    int chip_fd;
+    char chip_path[64];
+    configuration_st const * configuration;
+
+    size_t num_requests;
+    chardev_line_request_st * requests;
+
+    /* Indexed by line offset. */
+    size_t num_lines;
+    chardev_line_st * lines;
+
+    chardev_held_outputs_st held_outputs;
+} chardev_context_st;
+
+static chardev_context_st chardev_context =
+{
+    .chip_fd = -1
+};
+
+static size_t
+num_requests_needed(size_t const num_lines)
+{
+    return (num_lines + GPIO_V2_LINES_MAX - 1) / GPIO_V2_LINES_MAX;
+}
+
+static chardev_line_st const *
+chardev_line_lookup(size_t const gpio_number)
+{
+    chardev_line_st const * line;
+
+    if (gpio_number >= chardev_context.num_lines)
+    {
+        line = NULL;
+        goto done;
+    }
+
+    line = &chardev_context.lines[gpio_number];
+    if (line->request_index < 0)
+    {
+        line = NULL;
+        goto done;
+    }
+
+done:
+    return line;
+}
+
+static void
+chip_path(char const * const chip_name, char * const path, size_t const path_size)
+{
+    if (chip_name == NULL)
+    {
+        snprintf(path, path_size, "%s", DEFAULT_CHIP_PATH);
+    }
+    else if (strchr(chip_name, '/') == NULL)
+    {
+        /* Allow just the chip name (e.g. "gpiochip1") to be specified. */
+        snprintf(path, path_size, "/dev/%s", chip_name);
+    }
+    else
+    {
+        snprintf(path, path_size, "%s", chip_name);
+    }
+}
+
+static int
+open_chip(char const * const chip_name)
+{
+    chip_path(chip_name, chardev_context.chip_path, sizeof chardev_context.chip_path);
+
+    int const fd = open(chardev_context.chip_path, O_RDWR | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open GPIO chip %s!\n", chardev_context.chip_path);
+    }
+
+    return fd;
+}
+
+static bool
+request_lines(
+    configuration_st const * const configuration,
+    size_t const num_gpio,
+    gpio_number_getter_fn const get_gpio_number,
+    initial_state_getter_fn const get_initial_state,
+    bool const outgoing)
+{
+    bool success;
+
+    for (size_t first = 0; first < num_gpio; first += GPIO_V2_LINES_MAX)
+    {
+        struct gpio_v2_line_request request;
+        int const request_index = chardev_context.num_requests;
+        uint64_t initial_values = 0;
+
+        memset(&request, 0, sizeof request);
+
+        for (size_t index = first;
+             index < num_gpio && request.num_lines < GPIO_V2_LINES_MAX;
+             index++)
+        {
+            size_t gpio_number;
+
+            if (!get_gpio_number(configuration, index, &gpio_number)
+                || gpio_number >= chardev_context.num_lines)
+            {
+                success = false;
+                goto done;
+            }
+
+            chardev_line_st * const line = &chardev_context.lines[gpio_number];
+
+            if (line->request_index >= 0)
+            {
+                fprintf(stderr, "GPIO line %zu is configured more than once!\n", gpio_number);
+                success = false;
+                goto done;
+            }
+            line->request_index = request_index;
+            line->bit = request.num_lines;
+
+            bool high;
+
+            if (get_initial_state != NULL
+                && get_initial_state(configuration, index, &high)
+                && high)
+            {
+                initial_values |= UINT64_C(1) << request.num_lines;
+            }
+
+            request.offsets[request.num_lines] = gpio_number;
+            request.num_lines++;
+        }
+
+        snprintf(request.consumer, sizeof request.consumer, "%s", CONSUMER_NAME);
+        request.config.flags =
+            outgoing ? GPIO_V2_LINE_FLAG_OUTPUT : GPIO_V2_LINE_FLAG_INPUT;
+        if (outgoing)
+        {
+            /*
+             * Output lines are driven at their initial levels as soon as
+             * they're requested, rather than low and then set.
+             */
+            request.config.num_attrs = 1;
+            request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+            request.config.attrs[0].attr.values = initial_values;
+            request.config.attrs[0].mask =
+                request.num_lines == 64 ? UINT64_MAX : (UINT64_C(1) << request.num_lines) - 1;
+        }
+
+        if (ioctl(chardev_context.chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) < 0)
+        {
+            fprintf(stderr, "Failed to request GPIO lines!\n");
+            success = false;
+            goto done;
+        }
+
+        chardev_line_request_st * const line_request =
+            &chardev_context.requests[request_index];
+
+        line_request->uloop_fd.fd = request.fd;
+        line_request->outgoing = outgoing;
+        line_request->num_lines = request.num_lines;
+        memcpy(line_request->offsets, request.offsets, sizeof line_request->offsets);
+        chardev_context.num_requests++;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static void
+release_lines(void)
+{
+    for (size_t index = 0; index < chardev_context.num_requests; index++)
+    {
+        chardev_line_request_st * const line_request = &chardev_context.requests[index];
+
+        if (line_request->uloop_fd.registered)
+        {
+            uloop_fd_delete(&line_request->uloop_fd);
+        }
+        close(line_request->uloop_fd.fd);
+    }
+    free(chardev_context.requests);
+    chardev_context.requests = NULL;
+    chardev_context.num_requests = 0;
+
+    free(chardev_context.lines);
+    chardev_context.lines = NULL;
+    chardev_context.num_lines = 0;
+}
+
+static void
+chardev_close(void)
+{
+    release_lines();
+
+    if (chardev_context.chip_fd >= 0)
+    {
+        close(chardev_context.chip_fd);
+        chardev_context.chip_fd = -1;
+    }
+    chardev_context.configuration = NULL;
+}
+
+static bool
+request_configured_lines(
+    configuration_st const * const configuration,
+    initial_state_getter_fn const get_output_state)
+{
+    bool success;
+    size_t const num_inputs = configuration_num_inputs(configuration);
+    size_t const num_outputs = configuration_num_outputs(configuration);
+    size_t const num_counters = configuration_num_counters(configuration);
+
+    chardev_context.num_lines = configuration_highest_gpio_number(configuration) + 1;
+    chardev_context.lines =
+        calloc(chardev_context.num_lines, sizeof *chardev_context.lines);
+    chardev_context.requests =
+        calloc(num_requests_needed(num_inputs)
+               + num_requests_needed(num_outputs)
+               + num_requests_needed(num_counters),
+               sizeof *chardev_context.requests);
+    if (chardev_context.lines == NULL || chardev_context.requests == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < chardev_context.num_lines; index++)
+    {
+        chardev_context.lines[index].request_index = -1;
+    }
+
+    if (!request_lines(configuration, num_inputs, configuration_input_gpio_number, NULL, false))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!request_lines(
+            configuration,
+            num_outputs,
+            configuration_output_gpio_number,
+            get_output_state,
+            true))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!request_lines(configuration, num_counters, configuration_counter_gpio_number, NULL, false))
+    {
+        success = false;
+        goto done;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+chardev_open(configuration_st const * const configuration)
+{
+    bool success;
+
+    chardev_context.chip_fd = open_chip(configuration_chip_name(configuration));
+    if (chardev_context.chip_fd < 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!request_configured_lines(configuration, configuration_output_initial_state))
+    {
+        success = false;
+        goto done;
+    }
+    chardev_context.configuration = configuration;
+
+    success = true;
+
+done:
+    if (!success)
+    {
+        chardev_close();
+    }
+
+    return success;
+}
+
+static void
+held_outputs_free(void)
+{
+    chardev_held_outputs_st * const held = &chardev_context.held_outputs;
+
+    free(held->output_words);
+    held->output_words = NULL;
+    free(held->level_words);
+    held->level_words = NULL;
+    held->num_lines = 0;
+}
+
+/* Note the level each output line is being driven at. */
+static bool
+hold_outputs(void)
+{
+    bool success;
+    chardev_held_outputs_st * const held = &chardev_context.held_outputs;
+    size_t const num_words = pin_bitmap_num_words(chardev_context.num_lines);
+
+    held->num_lines = chardev_context.num_lines;
+    held->output_words = calloc(num_words, sizeof *held->output_words);
+    held->level_words = calloc(num_words, sizeof *held->level_words);
+    if (held->output_words == NULL || held->level_words == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < chardev_context.num_requests; index++)
+    {
+        chardev_line_request_st const * const line_request = &chardev_context.requests[index];
+
+        if (!line_request->outgoing)
+        {
+            continue;
+        }
+
+        struct gpio_v2_line_values values =
+        {
+            .mask = line_request->num_lines == 64
+                ? UINT64_MAX : (UINT64_C(1) << line_request->num_lines) - 1
+        };
+
+        if (ioctl(line_request->uloop_fd.fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+        {
+            fprintf(stderr, "Failed to read GPIO output lines!\n");
+            success = false;
+            goto done;
+        }
+
+        for (size_t bit = 0; bit < line_request->num_lines; bit++)
+        {
+            unsigned int const offset = line_request->offsets[bit];
+
+            pin_bitmap_assign(held->output_words, offset, true);
+            pin_bitmap_assign(held->level_words, offset, (values.bits >> bit) & 1);
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+/* A line that was already an output is requested at its current level. */
+static bool
+held_output_state(
+    configuration_st const * const configuration,
+    size_t const index,
+    bool * const state)
+{
+    bool success;
+    chardev_held_outputs_st const * const held = &chardev_context.held_outputs;
+    size_t gpio_number;
+
+    if (configuration_output_gpio_number(configuration, index, &gpio_number)
+        && gpio_number < held->num_lines
+        && pin_bitmap_get(held->output_words, gpio_number))
+    {
+        *state = pin_bitmap_get(held->level_words, gpio_number);
+        success = true;
+    }
+    else
+    {
+        success = configuration_output_initial_state(configuration, index, state);
+    }
+
+    return success;
+}
+
+/*
+ * Lines can't be added to or removed from a request, so all of them are
+ * released and requested again. Outputs are requested at the levels they
+ * were driving, rather than glitching back to their initial levels. No
+ * edges are watched during a reload.
+ */
+static bool
+chardev_reconfigure(configuration_st const * const configuration)
+{
+    bool success;
+    configuration_st const * const previous = chardev_context.configuration;
+    char next_chip_path[sizeof chardev_context.chip_path];
+
+    chip_path(configuration_chip_name(configuration), next_chip_path, sizeof next_chip_path);
+    if (strcmp(next_chip_path, chardev_context.chip_path) != 0)
+    {
+        fprintf(stderr, "The GPIO chip can't be changed by a reload!\n");
+        success = false;
+        goto done;
+    }
+
+    if (!hold_outputs())
+    {
+        success = false;
+        goto done;
+    }
+
+    release_lines();
+    if (request_configured_lines(configuration, held_output_state))
+    {
+        chardev_context.configuration = configuration;
+        success = true;
+        goto done;
+    }
+
+    /* Go back to the lines that were working, still at their levels. */
+    release_lines();
+    if (!request_configured_lines(previous, held_output_state))
+    {
+        fprintf(stderr, "Failed to request the previous configuration's GPIO lines again!\n");
+    }
+    success = false;
+
+done:
+    held_outputs_free();
+
+    return success;
+}
+
+static int
+chardev_read(size_t const gpio_number, bool * const state)
+{
+    int result;
+    chardev_line_st const * const line = chardev_line_lookup(gpio_number);
+
+    if (line == NULL)
+    {
+        result = -1;
+        goto done;
+    }
+
+    struct gpio_v2_line_values values =
+    {
+        .mask = UINT64_C(1) << line->bit
+    };
+
+    if (ioctl(chardev_context.requests[line->request_index].uloop_fd.fd,
+              GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+    {
+        fprintf(stderr, "Failed to read value!\n");
+        result = -1;
+        goto done;
+    }
+
+    *state = (values.bits & values.mask) != 0;
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+chardev_write(size_t const gpio_number, bool const high)
+{
+    int result;
+    chardev_line_st const * const line = chardev_line_lookup(gpio_number);
+
+    if (line == NULL || !chardev_context.requests[line->request_index].outgoing)
+    {
+        result = -1;
+        goto done;
+    }
+
+    struct gpio_v2_line_values values =
+    {
+        .mask = UINT64_C(1) << line->bit,
+        .bits = high ? UINT64_C(1) << line->bit : 0
+    };
+
+    if (ioctl(chardev_context.requests[line->request_index].uloop_fd.fd,
+              GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+    {
+        fprintf(stderr, "Failed to write value!\n");
+        result = -1;
+        goto done;
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static bool
+lines_are_requested(
+    size_t const * const gpio_numbers,
+    size_t const count,
+    bool const outgoing)
+{
+    bool requested;
+
+    for (size_t index = 0; index < count; index++)
+    {
+        chardev_line_st const * const line = chardev_line_lookup(gpio_numbers[index]);
+
+        if (line == NULL
+            || (outgoing && !chardev_context.requests[line->request_index].outgoing))
+        {
+            requested = false;
+            goto done;
+        }
+    }
+
+    requested = true;
+
+done:
+    return requested;
+}
+
+/*
+ * The lines to access may be spread across several line requests.
+ * Each request is accessed with a single ioctl covering all of the
+ * lines it holds.
+ */
+static int
+chardev_read_bulk(size_t const * const gpio_numbers, size_t const count, uint64_t * const state_words)
+{
+    int result;
+
+    if (!lines_are_requested(gpio_numbers, count, false))
+    {
+        result = -1;
+        goto done;
+    }
+
+    for (size_t request_index = 0; request_index < chardev_context.num_requests; request_index++)
+    {
+        struct gpio_v2_line_values values = { 0 };
+
+        for (size_t index = 0; index < count; index++)
+        {
+            chardev_line_st const * const line = chardev_line_lookup(gpio_numbers[index]);
+
+            if ((size_t)line->request_index == request_index)
+            {
+                values.mask |= UINT64_C(1) << line->bit;
+            }
+        }
+
+        if (values.mask == 0)
+        {
+            continue;
+        }
+
+        if (ioctl(chardev_context.requests[request_index].uloop_fd.fd,
+                  GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0)
+        {
+            fprintf(stderr, "Failed to read values!\n");
+            result = -1;
+            goto done;
+        }
+
+        for (size_t index = 0; index < count; index++)
+        {
+            chardev_line_st const * const line = chardev_line_lookup(gpio_numbers[index]);
+
+            if ((size_t)line->request_index == request_index)
+            {
+                pin_bitmap_assign(
+                    state_words, index, (values.bits & (UINT64_C(1) << line->bit)) != 0);
+            }
+        }
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+chardev_write_bulk(size_t const * const gpio_numbers, uint64_t const * const state_words, size_t const count)
+{
+    int result;
+
+    if (!lines_are_requested(gpio_numbers, count, true))
+    {
+        result = -1;
+        goto done;
+    }
+
+    result = 0;
+    for (size_t request_index = 0; request_index < chardev_context.num_requests; request_index++)
+    {
+        struct gpio_v2_line_values values = { 0 };
+
+        for (size_t index = 0; index < count; index++)
+        {
+            chardev_line_st const * const line = chardev_line_lookup(gpio_numbers[index]);
+
+            if ((size_t)line->request_index == request_index)
+            {
+                uint64_t const bit = UINT64_C(1) << line->bit;
+
+                values.mask |= bit;
+                if (pin_bitmap_get(state_words, index))
+                {
+                    values.bits |= bit;
+                }
+            }
+        }
+
+        if (values.mask == 0)
+        {
+            continue;
+        }
+
+        if (ioctl(chardev_context.requests[request_index].uloop_fd.fd,
+                  GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+        {
+            fprintf(stderr, "Failed to write values!\n");
+            result = -1;
+        }
+    }
+
+done:
+    return result;
+}
+
+static uint64_t
+edge_flags(gpio_edge_t const edge)
+{
+    uint64_t flags;
+
+    switch (edge)
+    {
+        case gpio_edge_rising:
+            flags = GPIO_V2_LINE_FLAG_EDGE_RISING;
+            break;
+        case gpio_edge_falling:
+            flags = GPIO_V2_LINE_FLAG_EDGE_FALLING;
+            break;
+        case gpio_edge_both:
+            flags = GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+            break;
+        case gpio_edge_none:
+        default:
+            flags = 0;
+            break;
+    }
+
+    return flags;
+}
+
+/*
+ * Apply the edge settings of each line in an input request. Lines sharing
+ * the same edge setting share a single configuration attribute.
+ */
+static int
+reconfigure_input_request(chardev_line_request_st const * const line_request)
+{
+    int result;
+    uint64_t edge_masks[gpio_edge_both + 1] = { 0 };
+    struct gpio_v2_line_config config;
+
+    memset(&config, 0, sizeof config);
+    config.flags = GPIO_V2_LINE_FLAG_INPUT;
+
+    for (size_t bit = 0; bit < line_request->num_lines; bit++)
+    {
+        chardev_line_st const * const line =
+            &chardev_context.lines[line_request->offsets[bit]];
+
+        edge_masks[line->edge] |= UINT64_C(1) << bit;
+    }
+
+    for (size_t edge = gpio_edge_rising; edge <= gpio_edge_both; edge++)
+    {
+        if (edge_masks[edge] == 0)
+        {
+            continue;
+        }
+
+        struct gpio_v2_line_config_attribute * const attr = &config.attrs[config.num_attrs];
+
+        attr->attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        attr->attr.flags = GPIO_V2_LINE_FLAG_INPUT | edge_flags(edge);
+        attr->mask = edge_masks[edge];
+        config.num_attrs++;
+    }
+
+    if (ioctl(line_request->uloop_fd.fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+    {
+        fprintf(stderr, "Failed to configure GPIO line edges!\n");
+        result = -1;
+        goto done;
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static void
+chardev_edge_event(struct uloop_fd * const uloop_fd, unsigned int const events)
+{
+    struct gpio_v2_line_event line_events[16];
+    ssize_t bytes_read;
+
+    while ((bytes_read = read(uloop_fd->fd, line_events, sizeof line_events)) > 0)
+    {
+        size_t const num_events = bytes_read / sizeof line_events[0];
+
+        for (size_t index = 0; index < num_events; index++)
+        {
+            struct gpio_v2_line_event const * const event = &line_events[index];
+            chardev_line_st const * const line = chardev_line_lookup(event->offset);
+
+            if (line == NULL || line->callback == NULL)
+            {
+                continue;
+            }
+
+            line->callback(
+                line->callback_ctx,
+                event->offset,
+                event->id == GPIO_V2_LINE_EVENT_RISING_EDGE,
+                event->timestamp_ns);
+        }
+    }
+}
+
+static int
+chardev_watch_edge(
+    size_t const gpio_number,
+    gpio_edge_t const edge,
+    gpio_edge_callback_fn const callback,
+    void * const callback_ctx)
+{
+    int result;
+    chardev_line_st const * const requested_line = chardev_line_lookup(gpio_number);
+
+    if (requested_line == NULL || edge == gpio_edge_none)
+    {
+        result = -1;
+        goto done;
+    }
+
+    chardev_line_st * const line = &chardev_context.lines[gpio_number];
+    chardev_line_request_st * const line_request =
+        &chardev_context.requests[line->request_index];
+
+    if (line_request->outgoing || line->edge != gpio_edge_none)
+    {
+        result = -1;
+        goto done;
+    }
+
+    line->edge = edge;
+    if (reconfigure_input_request(line_request) < 0)
+    {
+        line->edge = gpio_edge_none;
+        result = -1;
+        goto done;
+    }
+    line->callback = callback;
+    line->callback_ctx = callback_ctx;
+
+    line_request->num_watched++;
+    if (!line_request->uloop_fd.registered)
+    {
+        line_request->uloop_fd.cb = chardev_edge_event;
+        uloop_fd_add(&line_request->uloop_fd, ULOOP_READ);
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static void
+chardev_unwatch_edge(size_t const gpio_number)
+{
+    chardev_line_st const * const requested_line = chardev_line_lookup(gpio_number);
+
+    if (requested_line == NULL || requested_line->edge == gpio_edge_none)
+    {
+        goto done;
+    }
+
+    chardev_line_st * const line = &chardev_context.lines[gpio_number];
+    chardev_line_request_st * const line_request =
+        &chardev_context.requests[line->request_index];
+
+    line->edge = gpio_edge_none;
+    line->callback = NULL;
+    line->callback_ctx = NULL;
+    reconfigure_input_request(line_request);
+
+    line_request->num_watched--;
+    if (line_request->num_watched == 0 && line_request->uloop_fd.registered)
+    {
+        uloop_fd_delete(&line_request->uloop_fd);
+    }
+
+done:
+    return;
+}
+
+gpio_backend_st const chardev_gpio_backend =
+{
+    .name = "chardev",
+    .open = chardev_open,
+    .close = chardev_close,
+    .reconfigure = chardev_reconfigure,
+    .read = chardev_read,
+    .write = chardev_write,
+    .read_bulk = chardev_read_bulk,
+    .write_bulk = chardev_write_bulk,
+    .watch_edge = chardev_watch_edge,
+    .unwatch_edge = chardev_unwatch_edge
+};
@@ -0,0 +1,15 @@
+#ifndef __CHARDEV_GPIO_BACKEND_H__
+#define __CHARDEV_GPIO_BACKEND_H__
+
+#include "gpio_backend.h"
+
+/*
+ * A GPIO backend using the GPIO character device (/dev/gpiochipN) uAPI.
+ * GPIO numbers are line offsets on the configured chip. All inputs, and
+ * separately all outputs, are requested together so that multiple lines
+ * can be read or written with a single ioctl.
+ */
+extern gpio_backend_st const chardev_gpio_backend;
+
+
+#endif /* __CHARDEV_GPIO_BACKEND_H__ */
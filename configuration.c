@@ -5,10 +5,19 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+
+#define DEFAULT_RESYNC_MS 1000
+#define DEFAULT_STORM_POLL_MS 100
+#define DEFAULT_STORM_REARM_MS 5000
+#define DEFAULT_HISTORY_SIZE 4096
+#define DEFAULT_PWM_PERIOD_MS 1000
 
 typedef struct gpio_input_st
 {
     size_t gpio_number;
+    gpio_edge_t edge;
+    unsigned int debounce_ms;
 } gpio_input_st;
 
 typedef struct gpio_input_context_st
@@ -20,6 +29,9 @@ typedef struct gpio_input_context_st
 typedef struct gpio_output_st
 {
     size_t gpio_number;
+    unsigned int pwm_period_ms;
+    bool has_initial_state;
+    bool initial_state;
 } gpio_output_st;
 
 typedef struct gpio_output_context_st
@@ -28,11 +40,47 @@ typedef struct gpio_output_context_st
     gpio_output_st * gpios;
 } gpio_output_context_st;
 
+typedef struct gpio_counter_st
+{
+    size_t gpio_number;
+    gpio_edge_t edge;
+} gpio_counter_st;
+
+typedef struct gpio_counter_context_st
+{
+    size_t num_gpio;
+    gpio_counter_st * gpios;
+} gpio_counter_context_st;
+
+typedef struct gpio_rule_context_st
+{
+    size_t num_rules;
+    configuration_rule_st * rules;
+} gpio_rule_context_st;
+
 struct configuration_st
 {
     struct json_object * json;
+    char const * backend_name;
+    char const * chip_name;
+    char const * fast_socket;
+    char const * base_path;
+    bool cached;
+    bool force_writes;
+    bool shared_memory;
+    bool worker_pool;
+    bool lazy_export;
+    bool prewarm;
+    unsigned int resync_ms;
+    unsigned int storm_max_edges;
+    unsigned int storm_poll_ms;
+    unsigned int storm_rearm_ms;
+    unsigned int sample_hz;
+    unsigned int history_size;
     gpio_input_context_st inputs;
     gpio_output_context_st outputs;
+    gpio_counter_context_st counters;
+    gpio_rule_context_st rules;
 };
 
 static struct json_object * get_object_by_name(
@@ -54,6 +102,142 @@ done:
     return object;
 }
 
+/*
+ * The parse_optional_xxx functions leave the value unchanged if the field
+ * isn't present, and fail only if it is present with the wrong type.
+ */
+static bool
+parse_optional_string(
+    struct json_object * const parent,
+    char const * const name,
+    char const * * const value)
+{
+    bool success;
+    struct json_object * const object = get_object_by_name(parent, name);
+
+    if (object == NULL)
+    {
+        success = true;
+        goto done;
+    }
+
+    if (!json_object_is_type(object, json_type_string))
+    {
+        DPRINTF("%s must be a string\n", name);
+        success = false;
+        goto done;
+    }
+
+    *value = json_object_get_string(object);
+    DPRINTF("%s: %s\n", name, *value);
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+parse_optional_bool(
+    struct json_object * const parent,
+    char const * const name,
+    bool * const value)
+{
+    bool success;
+    struct json_object * const object = get_object_by_name(parent, name);
+
+    if (object == NULL)
+    {
+        success = true;
+        goto done;
+    }
+
+    if (!json_object_is_type(object, json_type_boolean))
+    {
+        DPRINTF("%s must be a boolean\n", name);
+        success = false;
+        goto done;
+    }
+
+    *value = json_object_get_boolean(object);
+    DPRINTF("%s: %d\n", name, *value);
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+parse_optional_uint(
+    struct json_object * const parent,
+    char const * const name,
+    unsigned int * const value)
+{
+    bool success;
+    struct json_object * const object = get_object_by_name(parent, name);
+
+    if (object == NULL)
+    {
+        success = true;
+        goto done;
+    }
+
+    if (!json_object_is_type(object, json_type_int) || json_object_get_int(object) < 0)
+    {
+        DPRINTF("%s must be a non-negative integer\n", name);
+        success = false;
+        goto done;
+    }
+
+    *value = json_object_get_int(object);
+    DPRINTF("%s: %u\n", name, *value);
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+parse_edge(
+    struct json_object * const input_object,
+    gpio_edge_t * const edge)
+{
+    bool success;
+    static char const * const edge_names[] =
+    {
+        [gpio_edge_none] = "none",
+        [gpio_edge_rising] = "rising",
+        [gpio_edge_falling] = "falling",
+        [gpio_edge_both] = "both"
+    };
+    struct json_object * const edge_object =
+        get_object_by_name(input_object, "edge");
+
+    if (edge_object == NULL)
+    {
+        *edge = gpio_edge_none;
+        success = true;
+        goto done;
+    }
+
+    char const * const edge_name = json_object_get_string(edge_object);
+
+    for (size_t index = 0; index < sizeof edge_names / sizeof edge_names[0]; index++)
+    {
+        if (strcmp(edge_name, edge_names[index]) == 0)
+        {
+            *edge = index;
+            success = true;
+            goto done;
+        }
+    }
+
+    DPRINTF("unknown edge: %s\n", edge_name);
+    success = false;
+
+done:
+    return success;
+}
+
 static bool
 parse_inputs(
     gpio_input_context_st * const inputs_context,
@@ -94,7 +278,65 @@ parse_inputs(
 
         gpio_input->gpio_number = json_object_get_int(gpio);
 
-        DPRINTF("input: %d gpio %d\n", index, gpio_input->gpio_number);
+        if (!parse_edge(input_object, &gpio_input->edge))
+        {
+            success = false;
+            goto done;
+        }
+
+        if (!parse_optional_uint(input_object, "debounce_ms", &gpio_input->debounce_ms))
+        {
+            success = false;
+            goto done;
+        }
+
+        DPRINTF("input: %zu gpio %zu edge %d\n", index, gpio_input->gpio_number, gpio_input->edge);
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+parse_level(
+    struct json_object * const rule_object,
+    char const * const name,
+    bool * const state)
+{
+    bool success;
+    struct json_object * const level_object = get_object_by_name(rule_object, name);
+
+    if (level_object == NULL)
+    {
+        DPRINTF("rule is missing: %s\n", name);
+        success = false;
+        goto done;
+    }
+
+    if (json_object_is_type(level_object, json_type_boolean))
+    {
+        *state = json_object_get_boolean(level_object);
+        success = true;
+        goto done;
+    }
+
+    char const * const level_name = json_object_get_string(level_object);
+
+    if (strcmp(level_name, "high") == 0)
+    {
+        *state = true;
+    }
+    else if (strcmp(level_name, "low") == 0)
+    {
+        *state = false;
+    }
+    else
+    {
+        DPRINTF("unknown %s: %s\n", name, level_name);
+        success = false;
+        goto done;
     }
 
     success = true;
@@ -143,6 +385,22 @@ parse_outputs(
 
         gpio_output->gpio_number = json_object_get_int(gpio);
 
+        gpio_output->pwm_period_ms = DEFAULT_PWM_PERIOD_MS;
+        if (!parse_optional_uint(output_object, "pwm_period_ms", &gpio_output->pwm_period_ms)
+            || gpio_output->pwm_period_ms == 0)
+        {
+            success = false;
+            goto done;
+        }
+
+        gpio_output->has_initial_state = get_object_by_name(output_object, "initial") != NULL;
+        if (gpio_output->has_initial_state
+            && !parse_level(output_object, "initial", &gpio_output->initial_state))
+        {
+            success = false;
+            goto done;
+        }
+
         DPRINTF("output: %d gpio %d\n", index, gpio_output->gpio_number);
     }
 
@@ -152,6 +410,156 @@ done:
     return success;
 }
 
+static bool
+parse_counters(
+    gpio_counter_context_st * const counters_context,
+    struct json_object * gpio_object)
+{
+    bool success;
+
+    static char const gpio_counters_name[] = "counters";
+    struct json_object * const counters =
+        get_object_by_name(gpio_object, gpio_counters_name);
+
+    /* Counters are optional. */
+    if (counters == NULL)
+    {
+        success = true;
+        goto done;
+    }
+
+    if (!json_object_is_type(counters, json_type_array))
+    {
+        success = false;
+        goto done;
+    }
+
+    counters_context->num_gpio = json_object_array_length(counters);
+    counters_context->gpios = calloc(counters_context->num_gpio, sizeof *counters_context->gpios);
+    if (counters_context->gpios == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < counters_context->num_gpio; index++)
+    {
+        gpio_counter_st * const gpio_counter = &counters_context->gpios[index];
+        struct json_object * const counter_object =
+            json_object_array_get_idx(counters, index);
+        struct json_object * const gpio = get_object_by_name(counter_object, "gpio");
+
+        if (gpio == NULL)
+        {
+            success = false;
+            goto done;
+        }
+
+        gpio_counter->gpio_number = json_object_get_int(gpio);
+
+        if (!parse_edge(counter_object, &gpio_counter->edge))
+        {
+            success = false;
+            goto done;
+        }
+
+        /* Counters count rising edges unless told otherwise. */
+        if (gpio_counter->edge == gpio_edge_none)
+        {
+            gpio_counter->edge = gpio_edge_rising;
+        }
+
+        DPRINTF("counter: %zu gpio %zu edge %d\n", index, gpio_counter->gpio_number, gpio_counter->edge);
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+parse_instance(
+    struct json_object * const rule_object,
+    char const * const name,
+    size_t const num_instances,
+    size_t * const instance)
+{
+    bool success;
+    struct json_object * const instance_object = get_object_by_name(rule_object, name);
+
+    if (instance_object == NULL
+        || !json_object_is_type(instance_object, json_type_int)
+        || json_object_get_int(instance_object) < 0
+        || (size_t)json_object_get_int(instance_object) >= num_instances)
+    {
+        DPRINTF("rule has no valid %s\n", name);
+        success = false;
+        goto done;
+    }
+
+    *instance = json_object_get_int(instance_object);
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+parse_rules(configuration_st * const configuration, struct json_object * gpio_object)
+{
+    bool success;
+    gpio_rule_context_st * const rules_context = &configuration->rules;
+
+    static char const gpio_rules_name[] = "rules";
+    struct json_object * const rules =
+        get_object_by_name(gpio_object, gpio_rules_name);
+
+    /* Rules are optional. */
+    if (rules == NULL)
+    {
+        success = true;
+        goto done;
+    }
+
+    if (!json_object_is_type(rules, json_type_array))
+    {
+        success = false;
+        goto done;
+    }
+
+    rules_context->num_rules = json_object_array_length(rules);
+    rules_context->rules = calloc(rules_context->num_rules, sizeof *rules_context->rules);
+    if (rules_context->rules == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < rules_context->num_rules; index++)
+    {
+        configuration_rule_st * const rule = &rules_context->rules[index];
+        struct json_object * const rule_object = json_object_array_get_idx(rules, index);
+
+        if (!parse_instance(rule_object, "input", configuration->inputs.num_gpio, &rule->input)
+            || !parse_level(rule_object, "when", &rule->input_state)
+            || !parse_instance(rule_object, "output", configuration->outputs.num_gpio, &rule->output)
+            || !parse_level(rule_object, "value", &rule->output_state))
+        {
+            success = false;
+            goto done;
+        }
+
+        DPRINTF("rule: %zu input %zu %d output %zu %d\n",
+                index, rule->input, rule->input_state, rule->output, rule->output_state);
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
 static bool
 parse_configuration(
     configuration_st * const configuration,
@@ -169,6 +577,108 @@ parse_configuration(
         goto done;
     }
 
+    if (!parse_optional_string(gpio_object, "backend", &configuration->backend_name))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_string(gpio_object, "fast_socket", &configuration->fast_socket))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_string(gpio_object, "chip", &configuration->chip_name))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_string(gpio_object, "base_path", &configuration->base_path))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_bool(gpio_object, "cached", &configuration->cached))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_bool(gpio_object, "force_writes", &configuration->force_writes))
+    {
+        success = false;
+        goto done;
+    }
+
+    configuration->resync_ms = DEFAULT_RESYNC_MS;
+    if (!parse_optional_uint(gpio_object, "resync_ms", &configuration->resync_ms))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_uint(gpio_object, "storm_max_edges", &configuration->storm_max_edges))
+    {
+        success = false;
+        goto done;
+    }
+
+    configuration->storm_poll_ms = DEFAULT_STORM_POLL_MS;
+    if (!parse_optional_uint(gpio_object, "storm_poll_ms", &configuration->storm_poll_ms)
+        || configuration->storm_poll_ms == 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    configuration->storm_rearm_ms = DEFAULT_STORM_REARM_MS;
+    if (!parse_optional_uint(gpio_object, "storm_rearm_ms", &configuration->storm_rearm_ms))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_bool(gpio_object, "shared_memory", &configuration->shared_memory))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_bool(gpio_object, "worker_pool", &configuration->worker_pool))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_bool(gpio_object, "lazy_export", &configuration->lazy_export))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_bool(gpio_object, "prewarm", &configuration->prewarm))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_optional_uint(gpio_object, "sample_hz", &configuration->sample_hz))
+    {
+        success = false;
+        goto done;
+    }
+
+    configuration->history_size = DEFAULT_HISTORY_SIZE;
+    if (!parse_optional_uint(gpio_object, "history_size", &configuration->history_size)
+        || configuration->history_size == 0)
+    {
+        success = false;
+        goto done;
+    }
+
     if (!parse_inputs(&configuration->inputs, gpio_object))
     {
         success = false;
@@ -181,6 +691,18 @@ parse_configuration(
         goto done;
     }
 
+    if (!parse_counters(&configuration->counters, gpio_object))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!parse_rules(configuration, gpio_object))
+    {
+        success = false;
+        goto done;
+    }
+
     success = true;
 
 done:
@@ -197,6 +719,8 @@ void configuration_free(configuration_st const * const configuration)
     json_object_put(configuration->json);
     free(configuration->inputs.gpios);
     free(configuration->outputs.gpios); 
+    free(configuration->counters.gpios);
+    free(configuration->rules.rules);
 
     free((void *)configuration);
 
@@ -271,6 +795,44 @@ done:
     return success;
 }
 
+gpio_edge_t configuration_input_edge(
+    configuration_st const * const configuration,
+    size_t const input_number)
+{
+    gpio_edge_t edge;
+    gpio_input_context_st const * const inputs = &configuration->inputs;
+
+    if (input_number >= inputs->num_gpio)
+    {
+        edge = gpio_edge_none;
+        goto done;
+    }
+
+    edge = inputs->gpios[input_number].edge;
+
+done:
+    return edge;
+}
+
+unsigned int configuration_input_debounce_ms(
+    configuration_st const * const configuration,
+    size_t const input_number)
+{
+    unsigned int debounce_ms;
+    gpio_input_context_st const * const inputs = &configuration->inputs;
+
+    if (input_number >= inputs->num_gpio)
+    {
+        debounce_ms = 0;
+        goto done;
+    }
+
+    debounce_ms = inputs->gpios[input_number].debounce_ms;
+
+done:
+    return debounce_ms;
+}
+
 bool configuration_output_gpio_number(
     configuration_st const * const configuration,
     size_t const output_number,
@@ -295,4 +857,199 @@ done:
     return success;
 }
 
+unsigned int configuration_output_pwm_period_ms(
+    configuration_st const * const configuration,
+    size_t const output_number)
+{
+    gpio_output_context_st const * const outputs = &configuration->outputs;
+
+    return output_number < outputs->num_gpio
+        ? outputs->gpios[output_number].pwm_period_ms
+        : DEFAULT_PWM_PERIOD_MS;
+}
+
+bool configuration_output_initial_state(
+    configuration_st const * const configuration,
+    size_t const output_number,
+    bool * const state)
+{
+    bool has_initial_state;
+    gpio_output_context_st const * const outputs = &configuration->outputs;
+
+    if (output_number >= outputs->num_gpio || !outputs->gpios[output_number].has_initial_state)
+    {
+        has_initial_state = false;
+        goto done;
+    }
+
+    *state = outputs->gpios[output_number].initial_state;
+    has_initial_state = true;
+
+done:
+    return has_initial_state;
+}
+
+size_t configuration_num_counters(configuration_st const * const configuration)
+{
+    return configuration->counters.num_gpio;
+}
+
+bool configuration_counter_gpio_number(
+    configuration_st const * const configuration,
+    size_t const counter_number,
+    size_t * const gpio_number)
+{
+    bool success;
+    gpio_counter_context_st const * const counters = &configuration->counters;
+
+    if (counter_number >= counters->num_gpio)
+    {
+        success = false;
+        goto done;
+    }
+
+    *gpio_number = counters->gpios[counter_number].gpio_number;
+    success = true;
+
+done:
+    return success;
+}
+
+gpio_edge_t configuration_counter_edge(
+    configuration_st const * const configuration,
+    size_t const counter_number)
+{
+    gpio_counter_context_st const * const counters = &configuration->counters;
+
+    return counter_number < counters->num_gpio
+        ? counters->gpios[counter_number].edge
+        : gpio_edge_none;
+}
+
+size_t configuration_num_rules(configuration_st const * const configuration)
+{
+    return configuration->rules.num_rules;
+}
+
+configuration_rule_st const * configuration_rule(
+    configuration_st const * const configuration,
+    size_t const rule_number)
+{
+    gpio_rule_context_st const * const rules = &configuration->rules;
+
+    return rule_number < rules->num_rules ? &rules->rules[rule_number] : NULL;
+}
+
+char const * configuration_backend_name(configuration_st const * const configuration)
+{
+    return configuration->backend_name;
+}
+
+char const * configuration_chip_name(configuration_st const * const configuration)
+{
+    return configuration->chip_name;
+}
+
+char const * configuration_fast_socket(configuration_st const * const configuration)
+{
+    return configuration->fast_socket;
+}
+
+char const * configuration_base_path(configuration_st const * const configuration)
+{
+    return configuration->base_path;
+}
+
+bool configuration_inputs_cached(configuration_st const * const configuration)
+{
+    return configuration->cached;
+}
+
+unsigned int configuration_resync_ms(configuration_st const * const configuration)
+{
+    return configuration->resync_ms;
+}
+
+bool configuration_force_writes(configuration_st const * const configuration)
+{
+    return configuration->force_writes;
+}
+
+bool configuration_shared_memory(configuration_st const * const configuration)
+{
+    return configuration->shared_memory;
+}
+
+bool configuration_worker_pool(configuration_st const * const configuration)
+{
+    return configuration->worker_pool;
+}
+
+bool configuration_lazy_export(configuration_st const * const configuration)
+{
+    return configuration->lazy_export;
+}
+
+bool configuration_prewarm(configuration_st const * const configuration)
+{
+    return configuration->prewarm;
+}
+
+unsigned int configuration_storm_max_edges(configuration_st const * const configuration)
+{
+    return configuration->storm_max_edges;
+}
+
+unsigned int configuration_storm_poll_ms(configuration_st const * const configuration)
+{
+    return configuration->storm_poll_ms;
+}
 
+unsigned int configuration_storm_rearm_ms(configuration_st const * const configuration)
+{
+    return configuration->storm_rearm_ms;
+}
+
+unsigned int configuration_sample_hz(configuration_st const * const configuration)
+{
+    return configuration->sample_hz;
+}
+
+unsigned int configuration_history_size(configuration_st const * const configuration)
+{
+    return configuration->history_size;
+}
+
+size_t configuration_highest_gpio_number(configuration_st const * const configuration)
+{
+    size_t highest = 0;
+    gpio_input_context_st const * const inputs = &configuration->inputs;
+    gpio_output_context_st const * const outputs = &configuration->outputs;
+    gpio_counter_context_st const * const counters = &configuration->counters;
+
+    for (size_t index = 0; index < inputs->num_gpio; index++)
+    {
+        if (inputs->gpios[index].gpio_number > highest)
+        {
+            highest = inputs->gpios[index].gpio_number;
+        }
+    }
+
+    for (size_t index = 0; index < outputs->num_gpio; index++)
+    {
+        if (outputs->gpios[index].gpio_number > highest)
+        {
+            highest = outputs->gpios[index].gpio_number;
+        }
+    }
+
+    for (size_t index = 0; index < counters->num_gpio; index++)
+    {
+        if (counters->gpios[index].gpio_number > highest)
+        {
+            highest = counters->gpios[index].gpio_number;
+        }
+    }
+
+    return highest;
+}
@@ -6,6 +6,23 @@
 
 typedef struct configuration_st configuration_st;
 
+typedef enum gpio_edge_t
+{
+    gpio_edge_none,
+    gpio_edge_rising,
+    gpio_edge_falling,
+    gpio_edge_both
+} gpio_edge_t;
+
+/* When binary-input 'input' changes to input_state, set binary-output 'output' to output_state. */
+typedef struct configuration_rule_st
+{
+    size_t input;
+    bool input_state;
+    size_t output;
+    bool output_state;
+} configuration_rule_st;
+
 configuration_st * configuration_load(char const * const filename);
 void configuration_free(configuration_st const * const configuration);
 
@@ -18,10 +35,105 @@ bool configuration_input_gpio_number(
     size_t const input_number,
     size_t * const gpio_number);
 
+gpio_edge_t configuration_input_edge(
+    configuration_st const * const configuration,
+    size_t const input_number);
+
+/* 0 if the input isn't debounced. */
+unsigned int configuration_input_debounce_ms(
+    configuration_st const * const configuration,
+    size_t const input_number);
+
 bool configuration_output_gpio_number(
     configuration_st const * const configuration,
     size_t const output_number,
     size_t * const gpio_number);
 
+/* The period used when the output is driven as a pwm-output. */
+unsigned int configuration_output_pwm_period_ms(
+    configuration_st const * const configuration,
+    size_t const output_number);
+
+/*
+ * The level an output is set to as it is made an output. False if none is
+ * configured, in which case it is driven low.
+ */
+bool configuration_output_initial_state(
+    configuration_st const * const configuration,
+    size_t const output_number,
+    bool * const state);
+
+/* Inputs whose edges are counted. */
+size_t configuration_num_counters(configuration_st const * const configuration);
+
+bool configuration_counter_gpio_number(
+    configuration_st const * const configuration,
+    size_t const counter_number,
+    size_t * const gpio_number);
+
+gpio_edge_t configuration_counter_edge(
+    configuration_st const * const configuration,
+    size_t const counter_number);
+
+size_t configuration_num_rules(configuration_st const * const configuration);
+
+configuration_rule_st const * configuration_rule(
+    configuration_st const * const configuration,
+    size_t const rule_number);
+
+/* The name of the GPIO backend to use, or NULL if not configured. */
+char const * configuration_backend_name(configuration_st const * const configuration);
+
+/* The GPIO chip used by the chardev backend, or NULL if not configured. */
+char const * configuration_chip_name(configuration_st const * const configuration);
+
+/* The path of the fast path socket, or NULL if it isn't enabled. */
+char const * configuration_fast_socket(configuration_st const * const configuration);
+
+/* The directory used by the sysfs backend, or NULL if not configured. */
+char const * configuration_base_path(configuration_st const * const configuration);
+
+/* True if UBUS reads of inputs should be answered from the input cache. */
+bool configuration_inputs_cached(configuration_st const * const configuration);
+
+/* How often the input cache is refreshed from the hardware. */
+unsigned int configuration_resync_ms(configuration_st const * const configuration);
+
+/* True if output writes should be issued even when the output won't change. */
+bool configuration_force_writes(configuration_st const * const configuration);
+
+/* True if GPIO state should be published in shared memory. */
+bool configuration_shared_memory(configuration_st const * const configuration);
+
+/* True if blocking GPIO operations should be run on worker threads. */
+bool configuration_worker_pool(configuration_st const * const configuration);
+
+/*
+ * True if pins that aren't monitored should only be exported and have
+ * their direction set when they are first used.
+ */
+bool configuration_lazy_export(configuration_st const * const configuration);
+
+/* True if lazily exported pins should be set up in the background anyway. */
+bool configuration_prewarm(configuration_st const * const configuration);
+
+/*
+ * The most edges per second allowed on an input before it is switched to
+ * polling, or 0 if there is no limit.
+ */
+unsigned int configuration_storm_max_edges(configuration_st const * const configuration);
+
+unsigned int configuration_storm_poll_ms(configuration_st const * const configuration);
+
+unsigned int configuration_storm_rearm_ms(configuration_st const * const configuration);
+
+/* The rate at which all inputs are sampled, or 0 if they aren't. */
+unsigned int configuration_sample_hz(configuration_st const * const configuration);
+
+/* The number of input samples kept. */
+unsigned int configuration_history_size(configuration_st const * const configuration);
+
+size_t configuration_highest_gpio_number(configuration_st const * const configuration);
+
 
 #endif /* __CONFIGURATION_H__ */
@@ -0,0 +1,152 @@
+#include "debounce.h"
+#include "gpio_backend.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+
+#include <stdlib.h>
+
+typedef struct debounce_input_st
+{
+    struct uloop_timeout timer;
+    size_t instance;
+    size_t gpio_number;
+    unsigned int debounce_ms;
+
+    bool stable_valid;
+    bool stable_state;
+
+    /* The state reported by the most recent change. */
+    bool pending_state;
+    uint64_t pending_ns;
+} debounce_input_st;
+
+typedef struct debounce_context_st
+{
+    debounce_commit_fn commit;
+    size_t num_inputs;
+    debounce_input_st * inputs;
+} debounce_context_st;
+
+static debounce_context_st debounce_context;
+
+static void
+debounce_timer_expired(struct uloop_timeout * const timer)
+{
+    debounce_input_st * const input = container_of(timer, debounce_input_st, timer);
+    bool state;
+
+    /*
+     * The input has been quiet for the debounce period, so its current
+     * state is stable.
+     */
+    if (gpio_backend_read(input->gpio_number, &state) < 0)
+    {
+        state = input->pending_state;
+    }
+
+    if (input->stable_valid && input->stable_state == state)
+    {
+        goto done;
+    }
+
+    input->stable_valid = true;
+    input->stable_state = state;
+    debounce_context.commit(input->instance, state, input->pending_ns);
+
+done:
+    return;
+}
+
+bool debounce_start(
+    configuration_st const * const configuration,
+    debounce_commit_fn const commit)
+{
+    bool success;
+
+    debounce_context.commit = commit;
+    debounce_context.num_inputs = configuration_num_inputs(configuration);
+    debounce_context.inputs =
+        calloc(debounce_context.num_inputs, sizeof *debounce_context.inputs);
+    if (debounce_context.inputs == NULL)
+    {
+        debounce_context.num_inputs = 0;
+        success = false;
+        goto done;
+    }
+
+    for (size_t instance = 0; instance < debounce_context.num_inputs; instance++)
+    {
+        debounce_input_st * const input = &debounce_context.inputs[instance];
+
+        input->timer.cb = debounce_timer_expired;
+        input->instance = instance;
+        input->debounce_ms = configuration_input_debounce_ms(configuration, instance);
+
+        if (input->debounce_ms == 0
+            || !configuration_input_gpio_number(configuration, instance, &input->gpio_number))
+        {
+            input->debounce_ms = 0;
+            continue;
+        }
+
+        input->stable_valid = gpio_backend_read(input->gpio_number, &input->stable_state) == 0;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+void debounce_stop(void)
+{
+    for (size_t instance = 0; instance < debounce_context.num_inputs; instance++)
+    {
+        uloop_timeout_cancel(&debounce_context.inputs[instance].timer);
+    }
+
+    free(debounce_context.inputs);
+    debounce_context.inputs = NULL;
+    debounce_context.num_inputs = 0;
+}
+
+bool debounce_is_enabled(size_t const instance)
+{
+    return instance < debounce_context.num_inputs
+        && debounce_context.inputs[instance].debounce_ms > 0;
+}
+
+bool debounce_stable_state(size_t const instance, bool * const state)
+{
+    bool success;
+
+    if (!debounce_is_enabled(instance) || !debounce_context.inputs[instance].stable_valid)
+    {
+        success = false;
+        goto done;
+    }
+
+    *state = debounce_context.inputs[instance].stable_state;
+    success = true;
+
+done:
+    return success;
+}
+
+void debounce_input_event(size_t const instance, bool const state, uint64_t const timestamp_ns)
+{
+    if (!debounce_is_enabled(instance))
+    {
+        goto done;
+    }
+
+    debounce_input_st * const input = &debounce_context.inputs[instance];
+
+    input->pending_state = state;
+    input->pending_ns = timestamp_ns;
+    uloop_timeout_set(&input->timer, input->debounce_ms);
+
+done:
+    return;
+}
@@ -0,0 +1,31 @@
+#ifndef __DEBOUNCE_H__
+#define __DEBOUNCE_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Debounces inputs configured with a "debounce_ms" setting. Each change
+ * reported for such an input restarts its debounce timer. When the timer
+ * expires the input is read, and if it differs from the last stable state,
+ * the new state is passed to the commit function.
+ */
+typedef void (*debounce_commit_fn)(size_t instance, bool state, uint64_t timestamp_ns);
+
+bool debounce_start(
+    configuration_st const * const configuration,
+    debounce_commit_fn const commit);
+
+void debounce_stop(void);
+
+bool debounce_is_enabled(size_t const instance);
+
+/* The last stable state of a debounced input. */
+bool debounce_stable_state(size_t const instance, bool * const state);
+
+void debounce_input_event(size_t const instance, bool const state, uint64_t const timestamp_ns);
+
+
+#endif /* __DEBOUNCE_H__ */
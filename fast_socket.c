@@ -0,0 +1,336 @@
+#include "fast_socket.h"
+#include "sysfs_gpio_fast.h"
+#include "input_monitor.h"
+#include "output_state.h"
+#include "pwm_output.h"
+#include "pin_bitmap.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 16
+
+typedef struct fast_socket_client_st
+{
+    struct uloop_fd uloop_fd;
+    bool connected;
+} fast_socket_client_st;
+
+typedef struct fast_socket_st
+{
+    struct uloop_fd listen_fd;
+    /* Copied, as the configuration it came from may be replaced by a reload. */
+    struct sockaddr_un address;
+    fast_socket_client_st clients[MAX_CLIENTS];
+} fast_socket_st;
+
+static fast_socket_st fast_socket = { .listen_fd = { .fd = -1 } };
+
+static void
+client_disconnect(fast_socket_client_st * const client)
+{
+    uloop_fd_delete(&client->uloop_fd);
+    close(client->uloop_fd.fd);
+    client->connected = false;
+}
+
+static int
+handle_get(sysfs_gpio_fast_request_st const * const request, sysfs_gpio_fast_response_st * const response)
+{
+    int result;
+    bool state;
+
+    if (request->instance >= input_monitor_num_inputs())
+    {
+        result = -EINVAL;
+        goto done;
+    }
+
+    if (!input_monitor_read(request->instance, &state))
+    {
+        result = -EIO;
+        goto done;
+    }
+
+    response->value = state;
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+handle_set(sysfs_gpio_fast_request_st const * const request)
+{
+    int result;
+    bool const state = request->value != 0;
+
+    if (request->instance >= output_state_num_outputs())
+    {
+        result = -EINVAL;
+        goto done;
+    }
+
+    if (output_state_write_rejected(request->instance, state))
+    {
+        result = -EPERM;
+        goto done;
+    }
+
+    pwm_output_cancel(request->instance);
+    result = output_state_write(request->instance, state) ? 0 : -EIO;
+
+done:
+    return result;
+}
+
+static int
+handle_get_all(sysfs_gpio_fast_response_st * const response)
+{
+    int result;
+
+    if (input_monitor_num_words() > SYSFS_GPIO_FAST_MAX_WORDS)
+    {
+        result = -E2BIG;
+        goto done;
+    }
+
+    result = input_monitor_read_all(response->words) ? 0 : -EIO;
+
+done:
+    return result;
+}
+
+static int
+handle_set_mask(sysfs_gpio_fast_request_st const * const request)
+{
+    int result;
+    size_t const num_words = output_state_num_words() < SYSFS_GPIO_FAST_MAX_WORDS
+        ? output_state_num_words()
+        : SYSFS_GPIO_FAST_MAX_WORDS;
+
+    for (size_t word = num_words; word < SYSFS_GPIO_FAST_MAX_WORDS; word++)
+    {
+        if (request->mask[word] != 0)
+        {
+            result = -EINVAL;
+            goto done;
+        }
+    }
+
+    if (output_state_write_mask_rejected(request->words, request->mask, num_words))
+    {
+        result = -EPERM;
+        goto done;
+    }
+
+    for (size_t word = 0; word < num_words; word++)
+    {
+        for (uint64_t mask = request->mask[word]; mask != 0; mask &= mask - 1)
+        {
+            pwm_output_cancel(word * PIN_BITMAP_WORD_BITS + pin_bitmap_next_bit(mask));
+        }
+    }
+
+    result = output_state_write_mask(request->words, request->mask, num_words) ? 0 : -EIO;
+
+done:
+    return result;
+}
+
+static void
+client_readable(struct uloop_fd * const u, unsigned int const events)
+{
+    fast_socket_client_st * const client = container_of(u, fast_socket_client_st, uloop_fd);
+    sysfs_gpio_fast_request_st request;
+
+    for (;;)
+    {
+        ssize_t const received = recv(u->fd, &request, sizeof request, MSG_DONTWAIT);
+
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (received <= 0)
+        {
+            client_disconnect(client);
+            break;
+        }
+
+        sysfs_gpio_fast_response_st response =
+        {
+            .tag = request.tag,
+            .op = request.op
+        };
+
+        if (received != sizeof request)
+        {
+            response.status = -EINVAL;
+        }
+        else
+        {
+            switch (request.op)
+            {
+                case sysfs_gpio_fast_op_get:
+                    response.status = handle_get(&request, &response);
+                    break;
+                case sysfs_gpio_fast_op_set:
+                    response.status = handle_set(&request);
+                    break;
+                case sysfs_gpio_fast_op_get_all:
+                    response.status = handle_get_all(&response);
+                    break;
+                case sysfs_gpio_fast_op_set_mask:
+                    response.status = handle_set_mask(&request);
+                    break;
+                default:
+                    response.status = -EOPNOTSUPP;
+                    break;
+            }
+        }
+
+        if (send(u->fd, &response, sizeof response, MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof response)
+        {
+            /* A client that doesn't read its responses is dropped. */
+            client_disconnect(client);
+            break;
+        }
+    }
+}
+
+static void
+client_accept(struct uloop_fd * const u, unsigned int const events)
+{
+    for (;;)
+    {
+        int const fd = accept4(u->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            break;
+        }
+
+        fast_socket_client_st * client = NULL;
+
+        for (size_t index = 0; index < MAX_CLIENTS && client == NULL; index++)
+        {
+            if (!fast_socket.clients[index].connected)
+            {
+                client = &fast_socket.clients[index];
+            }
+        }
+
+        if (client == NULL)
+        {
+            DPRINTF("Too many fast socket clients\n");
+            close(fd);
+            continue;
+        }
+
+        client->uloop_fd.fd = fd;
+        client->uloop_fd.cb = client_readable;
+        client->connected = true;
+        uloop_fd_add(&client->uloop_fd, ULOOP_READ);
+    }
+}
+
+bool fast_socket_start(configuration_st const * const configuration)
+{
+    bool success;
+    char const * const path = configuration_fast_socket(configuration);
+
+    if (path == NULL)
+    {
+        success = true;
+        goto done;
+    }
+
+    if (strlen(path) >= sizeof fast_socket.address.sun_path)
+    {
+        DPRINTF("Fast socket path is too long: %s\n", path);
+        success = false;
+        goto done;
+    }
+    fast_socket.address.sun_family = AF_UNIX;
+    strcpy(fast_socket.address.sun_path, path);
+
+    fast_socket.listen_fd.fd =
+        socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fast_socket.listen_fd.fd < 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    /* Remove any socket left behind by an earlier run. */
+    unlink(path);
+    if (bind(fast_socket.listen_fd.fd,
+             (struct sockaddr *)&fast_socket.address,
+             sizeof fast_socket.address) < 0
+        || listen(fast_socket.listen_fd.fd, MAX_CLIENTS) < 0)
+    {
+        DPRINTF("Unable to listen on fast socket %s: %m\n", path);
+        success = false;
+        goto done;
+    }
+
+    fast_socket.listen_fd.cb = client_accept;
+    uloop_fd_add(&fast_socket.listen_fd, ULOOP_READ);
+
+    success = true;
+
+done:
+    if (!success)
+    {
+        fast_socket_stop();
+    }
+
+    return success;
+}
+
+void fast_socket_stop(void)
+{
+    for (size_t index = 0; index < MAX_CLIENTS; index++)
+    {
+        if (fast_socket.clients[index].connected)
+        {
+            client_disconnect(&fast_socket.clients[index]);
+        }
+    }
+
+    if (fast_socket.listen_fd.fd >= 0)
+    {
+        uloop_fd_delete(&fast_socket.listen_fd);
+        close(fast_socket.listen_fd.fd);
+        fast_socket.listen_fd.fd = -1;
+        unlink(fast_socket.address.sun_path);
+    }
+}
+
+bool fast_socket_reload(configuration_st const * const configuration)
+{
+    bool success;
+    char const * const path = configuration_fast_socket(configuration);
+    bool const listening = fast_socket.listen_fd.fd >= 0;
+
+    if ((!listening && path == NULL)
+        || (listening && path != NULL && strcmp(path, fast_socket.address.sun_path) == 0))
+    {
+        success = true;
+        goto done;
+    }
+
+    fast_socket_stop();
+    success = fast_socket_start(configuration);
+
+done:
+    return success;
+}
@@ -0,0 +1,23 @@
+#ifndef __FAST_SOCKET_H__
+#define __FAST_SOCKET_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+
+/*
+ * Serves the binary protocol described in sysfs_gpio_fast.h on a
+ * SOCK_SEQPACKET Unix socket, if the configuration names one. This gives
+ * local clients a way to read and write GPIO without the cost of UBUS.
+ */
+bool fast_socket_start(configuration_st const * const configuration);
+void fast_socket_stop(void);
+
+/*
+ * Move to a reloaded configuration. The socket and its connected clients
+ * are kept unless the socket path changed.
+ */
+bool fast_socket_reload(configuration_st const * const configuration);
+
+
+#endif /* __FAST_SOCKET_H__ */
@@ -0,0 +1,1132 @@
+#include "gpio_backend.h"
+#include "sysfs_gpio_module.h"
+#include "memory_gpio_backend.h"
+#include "chardev_gpio_backend.h"
+#include "pin_bitmap.h"
+#include "gpio_stats.h"
+#include "monotonic.h"
+#include "ubus_common.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static gpio_backend_st const * const gpio_backends[] =
+{
+    &sysfs_gpio_backend,
+    &sysfs_uring_gpio_backend,
+    &chardev_gpio_backend,
+    &memory_gpio_backend
+};
+
+static gpio_backend_st const * active_backend = &sysfs_gpio_backend;
+
+static bool deferred_pin_ready(size_t const gpio_number);
+static bool deferred_pins_ready(size_t const * const gpio_numbers, size_t const count);
+
+gpio_backend_st const * gpio_backend_lookup(char const * const name)
+{
+    gpio_backend_st const * backend;
+
+    if (name == NULL)
+    {
+        backend = &sysfs_gpio_backend;
+        goto done;
+    }
+
+    for (size_t index = 0; index < ARRAY_SIZE(gpio_backends); index++)
+    {
+        backend = gpio_backends[index];
+
+        if (strcmp(backend->name, name) == 0)
+        {
+            goto done;
+        }
+    }
+
+    backend = NULL;
+
+done:
+    return backend;
+}
+
+bool gpio_backend_select(char const * const name)
+{
+    bool success;
+    gpio_backend_st const * const backend = gpio_backend_lookup(name);
+
+    if (backend == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    active_backend = backend;
+    success = true;
+
+done:
+    return success;
+}
+
+char const * gpio_backend_name(void)
+{
+    return active_backend->name;
+}
+
+int gpio_backend_read(size_t const gpio_number, bool * const state)
+{
+    int result;
+
+    if (!deferred_pin_ready(gpio_number))
+    {
+        result = -1;
+        goto done;
+    }
+
+    uint64_t const start_ns = monotonic_time_ns();
+
+    result = active_backend->read(gpio_number, state);
+    gpio_stats_record(gpio_stats_op_read, gpio_number, start_ns, result >= 0);
+
+done:
+    return result;
+}
+
+int gpio_backend_write(size_t const gpio_number, bool const high)
+{
+    int result;
+
+    if (!deferred_pin_ready(gpio_number))
+    {
+        result = -1;
+        goto done;
+    }
+
+    uint64_t const start_ns = monotonic_time_ns();
+
+    result = active_backend->write(gpio_number, high);
+    gpio_stats_record(gpio_stats_op_write, gpio_number, start_ns, result >= 0);
+
+done:
+    return result;
+}
+
+int gpio_backend_read_bulk(
+    size_t const * const gpio_numbers,
+    size_t const count,
+    uint64_t * const state_words)
+{
+    int result;
+    uint64_t const start_ns = monotonic_time_ns();
+
+    if (!deferred_pins_ready(gpio_numbers, count))
+    {
+        result = -1;
+        goto done;
+    }
+
+    if (active_backend->read_bulk != NULL)
+    {
+        result = active_backend->read_bulk(gpio_numbers, count, state_words);
+        goto done;
+    }
+
+    for (size_t index = 0; index < count; index++)
+    {
+        bool state;
+
+        if (active_backend->read(gpio_numbers[index], &state) < 0)
+        {
+            result = -1;
+            goto done;
+        }
+        pin_bitmap_assign(state_words, index, state);
+    }
+
+    result = 0;
+
+done:
+    gpio_stats_record(gpio_stats_op_read_bulk, GPIO_STATS_NO_PIN, start_ns, result >= 0);
+
+    return result;
+}
+
+int gpio_backend_write_bulk(
+    size_t const * const gpio_numbers,
+    uint64_t const * const state_words,
+    size_t const count)
+{
+    int result;
+    uint64_t const start_ns = monotonic_time_ns();
+
+    if (!deferred_pins_ready(gpio_numbers, count))
+    {
+        result = -1;
+        goto done;
+    }
+
+    if (active_backend->write_bulk != NULL)
+    {
+        result = active_backend->write_bulk(gpio_numbers, state_words, count);
+        goto done;
+    }
+
+    result = 0;
+    for (size_t index = 0; index < count; index++)
+    {
+        if (active_backend->write(gpio_numbers[index], pin_bitmap_get(state_words, index)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+done:
+    gpio_stats_record(gpio_stats_op_write_bulk, GPIO_STATS_NO_PIN, start_ns, result >= 0);
+
+    return result;
+}
+
+int gpio_backend_watch_edge(
+    size_t const gpio_number,
+    gpio_edge_t const edge,
+    gpio_edge_callback_fn const callback,
+    void * const callback_ctx)
+{
+    int result;
+
+    if (active_backend->watch_edge == NULL)
+    {
+        fprintf(stderr, "The %s GPIO backend doesn't support edge monitoring!\n",
+                active_backend->name);
+        result = -1;
+        goto done;
+    }
+
+    if (!deferred_pin_ready(gpio_number))
+    {
+        result = -1;
+        goto done;
+    }
+
+    result = active_backend->watch_edge(gpio_number, edge, callback, callback_ctx);
+
+done:
+    return result;
+}
+
+void gpio_backend_unwatch_edge(size_t const gpio_number)
+{
+    if (active_backend->unwatch_edge != NULL)
+    {
+        active_backend->unwatch_edge(gpio_number);
+    }
+}
+
+size_t gpio_backend_chip(size_t const gpio_number)
+{
+    size_t chip;
+
+    if (active_backend->chip_of == NULL
+        || active_backend->chip_of(gpio_number, &chip) < 0)
+    {
+        chip = 0;
+    }
+
+    return chip;
+}
+
+static bool
+configure_gpio(
+    size_t const gpio_number,
+    gpio_direction_t const direction,
+    bool * const already_exported)
+{
+    bool success;
+
+    *already_exported = false;
+    if (active_backend->export_pin != NULL)
+    {
+        uint64_t const start_ns = monotonic_time_ns();
+        int const result = active_backend->export_pin(gpio_number);
+
+        gpio_stats_record(gpio_stats_op_export, gpio_number, start_ns, result >= 0);
+        if (result < 0)
+        {
+            success = false;
+            goto done;
+        }
+        *already_exported = result > 0;
+    }
+
+    /*
+     * Set GPIO direction.
+     */
+    if (active_backend->set_direction != NULL)
+    {
+        uint64_t const start_ns = monotonic_time_ns();
+        bool const set = active_backend->set_direction(gpio_number, direction) >= 0;
+
+        gpio_stats_record(gpio_stats_op_direction, gpio_number, start_ns, set);
+        if (!set)
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+/*
+ * Pins whose export and direction are left until they are first used,
+ * indexed by GPIO number. A pin's bit is only cleared, with the lock held,
+ * once it has been configured, so a clear bit can be trusted without the
+ * lock. Pins may be used from worker threads as well as from uloop.
+ * The lock isn't held while a pin is configured. Instead the thread that
+ * configures it claims it, and any other thread that needs the same pin
+ * waits for the claim to be released.
+ */
+typedef struct gpio_deferred_st
+{
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    size_t num_gpio;
+    uint64_t * pending_words;
+    uint64_t * claimed_words;
+    gpio_direction_t * directions;
+    size_t num_pending;
+
+    pthread_t prewarm_thread;
+    bool prewarm_started;
+    bool prewarm_stop;
+} gpio_deferred_st;
+
+static gpio_deferred_st gpio_deferred =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .released = PTHREAD_COND_INITIALIZER
+};
+
+/* Lazy export only helps backends that configure pins one at a time. */
+static bool
+lazy_export(configuration_st const * const configuration)
+{
+    return configuration_lazy_export(configuration)
+        && (active_backend->export_pin != NULL || active_backend->set_direction != NULL);
+}
+
+static bool
+deferred_start(configuration_st const * const configuration)
+{
+    bool success;
+
+    /* Nothing is ever deferred unless lazy export is on. */
+    if (!lazy_export(configuration))
+    {
+        success = true;
+        goto done;
+    }
+
+    gpio_deferred.num_gpio = configuration_highest_gpio_number(configuration) + 1;
+    gpio_deferred.pending_words =
+        calloc(pin_bitmap_num_words(gpio_deferred.num_gpio), sizeof *gpio_deferred.pending_words);
+    gpio_deferred.claimed_words =
+        calloc(pin_bitmap_num_words(gpio_deferred.num_gpio), sizeof *gpio_deferred.claimed_words);
+    gpio_deferred.directions =
+        calloc(gpio_deferred.num_gpio, sizeof *gpio_deferred.directions);
+    if (gpio_deferred.pending_words == NULL
+        || gpio_deferred.claimed_words == NULL
+        || gpio_deferred.directions == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static void
+deferred_free(void)
+{
+    free(gpio_deferred.pending_words);
+    gpio_deferred.pending_words = NULL;
+    free(gpio_deferred.claimed_words);
+    gpio_deferred.claimed_words = NULL;
+    free(gpio_deferred.directions);
+    gpio_deferred.directions = NULL;
+    gpio_deferred.num_gpio = 0;
+    gpio_deferred.num_pending = 0;
+}
+
+static void
+deferred_add(size_t const gpio_number, gpio_direction_t const direction)
+{
+    if (!pin_bitmap_get(gpio_deferred.pending_words, gpio_number))
+    {
+        pin_bitmap_assign(gpio_deferred.pending_words, gpio_number, true);
+        gpio_deferred.num_pending++;
+    }
+    gpio_deferred.directions[gpio_number] = direction;
+}
+
+static bool
+deferred_pin_pending(size_t const gpio_number)
+{
+    bool pending;
+
+    if (__atomic_load_n(&gpio_deferred.num_pending, __ATOMIC_ACQUIRE) == 0
+        || gpio_number >= gpio_deferred.num_gpio)
+    {
+        pending = false;
+        goto done;
+    }
+
+    uint64_t const word =
+        __atomic_load_n(
+            &gpio_deferred.pending_words[gpio_number / PIN_BITMAP_WORD_BITS], __ATOMIC_ACQUIRE);
+
+    pending = (word & pin_bitmap_bit(gpio_number)) != 0;
+
+done:
+    return pending;
+}
+
+/* Configure the pin if that was deferred. False if it couldn't be. */
+static bool
+deferred_pin_ready(size_t const gpio_number)
+{
+    bool ready;
+
+    if (!deferred_pin_pending(gpio_number))
+    {
+        ready = true;
+        goto done;
+    }
+
+    pthread_mutex_lock(&gpio_deferred.lock);
+
+    while (pin_bitmap_get(gpio_deferred.claimed_words, gpio_number))
+    {
+        pthread_cond_wait(&gpio_deferred.released, &gpio_deferred.lock);
+    }
+
+    /* Another thread may have configured it while this one waited. */
+    if (!deferred_pin_pending(gpio_number))
+    {
+        ready = true;
+        pthread_mutex_unlock(&gpio_deferred.lock);
+        goto done;
+    }
+
+    gpio_direction_t const direction = gpio_deferred.directions[gpio_number];
+    bool already_exported;
+
+    pin_bitmap_assign(gpio_deferred.claimed_words, gpio_number, true);
+    pthread_mutex_unlock(&gpio_deferred.lock);
+
+    /* Left pending on failure, so the next use tries again. */
+    ready = configure_gpio(gpio_number, direction, &already_exported);
+
+    pthread_mutex_lock(&gpio_deferred.lock);
+    if (ready)
+    {
+        __atomic_and_fetch(
+            &gpio_deferred.pending_words[gpio_number / PIN_BITMAP_WORD_BITS],
+            ~pin_bitmap_bit(gpio_number),
+            __ATOMIC_RELEASE);
+        __atomic_sub_fetch(&gpio_deferred.num_pending, 1, __ATOMIC_RELEASE);
+    }
+    pin_bitmap_assign(gpio_deferred.claimed_words, gpio_number, false);
+    pthread_cond_broadcast(&gpio_deferred.released);
+    pthread_mutex_unlock(&gpio_deferred.lock);
+
+done:
+    return ready;
+}
+
+static bool
+deferred_pins_ready(size_t const * const gpio_numbers, size_t const count)
+{
+    bool ready = true;
+
+    for (size_t index = 0; index < count && ready; index++)
+    {
+        ready = deferred_pin_ready(gpio_numbers[index]);
+    }
+
+    return ready;
+}
+
+static void *
+prewarm_thread(void * const arg)
+{
+    for (size_t gpio_number = 0;
+         gpio_number < gpio_deferred.num_gpio
+         && !__atomic_load_n(&gpio_deferred.prewarm_stop, __ATOMIC_ACQUIRE);
+         gpio_number++)
+    {
+        deferred_pin_ready(gpio_number);
+    }
+
+    return NULL;
+}
+
+static void
+prewarm_stop(void)
+{
+    if (gpio_deferred.prewarm_started)
+    {
+        __atomic_store_n(&gpio_deferred.prewarm_stop, true, __ATOMIC_RELEASE);
+        pthread_join(gpio_deferred.prewarm_thread, NULL);
+        gpio_deferred.prewarm_started = false;
+        gpio_deferred.prewarm_stop = false;
+    }
+}
+
+bool gpio_backend_prewarm_start(configuration_st const * const configuration)
+{
+    bool success;
+
+    if (!configuration_prewarm(configuration)
+        || __atomic_load_n(&gpio_deferred.num_pending, __ATOMIC_ACQUIRE) == 0
+        || gpio_deferred.prewarm_started)
+    {
+        success = true;
+        goto done;
+    }
+
+    gpio_deferred.prewarm_started =
+        pthread_create(&gpio_deferred.prewarm_thread, NULL, prewarm_thread, NULL) == 0;
+    success = gpio_deferred.prewarm_started;
+
+done:
+    return success;
+}
+
+static void
+unconfigure_gpio(size_t const gpio_number)
+{
+    /* A pin still pending was never configured, so there's nothing to undo. */
+    if (active_backend->unexport_pin != NULL && !deferred_pin_pending(gpio_number))
+    {
+        uint64_t const start_ns = monotonic_time_ns();
+        int const result = active_backend->unexport_pin(gpio_number);
+
+        gpio_stats_record(gpio_stats_op_unexport, gpio_number, start_ns, result >= 0);
+    }
+}
+
+static void
+disable_inputs(configuration_st const * const configuration)
+{
+    for (size_t index = 0; index < configuration_num_inputs(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_input_gpio_number(configuration, index, &gpio_number))
+        {
+            continue;
+        }
+        unconfigure_gpio(gpio_number);
+    }
+}
+
+static void
+disable_outputs(configuration_st const * const configuration)
+{
+    for (size_t index = 0; index < configuration_num_outputs(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_output_gpio_number(configuration, index, &gpio_number))
+        {
+            continue;
+        }
+        unconfigure_gpio(gpio_number);
+    }
+}
+
+static void
+disable_counters(configuration_st const * const configuration)
+{
+    for (size_t index = 0; index < configuration_num_counters(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_counter_gpio_number(configuration, index, &gpio_number))
+        {
+            continue;
+        }
+        unconfigure_gpio(gpio_number);
+    }
+}
+
+typedef struct gpio_setup_pin_st
+{
+    size_t gpio_number;
+    gpio_direction_t direction;
+} gpio_setup_pin_st;
+
+/* The pins on one chip, which are configured in order. */
+typedef struct gpio_chip_setup_st
+{
+    size_t chip;
+    pthread_t thread;
+    bool thread_started;
+
+    size_t num_pins;
+    gpio_setup_pin_st * pins;
+
+    size_t num_already_exported;
+    size_t num_failed;
+} gpio_chip_setup_st;
+
+typedef struct gpio_setup_st
+{
+    size_t num_chips;
+    gpio_chip_setup_st * chips;
+} gpio_setup_st;
+
+static gpio_startup_st gpio_startup;
+
+static bool
+setup_add_pin(
+    gpio_setup_st * const setup,
+    size_t const gpio_number,
+    gpio_direction_t const direction)
+{
+    bool success;
+    size_t const chip_number = gpio_backend_chip(gpio_number);
+    size_t index;
+
+    for (index = 0; index < setup->num_chips; index++)
+    {
+        if (setup->chips[index].chip == chip_number)
+        {
+            break;
+        }
+    }
+
+    if (index == setup->num_chips)
+    {
+        gpio_chip_setup_st * const chips =
+            realloc(setup->chips, (setup->num_chips + 1) * sizeof *chips);
+
+        if (chips == NULL)
+        {
+            success = false;
+            goto done;
+        }
+        setup->chips = chips;
+        setup->chips[index] = (gpio_chip_setup_st){ .chip = chip_number };
+        setup->num_chips++;
+    }
+
+    gpio_chip_setup_st * const chip = &setup->chips[index];
+    gpio_setup_pin_st * const pins = realloc(chip->pins, (chip->num_pins + 1) * sizeof *pins);
+
+    if (pins == NULL)
+    {
+        success = false;
+        goto done;
+    }
+    chip->pins = pins;
+    chip->pins[chip->num_pins] =
+        (gpio_setup_pin_st){ .gpio_number = gpio_number, .direction = direction };
+    chip->num_pins++;
+    success = true;
+
+done:
+    return success;
+}
+
+/* Called for each configured pin, with whether its edges are watched. */
+typedef bool (*configured_pin_fn)(
+    void * ctx,
+    size_t gpio_number,
+    gpio_direction_t direction,
+    bool monitored);
+
+/* Inputs, then outputs, then counters. */
+static bool
+for_each_configured_pin(
+    configuration_st const * const configuration,
+    configured_pin_fn const visit,
+    void * const ctx)
+{
+    bool success;
+
+    for (size_t index = 0; index < configuration_num_inputs(configuration); index++)
+    {
+        size_t gpio_number;
+        bool const monitored = configuration_input_edge(configuration, index) != gpio_edge_none;
+
+        if (!configuration_input_gpio_number(configuration, index, &gpio_number)
+            || !visit(ctx, gpio_number, gpio_direction_in, monitored))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    for (size_t index = 0; index < configuration_num_outputs(configuration); index++)
+    {
+        size_t gpio_number;
+        bool high = false;
+
+        configuration_output_initial_state(configuration, index, &high);
+        if (!configuration_output_gpio_number(configuration, index, &gpio_number)
+            || !visit(
+                ctx,
+                gpio_number,
+                high ? gpio_direction_out_high : gpio_direction_out_low,
+                false))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    for (size_t index = 0; index < configuration_num_counters(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_counter_gpio_number(configuration, index, &gpio_number)
+            || !visit(ctx, gpio_number, gpio_direction_in, true))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+typedef struct setup_plan_ctx_st
+{
+    gpio_setup_st * setup;
+    bool lazy;
+} setup_plan_ctx_st;
+
+/*
+ * Pins are configured now unless lazy is set and they aren't monitored, in
+ * which case they are deferred until first used.
+ */
+static bool
+setup_plan_pin(
+    void * const ctx,
+    size_t const gpio_number,
+    gpio_direction_t const direction,
+    bool const monitored)
+{
+    bool success;
+    setup_plan_ctx_st const * const plan = ctx;
+
+    if (plan->lazy && !monitored)
+    {
+        deferred_add(gpio_number, direction);
+        success = true;
+        goto done;
+    }
+
+    success = setup_add_pin(plan->setup, gpio_number, direction);
+
+done:
+    return success;
+}
+
+/* Grouped by chip. */
+static bool
+setup_plan(gpio_setup_st * const setup, configuration_st const * const configuration)
+{
+    setup_plan_ctx_st plan = { .setup = setup, .lazy = lazy_export(configuration) };
+
+    return for_each_configured_pin(configuration, setup_plan_pin, &plan);
+}
+
+static void
+setup_free(gpio_setup_st * const setup)
+{
+    for (size_t index = 0; index < setup->num_chips; index++)
+    {
+        free(setup->chips[index].pins);
+    }
+    free(setup->chips);
+    setup->chips = NULL;
+    setup->num_chips = 0;
+}
+
+static void
+chip_setup(gpio_chip_setup_st * const chip)
+{
+    for (size_t index = 0; index < chip->num_pins; index++)
+    {
+        gpio_setup_pin_st const * const pin = &chip->pins[index];
+        bool already_exported;
+
+        if (!configure_gpio(pin->gpio_number, pin->direction, &already_exported))
+        {
+            chip->num_failed++;
+        }
+        if (already_exported)
+        {
+            chip->num_already_exported++;
+        }
+    }
+}
+
+static void *
+chip_setup_thread(void * const arg)
+{
+    chip_setup(arg);
+
+    return NULL;
+}
+
+/*
+ * Chips are set up in parallel, a thread each. Any chip without a thread
+ * is set up on this one.
+ */
+static void
+setup_run(gpio_setup_st * const setup)
+{
+    if (setup->num_chips > 1)
+    {
+        for (size_t index = 0; index < setup->num_chips; index++)
+        {
+            gpio_chip_setup_st * const chip = &setup->chips[index];
+
+            chip->thread_started =
+                pthread_create(&chip->thread, NULL, chip_setup_thread, chip) == 0;
+        }
+    }
+
+    for (size_t index = 0; index < setup->num_chips; index++)
+    {
+        gpio_chip_setup_st * const chip = &setup->chips[index];
+
+        if (chip->thread_started)
+        {
+            pthread_join(chip->thread, NULL);
+        }
+        else
+        {
+            chip_setup(chip);
+        }
+    }
+}
+
+bool enable_gpio_pins(configuration_st const * const configuration)
+{
+    bool success;
+    uint64_t const start_ns = monotonic_time_ns();
+    gpio_setup_st setup = { 0 };
+
+    if (active_backend->open != NULL && !active_backend->open(configuration))
+    {
+        fprintf(stderr, "Failed to open %s GPIO backend!\n", active_backend->name);
+        success = false;
+        goto done;
+    }
+
+    if (!deferred_start(configuration) || !setup_plan(&setup, configuration))
+    {
+        success = false;
+        goto done;
+    }
+
+    setup_run(&setup);
+
+    gpio_startup =
+        (gpio_startup_st){ .num_chips = setup.num_chips, .num_deferred = gpio_deferred.num_pending };
+    for (size_t index = 0; index < setup.num_chips; index++)
+    {
+        gpio_chip_setup_st const * const chip = &setup.chips[index];
+
+        gpio_startup.num_pins += chip->num_pins;
+        gpio_startup.num_already_exported += chip->num_already_exported;
+        gpio_startup.num_failed += chip->num_failed;
+    }
+
+    success = true;
+
+done:
+    setup_free(&setup);
+    gpio_startup.duration_ns = monotonic_time_ns() - start_ns;
+
+    return success;
+}
+
+void disable_gpio_pins(configuration_st const * const configuration)
+{
+    prewarm_stop();
+    disable_inputs(configuration);
+    disable_outputs(configuration);
+    disable_counters(configuration);
+
+    if (active_backend->close != NULL)
+    {
+        active_backend->close();
+    }
+    deferred_free();
+}
+
+void gpio_backend_startup(gpio_startup_st * const startup)
+{
+    *startup = gpio_startup;
+    startup->num_pending = __atomic_load_n(&gpio_deferred.num_pending, __ATOMIC_ACQUIRE);
+}
+
+/* The pins of a configuration, indexed by GPIO number. */
+typedef struct gpio_pin_table_st
+{
+    uint64_t * present_words;
+    uint64_t * monitored_words;
+    gpio_direction_t * directions;
+} gpio_pin_table_st;
+
+static bool
+pin_table_add(
+    void * const ctx,
+    size_t const gpio_number,
+    gpio_direction_t const direction,
+    bool const monitored)
+{
+    gpio_pin_table_st * const table = ctx;
+
+    pin_bitmap_assign(table->present_words, gpio_number, true);
+    pin_bitmap_assign(table->monitored_words, gpio_number, monitored);
+    table->directions[gpio_number] = direction;
+
+    return true;
+}
+
+static void
+pin_table_free(gpio_pin_table_st * const table)
+{
+    free(table->present_words);
+    table->present_words = NULL;
+    free(table->monitored_words);
+    table->monitored_words = NULL;
+    free(table->directions);
+    table->directions = NULL;
+}
+
+static bool
+pin_table_load(
+    gpio_pin_table_st * const table,
+    configuration_st const * const configuration,
+    size_t const num_gpio)
+{
+    bool success;
+
+    table->present_words = calloc(pin_bitmap_num_words(num_gpio), sizeof *table->present_words);
+    table->monitored_words = calloc(pin_bitmap_num_words(num_gpio), sizeof *table->monitored_words);
+    table->directions = calloc(num_gpio, sizeof *table->directions);
+    if (table->present_words == NULL
+        || table->monitored_words == NULL
+        || table->directions == NULL)
+    {
+        pin_table_free(table);
+        success = false;
+        goto done;
+    }
+
+    success = for_each_configured_pin(configuration, pin_table_add, table);
+
+done:
+    return success;
+}
+
+/* Only a change between input and output matters, not the initial level. */
+static bool
+same_direction(gpio_direction_t const previous, gpio_direction_t const next)
+{
+    return (previous == gpio_direction_in) == (next == gpio_direction_in);
+}
+
+/* For backends that can't change their pins one at a time. */
+static bool
+reload_reopen(
+    configuration_st const * const previous,
+    configuration_st const * const next,
+    gpio_reload_st * const reload)
+{
+    bool success;
+
+    disable_gpio_pins(previous);
+    success = enable_gpio_pins(next);
+    if (!success)
+    {
+        /* Go back to the pins that were working. */
+        disable_gpio_pins(next);
+        if (!enable_gpio_pins(previous))
+        {
+            fprintf(stderr, "Failed to set up the previous configuration's pins again!\n");
+            reload->restore_failed = true;
+        }
+    }
+
+    reload->reopened = true;
+    reload->num_added = gpio_startup.num_pins + gpio_startup.num_deferred;
+    reload->num_failed = gpio_startup.num_failed;
+
+    return success;
+}
+
+bool gpio_backend_reload(
+    configuration_st const * const previous,
+    configuration_st const * const next,
+    gpio_reload_st * const reload)
+{
+    bool success;
+    size_t const previous_highest = configuration_highest_gpio_number(previous);
+    size_t const next_highest = configuration_highest_gpio_number(next);
+    size_t const num_gpio =
+        (previous_highest > next_highest ? previous_highest : next_highest) + 1;
+    size_t const num_deferred_gpio = next_highest + 1;
+    bool const lazy = lazy_export(next);
+    gpio_pin_table_st before = { 0 };
+    gpio_pin_table_st after = { 0 };
+    gpio_setup_st setup = { 0 };
+    uint64_t * const was_pending = calloc(pin_bitmap_num_words(num_gpio), sizeof *was_pending);
+    uint64_t * deferred_words =
+        calloc(pin_bitmap_num_words(num_deferred_gpio), sizeof *deferred_words);
+    uint64_t * deferred_claimed_words =
+        calloc(pin_bitmap_num_words(num_deferred_gpio), sizeof *deferred_claimed_words);
+    gpio_direction_t * deferred_directions = calloc(num_deferred_gpio, sizeof *deferred_directions);
+
+    *reload = (gpio_reload_st){ 0 };
+    prewarm_stop();
+
+    if (active_backend->reconfigure == NULL)
+    {
+        success = reload_reopen(previous, next, reload);
+        goto done;
+    }
+
+    /* Everything that could fail is done before any pin is touched. */
+    if (was_pending == NULL
+        || deferred_words == NULL
+        || deferred_claimed_words == NULL
+        || deferred_directions == NULL
+        || !pin_table_load(&before, previous, num_gpio)
+        || !pin_table_load(&after, next, num_gpio))
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t gpio_number = 0; gpio_number < num_gpio; gpio_number++)
+    {
+        pin_bitmap_assign(was_pending, gpio_number, deferred_pin_pending(gpio_number));
+    }
+
+    if (!active_backend->reconfigure(next))
+    {
+        fprintf(stderr, "The %s GPIO backend can't apply the new configuration!\n",
+                active_backend->name);
+        success = false;
+        goto done;
+    }
+
+    for (size_t gpio_number = 0; gpio_number < num_gpio; gpio_number++)
+    {
+        if (pin_bitmap_get(before.present_words, gpio_number)
+            && !pin_bitmap_get(after.present_words, gpio_number))
+        {
+            unconfigure_gpio(gpio_number);
+            reload->num_removed++;
+        }
+    }
+
+    /* No other thread uses pins while the configuration is swapped. */
+    free(gpio_deferred.pending_words);
+    free(gpio_deferred.claimed_words);
+    free(gpio_deferred.directions);
+    gpio_deferred.pending_words = deferred_words;
+    gpio_deferred.claimed_words = deferred_claimed_words;
+    gpio_deferred.directions = deferred_directions;
+    gpio_deferred.num_gpio = num_deferred_gpio;
+    gpio_deferred.num_pending = 0;
+    deferred_words = NULL;
+    deferred_claimed_words = NULL;
+    deferred_directions = NULL;
+
+    for (size_t gpio_number = 0; gpio_number < num_gpio; gpio_number++)
+    {
+        if (!pin_bitmap_get(after.present_words, gpio_number))
+        {
+            continue;
+        }
+
+        bool const present = pin_bitmap_get(before.present_words, gpio_number);
+        bool const kept =
+            present
+            && same_direction(before.directions[gpio_number], after.directions[gpio_number]);
+        bool const configured = kept && !pin_bitmap_get(was_pending, gpio_number);
+        gpio_direction_t const direction = after.directions[gpio_number];
+
+        if (kept)
+        {
+            reload->num_kept++;
+        }
+        else if (present)
+        {
+            reload->num_changed++;
+        }
+        else
+        {
+            reload->num_added++;
+        }
+
+        /*
+         * A configured pin is left alone. A changed one is reconfigured
+         * now, as it may be driving a line that is now an input.
+         */
+        if (configured)
+        {
+            continue;
+        }
+
+        if (lazy
+            && !pin_bitmap_get(after.monitored_words, gpio_number)
+            && (!present || pin_bitmap_get(was_pending, gpio_number)))
+        {
+            deferred_add(gpio_number, direction);
+        }
+        else if (!setup_add_pin(&setup, gpio_number, direction))
+        {
+            reload->num_failed++;
+        }
+    }
+
+    setup_run(&setup);
+    for (size_t index = 0; index < setup.num_chips; index++)
+    {
+        reload->num_failed += setup.chips[index].num_failed;
+    }
+
+    success = true;
+
+done:
+    setup_free(&setup);
+    pin_table_free(&before);
+    pin_table_free(&after);
+    free(was_pending);
+    free(deferred_words);
+    free(deferred_claimed_words);
+    free(deferred_directions);
+
+    return success;
+}
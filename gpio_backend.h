@@ -0,0 +1,167 @@
+#ifndef __GPIO_BACKEND_H__
+#define __GPIO_BACKEND_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Called from uloop when a watched input changes. The timestamp is taken
+ * from CLOCK_MONOTONIC.
+ */
+typedef void (*gpio_edge_callback_fn)(
+    void * callback_ctx,
+    size_t gpio_number,
+    bool state,
+    uint64_t timestamp_ns);
+
+/*
+ * How a pin is configured. Making a pin an output sets its level in the
+ * same step, so there is no glitch before the first write.
+ */
+typedef enum gpio_direction_t
+{
+    gpio_direction_in,
+    gpio_direction_out_low,
+    gpio_direction_out_high
+} gpio_direction_t;
+
+/*
+ * Operations table implemented by each GPIO backend.
+ * All operations return 0 on success and -1 on failure, except that
+ * export_pin returns 1 if the pin was already exported.
+ * Any operation other than read and write may be left NULL.
+ * Bulk operations pass states as a pin bitmap (see pin_bitmap.h), where
+ * bit N holds the state of gpio_numbers[N].
+ */
+typedef struct gpio_backend_st
+{
+    char const * name;
+
+    /* Called before any pin is configured and after all pins are released. */
+    bool (*open)(configuration_st const * configuration);
+    void (*close)(void);
+
+    int (*export_pin)(size_t gpio_number);
+    int (*unexport_pin)(size_t gpio_number);
+    int (*set_direction)(size_t gpio_number, gpio_direction_t direction);
+
+    int (*read)(size_t gpio_number, bool * state);
+    int (*write)(size_t gpio_number, bool high);
+
+    int (*read_bulk)(size_t const * gpio_numbers, size_t count, uint64_t * state_words);
+    int (*write_bulk)(size_t const * gpio_numbers, uint64_t const * state_words, size_t count);
+
+    int (*watch_edge)(
+        size_t gpio_number,
+        gpio_edge_t edge,
+        gpio_edge_callback_fn callback,
+        void * callback_ctx);
+    void (*unwatch_edge)(size_t gpio_number);
+
+    /*
+     * Identify the controller a pin belongs to. Operations on different
+     * controllers may be run in parallel.
+     */
+    int (*chip_of)(size_t gpio_number, size_t * chip);
+
+    /*
+     * Take on a reloaded configuration without disturbing pins in both the
+     * old and new ones. Called before pins are added or removed, and must
+     * leave the backend unchanged if it fails. If NULL, a reload closes and
+     * reopens the backend.
+     */
+    bool (*reconfigure)(configuration_st const * configuration);
+} gpio_backend_st;
+
+gpio_backend_st const * gpio_backend_lookup(char const * const name);
+
+bool gpio_backend_select(char const * const name);
+
+char const * gpio_backend_name(void);
+
+int gpio_backend_read(size_t const gpio_number, bool * const state);
+
+int gpio_backend_write(size_t const gpio_number, bool const high);
+
+int gpio_backend_read_bulk(
+    size_t const * const gpio_numbers,
+    size_t const count,
+    uint64_t * const state_words);
+
+int gpio_backend_write_bulk(
+    size_t const * const gpio_numbers,
+    uint64_t const * const state_words,
+    size_t const count);
+
+int gpio_backend_watch_edge(
+    size_t const gpio_number,
+    gpio_edge_t const edge,
+    gpio_edge_callback_fn const callback,
+    void * const callback_ctx);
+
+void gpio_backend_unwatch_edge(size_t const gpio_number);
+
+/* The controller a pin belongs to, or 0 if the backend can't tell. */
+size_t gpio_backend_chip(size_t const gpio_number);
+
+/*
+ * Export and set the direction of every configured pin. Pins on different
+ * chips are configured in parallel. With lazy export, only monitored pins
+ * are configured now, and the others when they are first used.
+ */
+bool enable_gpio_pins(configuration_st const * const configuration);
+void disable_gpio_pins(configuration_st const * const configuration);
+
+/*
+ * Configure any pins still deferred by lazy export on a background thread,
+ * if the configuration asks for it.
+ */
+bool gpio_backend_prewarm_start(configuration_st const * const configuration);
+
+/* What the last enable_gpio_pins() did, and how long it took. */
+typedef struct gpio_startup_st
+{
+    uint64_t duration_ns;
+    size_t num_pins;
+    size_t num_already_exported;
+    size_t num_failed;
+    size_t num_chips;
+    /* Pins left by lazy export, and how many of those are still to be configured. */
+    size_t num_deferred;
+    size_t num_pending;
+} gpio_startup_st;
+
+void gpio_backend_startup(gpio_startup_st * const startup);
+
+/* What a gpio_backend_reload() changed. */
+typedef struct gpio_reload_st
+{
+    size_t num_added;
+    size_t num_removed;
+    /* Pins changed between input and output. */
+    size_t num_changed;
+    size_t num_kept;
+    size_t num_failed;
+    /* True if the backend had to be closed and reopened. */
+    bool reopened;
+    /* True if the previous configuration's pins couldn't be set up again. */
+    bool restore_failed;
+} gpio_reload_st;
+
+/*
+ * Move from the previous configuration's pins to the next's. Only pins that
+ * were added, removed or changed direction are touched. Returns false if the
+ * change can't be made, in which case the previous configuration's pins are
+ * left as they were unless the backend was reopened. Monitors and worker
+ * threads using the pins must be stopped first.
+ */
+bool gpio_backend_reload(
+    configuration_st const * const previous,
+    configuration_st const * const next,
+    gpio_reload_st * const reload);
+
+
+#endif /* __GPIO_BACKEND_H__ */
@@ -0,0 +1,272 @@
+#include "gpio_stats.h"
+#include "monotonic.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct gpio_stats_counters_st
+{
+    atomic_uint_fast64_t calls;
+    atomic_uint_fast64_t errors;
+    atomic_uint_fast64_t total_ns;
+    atomic_uint_fast64_t max_ns;
+    atomic_uint_fast64_t histogram[GPIO_STATS_BUCKETS];
+} gpio_stats_counters_st;
+
+/* Pins only keep counters for the operations on a single pin, to limit their size. */
+typedef struct gpio_stats_pin_st
+{
+    gpio_stats_counters_st open;
+    gpio_stats_counters_st close;
+    gpio_stats_counters_st read;
+    gpio_stats_counters_st write;
+} gpio_stats_pin_st;
+
+typedef struct gpio_stats_st
+{
+    gpio_stats_counters_st ops[gpio_stats_op_count];
+    size_t num_pins;
+    gpio_stats_pin_st * pins;
+} gpio_stats_st;
+
+static gpio_stats_st gpio_stats;
+
+static char const * const op_names[gpio_stats_op_count] =
+{
+    [gpio_stats_op_open] = "open",
+    [gpio_stats_op_close] = "close",
+    [gpio_stats_op_read] = "read",
+    [gpio_stats_op_write] = "write",
+    [gpio_stats_op_read_bulk] = "read_bulk",
+    [gpio_stats_op_write_bulk] = "write_bulk",
+    [gpio_stats_op_export] = "export",
+    [gpio_stats_op_unexport] = "unexport",
+    [gpio_stats_op_direction] = "direction",
+    [gpio_stats_op_ubus_get] = "ubus_get",
+    [gpio_stats_op_ubus_set] = "ubus_set"
+};
+
+static unsigned int
+latency_bucket(uint64_t const latency_ns)
+{
+    unsigned int const bucket = latency_ns == 0 ? 0 : 64 - __builtin_clzll(latency_ns);
+
+    return bucket < GPIO_STATS_BUCKETS ? bucket : GPIO_STATS_BUCKETS - 1;
+}
+
+static void
+counters_record(
+    gpio_stats_counters_st * const counters,
+    uint64_t const latency_ns,
+    bool const success)
+{
+    atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+    if (!success)
+    {
+        atomic_fetch_add_explicit(&counters->errors, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&counters->total_ns, latency_ns, memory_order_relaxed);
+
+    uint_fast64_t max_ns = atomic_load_explicit(&counters->max_ns, memory_order_relaxed);
+
+    while (latency_ns > max_ns
+           && !atomic_compare_exchange_weak_explicit(
+               &counters->max_ns, &max_ns, latency_ns,
+               memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+
+    atomic_fetch_add_explicit(
+        &counters->histogram[latency_bucket(latency_ns)], 1, memory_order_relaxed);
+}
+
+static void
+counters_read(gpio_stats_counters_st * const counters, gpio_stats_snapshot_st * const snapshot)
+{
+    snapshot->calls = atomic_load_explicit(&counters->calls, memory_order_relaxed);
+    snapshot->errors = atomic_load_explicit(&counters->errors, memory_order_relaxed);
+    snapshot->total_ns = atomic_load_explicit(&counters->total_ns, memory_order_relaxed);
+    snapshot->max_ns = atomic_load_explicit(&counters->max_ns, memory_order_relaxed);
+    for (size_t bucket = 0; bucket < GPIO_STATS_BUCKETS; bucket++)
+    {
+        snapshot->histogram[bucket] =
+            atomic_load_explicit(&counters->histogram[bucket], memory_order_relaxed);
+    }
+}
+
+static void
+counters_reset(gpio_stats_counters_st * const counters)
+{
+    atomic_store_explicit(&counters->calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->max_ns, 0, memory_order_relaxed);
+    for (size_t bucket = 0; bucket < GPIO_STATS_BUCKETS; bucket++)
+    {
+        atomic_store_explicit(&counters->histogram[bucket], 0, memory_order_relaxed);
+    }
+}
+
+/* The counters a pin keeps for an operation, or NULL if it keeps none. */
+static gpio_stats_counters_st *
+pin_counters(size_t const gpio_number, gpio_stats_op_t const op)
+{
+    gpio_stats_counters_st * counters;
+
+    if (gpio_number >= gpio_stats.num_pins)
+    {
+        counters = NULL;
+        goto done;
+    }
+
+    gpio_stats_pin_st * const pin = &gpio_stats.pins[gpio_number];
+
+    switch (op)
+    {
+    case gpio_stats_op_open:
+        counters = &pin->open;
+        break;
+
+    case gpio_stats_op_close:
+        counters = &pin->close;
+        break;
+
+    case gpio_stats_op_read:
+        counters = &pin->read;
+        break;
+
+    case gpio_stats_op_write:
+        counters = &pin->write;
+        break;
+
+    default:
+        counters = NULL;
+        break;
+    }
+
+done:
+    return counters;
+}
+
+bool gpio_stats_start(configuration_st const * const configuration)
+{
+    bool success;
+
+    gpio_stats.num_pins = configuration_highest_gpio_number(configuration) + 1;
+    gpio_stats.pins = calloc(gpio_stats.num_pins, sizeof *gpio_stats.pins);
+    if (gpio_stats.pins == NULL)
+    {
+        gpio_stats.num_pins = 0;
+        success = false;
+        goto done;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+bool gpio_stats_reconfigure(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_pins = configuration_highest_gpio_number(configuration) + 1;
+
+    if (num_pins <= gpio_stats.num_pins)
+    {
+        success = true;
+        goto done;
+    }
+
+    gpio_stats_pin_st * const pins = realloc(gpio_stats.pins, num_pins * sizeof *pins);
+
+    if (pins == NULL)
+    {
+        success = false;
+        goto done;
+    }
+    memset(&pins[gpio_stats.num_pins], 0, (num_pins - gpio_stats.num_pins) * sizeof *pins);
+    gpio_stats.pins = pins;
+    gpio_stats.num_pins = num_pins;
+
+    success = true;
+
+done:
+    return success;
+}
+
+void gpio_stats_stop(void)
+{
+    free(gpio_stats.pins);
+    gpio_stats.pins = NULL;
+    gpio_stats.num_pins = 0;
+}
+
+char const * gpio_stats_op_name(gpio_stats_op_t const op)
+{
+    return op < gpio_stats_op_count ? op_names[op] : NULL;
+}
+
+void gpio_stats_record(
+    gpio_stats_op_t const op,
+    size_t const gpio_number,
+    uint64_t const start_ns,
+    bool const success)
+{
+    uint64_t const latency_ns = monotonic_time_ns() - start_ns;
+    gpio_stats_counters_st * const counters = pin_counters(gpio_number, op);
+
+    counters_record(&gpio_stats.ops[op], latency_ns, success);
+    if (counters != NULL)
+    {
+        counters_record(counters, latency_ns, success);
+    }
+}
+
+void gpio_stats_op(gpio_stats_op_t const op, gpio_stats_snapshot_st * const snapshot)
+{
+    counters_read(&gpio_stats.ops[op], snapshot);
+}
+
+size_t gpio_stats_num_pins(void)
+{
+    return gpio_stats.num_pins;
+}
+
+bool gpio_stats_pin(
+    size_t const gpio_number,
+    gpio_stats_op_t const op,
+    gpio_stats_snapshot_st * const snapshot)
+{
+    bool success;
+    gpio_stats_counters_st * const counters = pin_counters(gpio_number, op);
+
+    if (counters == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    counters_read(counters, snapshot);
+    success = true;
+
+done:
+    return success;
+}
+
+void gpio_stats_reset(void)
+{
+    for (size_t op = 0; op < gpio_stats_op_count; op++)
+    {
+        counters_reset(&gpio_stats.ops[op]);
+    }
+
+    for (size_t pin = 0; pin < gpio_stats.num_pins; pin++)
+    {
+        counters_reset(&gpio_stats.pins[pin].open);
+        counters_reset(&gpio_stats.pins[pin].close);
+        counters_reset(&gpio_stats.pins[pin].read);
+        counters_reset(&gpio_stats.pins[pin].write);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef __GPIO_STATS_H__
+#define __GPIO_STATS_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Call counts, error counts and latency histograms for GPIO operations,
+ * kept per operation, and per pin for value file opens, closes, reads and
+ * writes. Latency histograms have a bucket per
+ * power of two nanoseconds; bucket N counts latencies below 2^N ns that
+ * didn't fit in bucket N - 1. Counters are updated with relaxed atomics
+ * so that they can be updated from any thread without locks.
+ */
+#define GPIO_STATS_BUCKETS 32
+#define GPIO_STATS_NO_PIN SIZE_MAX
+
+typedef enum gpio_stats_op_t
+{
+    gpio_stats_op_open,
+    gpio_stats_op_close,
+    gpio_stats_op_read,
+    gpio_stats_op_write,
+    gpio_stats_op_read_bulk,
+    gpio_stats_op_write_bulk,
+    gpio_stats_op_export,
+    gpio_stats_op_unexport,
+    gpio_stats_op_direction,
+    gpio_stats_op_ubus_get,
+    gpio_stats_op_ubus_set,
+    gpio_stats_op_count
+} gpio_stats_op_t;
+
+typedef struct gpio_stats_snapshot_st
+{
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t histogram[GPIO_STATS_BUCKETS];
+} gpio_stats_snapshot_st;
+
+bool gpio_stats_start(configuration_st const * const configuration);
+void gpio_stats_stop(void);
+
+/*
+ * Make room for the pins of a reloaded configuration, keeping the counts so
+ * far. Only called while no other thread records statistics.
+ */
+bool gpio_stats_reconfigure(configuration_st const * const configuration);
+
+char const * gpio_stats_op_name(gpio_stats_op_t const op);
+
+/*
+ * Record an operation that started at start_ns (from monotonic_time_ns()).
+ * gpio_number may be GPIO_STATS_NO_PIN for operations not on a single pin.
+ */
+void gpio_stats_record(
+    gpio_stats_op_t const op,
+    size_t const gpio_number,
+    uint64_t const start_ns,
+    bool const success);
+
+void gpio_stats_op(gpio_stats_op_t const op, gpio_stats_snapshot_st * const snapshot);
+
+/* The number of pins with statistics, which are numbered from 0. */
+size_t gpio_stats_num_pins(void);
+
+/* Pins only have statistics for value file opens and closes, and single pin reads and writes. */
+bool gpio_stats_pin(
+    size_t const gpio_number,
+    gpio_stats_op_t const op,
+    gpio_stats_snapshot_st * const snapshot);
+
+void gpio_stats_reset(void);
+
+
+#endif /* __GPIO_STATS_H__ */
@@ -0,0 +1,690 @@
+#include "gpio_worker_pool.h"
+#include "gpio_backend.h"
+#include "pin_bitmap.h"
+#include "monotonic.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+typedef enum gpio_job_type_t
+{
+    gpio_job_write,
+    gpio_job_read_bulk,
+    gpio_job_write_bulk
+} gpio_job_type_t;
+
+/* A bulk operation, which is split into a job for each controller. */
+typedef struct gpio_batch_st
+{
+    uint64_t * state_words;
+    uint64_t * read_ns;
+    size_t pending;
+    int result;
+    gpio_worker_done_fn done;
+    void * done_ctx;
+} gpio_batch_st;
+
+typedef struct gpio_job_st gpio_job_st;
+
+struct gpio_job_st
+{
+    gpio_job_st * next;
+    gpio_job_type_t type;
+    int result;
+
+    /* gpio_job_write */
+    size_t gpio_number;
+    bool high;
+    gpio_worker_done_fn done;
+    void * done_ctx;
+
+    /* gpio_job_read_bulk and gpio_job_write_bulk */
+    gpio_batch_st * batch;
+    size_t count;
+    size_t * gpio_numbers;
+    /* Where each pin's state goes in the batch's bitmap. */
+    size_t * indexes;
+    uint64_t * state_words;
+    /* gpio_job_read_bulk, when the worker finished reading. */
+    uint64_t read_ns;
+};
+
+typedef struct gpio_job_queue_st
+{
+    gpio_job_st * head;
+    gpio_job_st * tail;
+} gpio_job_queue_st;
+
+typedef struct gpio_worker_shard_st
+{
+    size_t chip;
+    pthread_t thread;
+    bool thread_started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    gpio_job_queue_st jobs;
+    bool stopping;
+} gpio_worker_shard_st;
+
+typedef struct gpio_worker_pool_st
+{
+    bool running;
+    size_t num_shards;
+    gpio_worker_shard_st * shards;
+
+    /* Indexed by GPIO number. */
+    size_t num_gpios;
+    size_t * gpio_shards;
+
+    /* Finished jobs are passed back to uloop through the eventfd. */
+    struct uloop_fd completion_fd;
+    pthread_mutex_t completion_lock;
+    gpio_job_queue_st completed;
+} gpio_worker_pool_st;
+
+static gpio_worker_pool_st gpio_worker_pool =
+{
+    .completion_fd = { .fd = -1 },
+    .completion_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static void
+job_queue_push(gpio_job_queue_st * const queue, gpio_job_st * const job)
+{
+    job->next = NULL;
+    if (queue->tail != NULL)
+    {
+        queue->tail->next = job;
+    }
+    else
+    {
+        queue->head = job;
+    }
+    queue->tail = job;
+}
+
+static gpio_job_st *
+job_queue_pop(gpio_job_queue_st * const queue)
+{
+    gpio_job_st * const job = queue->head;
+
+    if (job != NULL)
+    {
+        queue->head = job->next;
+        if (queue->head == NULL)
+        {
+            queue->tail = NULL;
+        }
+    }
+
+    return job;
+}
+
+static void
+job_free(gpio_job_st * const job)
+{
+    free(job->gpio_numbers);
+    free(job->indexes);
+    free(job->state_words);
+    free(job);
+}
+
+static void
+job_run(gpio_job_st * const job)
+{
+    switch (job->type)
+    {
+    case gpio_job_write:
+        job->result = gpio_backend_write(job->gpio_number, job->high);
+        break;
+
+    case gpio_job_read_bulk:
+        job->result = gpio_backend_read_bulk(job->gpio_numbers, job->count, job->state_words);
+        job->read_ns = monotonic_time_ns();
+        break;
+
+    case gpio_job_write_bulk:
+        job->result = gpio_backend_write_bulk(job->gpio_numbers, job->state_words, job->count);
+        break;
+    }
+}
+
+/* Called from uloop. */
+static void
+job_complete(gpio_job_st * const job)
+{
+    gpio_batch_st * const batch = job->batch;
+
+    if (batch == NULL)
+    {
+        if (job->done != NULL)
+        {
+            job->done(job->done_ctx, job->result);
+        }
+        goto done;
+    }
+
+    if (job->result < 0)
+    {
+        batch->result = -1;
+    }
+    else if (job->type == gpio_job_read_bulk)
+    {
+        for (size_t index = 0; index < job->count; index++)
+        {
+            pin_bitmap_assign(
+                batch->state_words,
+                job->indexes[index],
+                pin_bitmap_get(job->state_words, index));
+        }
+        if (batch->read_ns != NULL && job->read_ns > *batch->read_ns)
+        {
+            *batch->read_ns = job->read_ns;
+        }
+    }
+
+    if (--batch->pending == 0)
+    {
+        if (batch->done != NULL)
+        {
+            batch->done(batch->done_ctx, batch->result);
+        }
+        free(batch);
+    }
+
+done:
+    job_free(job);
+}
+
+static void
+completions_ready(struct uloop_fd * const u, unsigned int const events)
+{
+    uint64_t count;
+    gpio_job_queue_st completed;
+
+    if (read(u->fd, &count, sizeof count) != sizeof count)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&gpio_worker_pool.completion_lock);
+    completed = gpio_worker_pool.completed;
+    gpio_worker_pool.completed = (gpio_job_queue_st){ 0 };
+    pthread_mutex_unlock(&gpio_worker_pool.completion_lock);
+
+    for (gpio_job_st * job = job_queue_pop(&completed); job != NULL; job = job_queue_pop(&completed))
+    {
+        job_complete(job);
+    }
+
+done:
+    return;
+}
+
+static void *
+shard_thread(void * const arg)
+{
+    gpio_worker_shard_st * const shard = arg;
+    static uint64_t const one = 1;
+
+    pthread_mutex_lock(&shard->lock);
+    for (;;)
+    {
+        while (shard->jobs.head == NULL && !shard->stopping)
+        {
+            pthread_cond_wait(&shard->wake, &shard->lock);
+        }
+        if (shard->stopping)
+        {
+            break;
+        }
+
+        gpio_job_st * const job = job_queue_pop(&shard->jobs);
+
+        pthread_mutex_unlock(&shard->lock);
+
+        job_run(job);
+
+        pthread_mutex_lock(&gpio_worker_pool.completion_lock);
+        job_queue_push(&gpio_worker_pool.completed, job);
+        pthread_mutex_unlock(&gpio_worker_pool.completion_lock);
+        if (write(gpio_worker_pool.completion_fd.fd, &one, sizeof one) != sizeof one)
+        {
+            DPRINTF("Failed to signal a GPIO job completion\n");
+        }
+
+        pthread_mutex_lock(&shard->lock);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return NULL;
+}
+
+static void
+shard_submit(gpio_worker_shard_st * const shard, gpio_job_st * const job)
+{
+    pthread_mutex_lock(&shard->lock);
+    job_queue_push(&shard->jobs, job);
+    pthread_cond_signal(&shard->wake);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static size_t
+shard_index(size_t const gpio_number)
+{
+    return gpio_number < gpio_worker_pool.num_gpios ? gpio_worker_pool.gpio_shards[gpio_number] : 0;
+}
+
+static size_t
+find_shard(size_t const chip)
+{
+    size_t index;
+
+    for (index = 0; index < gpio_worker_pool.num_shards; index++)
+    {
+        if (gpio_worker_pool.shards[index].chip == chip)
+        {
+            break;
+        }
+    }
+
+    return index;
+}
+
+/* Find or add the shard for the controller a pin is on. */
+static bool
+assign_shard(size_t const gpio_number)
+{
+    bool success;
+    size_t const chip = gpio_backend_chip(gpio_number);
+    size_t const index = find_shard(chip);
+
+    if (index == gpio_worker_pool.num_shards)
+    {
+        gpio_worker_shard_st * const shards =
+            realloc(gpio_worker_pool.shards, (index + 1) * sizeof *shards);
+
+        if (shards == NULL)
+        {
+            success = false;
+            goto done;
+        }
+        gpio_worker_pool.shards = shards;
+        gpio_worker_pool.shards[index] = (gpio_worker_shard_st){ .chip = chip };
+        gpio_worker_pool.num_shards++;
+    }
+
+    gpio_worker_pool.gpio_shards[gpio_number] = index;
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+assign_shards(configuration_st const * const configuration)
+{
+    bool success;
+
+    for (size_t index = 0; index < configuration_num_inputs(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_input_gpio_number(configuration, index, &gpio_number)
+            || !assign_shard(gpio_number))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    for (size_t index = 0; index < configuration_num_outputs(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_output_gpio_number(configuration, index, &gpio_number)
+            || !assign_shard(gpio_number))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    for (size_t index = 0; index < configuration_num_counters(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (!configuration_counter_gpio_number(configuration, index, &gpio_number)
+            || !assign_shard(gpio_number))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+bool gpio_worker_pool_start(configuration_st const * const configuration)
+{
+    bool success;
+
+    if (!configuration_worker_pool(configuration))
+    {
+        success = true;
+        goto done;
+    }
+
+    gpio_worker_pool.num_gpios = configuration_highest_gpio_number(configuration) + 1;
+    gpio_worker_pool.gpio_shards =
+        calloc(gpio_worker_pool.num_gpios, sizeof *gpio_worker_pool.gpio_shards);
+    if (gpio_worker_pool.gpio_shards == NULL || !assign_shards(configuration))
+    {
+        success = false;
+        goto done;
+    }
+
+    int const fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fd < 0)
+    {
+        success = false;
+        goto done;
+    }
+    gpio_worker_pool.completion_fd.fd = fd;
+    gpio_worker_pool.completion_fd.cb = completions_ready;
+    uloop_fd_add(&gpio_worker_pool.completion_fd, ULOOP_READ);
+
+    for (size_t index = 0; index < gpio_worker_pool.num_shards; index++)
+    {
+        gpio_worker_shard_st * const shard = &gpio_worker_pool.shards[index];
+
+        pthread_mutex_init(&shard->lock, NULL);
+        pthread_cond_init(&shard->wake, NULL);
+        if (pthread_create(&shard->thread, NULL, shard_thread, shard) != 0)
+        {
+            DPRINTF("Failed to start GPIO worker thread for chip %zu\n", shard->chip);
+            success = false;
+            goto done;
+        }
+        shard->thread_started = true;
+    }
+
+    DPRINTF("Started %zu GPIO worker threads\n", gpio_worker_pool.num_shards);
+    gpio_worker_pool.running = true;
+    success = true;
+
+done:
+    if (!success)
+    {
+        gpio_worker_pool_stop();
+    }
+
+    return success;
+}
+
+void gpio_worker_pool_stop(void)
+{
+    gpio_worker_pool.running = false;
+
+    for (size_t index = 0; index < gpio_worker_pool.num_shards; index++)
+    {
+        gpio_worker_shard_st * const shard = &gpio_worker_pool.shards[index];
+
+        if (!shard->thread_started)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&shard->lock);
+        shard->stopping = true;
+        pthread_cond_signal(&shard->wake);
+        pthread_mutex_unlock(&shard->lock);
+        pthread_join(shard->thread, NULL);
+    }
+
+    /*
+     * All threads have stopped, so nothing else touches the queues. Jobs
+     * still queued are run here, in order, so a write a caller was told had
+     * been queued still reaches its pin, and every completion is called.
+     */
+    for (gpio_job_st * job = job_queue_pop(&gpio_worker_pool.completed);
+         job != NULL;
+         job = job_queue_pop(&gpio_worker_pool.completed))
+    {
+        job_complete(job);
+    }
+
+    for (size_t index = 0; index < gpio_worker_pool.num_shards; index++)
+    {
+        gpio_worker_shard_st * const shard = &gpio_worker_pool.shards[index];
+
+        if (!shard->thread_started)
+        {
+            continue;
+        }
+
+        for (gpio_job_st * job = job_queue_pop(&shard->jobs); job != NULL; job = job_queue_pop(&shard->jobs))
+        {
+            job_run(job);
+            job_complete(job);
+        }
+        pthread_cond_destroy(&shard->wake);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    if (gpio_worker_pool.completion_fd.fd >= 0)
+    {
+        uloop_fd_delete(&gpio_worker_pool.completion_fd);
+        close(gpio_worker_pool.completion_fd.fd);
+        gpio_worker_pool.completion_fd.fd = -1;
+    }
+
+    free(gpio_worker_pool.shards);
+    gpio_worker_pool.shards = NULL;
+    gpio_worker_pool.num_shards = 0;
+    free(gpio_worker_pool.gpio_shards);
+    gpio_worker_pool.gpio_shards = NULL;
+    gpio_worker_pool.num_gpios = 0;
+}
+
+bool gpio_worker_pool_is_running(void)
+{
+    return gpio_worker_pool.running;
+}
+
+size_t gpio_worker_pool_num_threads(void)
+{
+    return gpio_worker_pool.running ? gpio_worker_pool.num_shards : 0;
+}
+
+bool gpio_worker_pool_write(
+    size_t const gpio_number,
+    bool const high,
+    gpio_worker_done_fn const done,
+    void * const done_ctx)
+{
+    bool success;
+
+    if (!gpio_worker_pool.running)
+    {
+        success = false;
+        goto done;
+    }
+
+    gpio_job_st * const job = calloc(1, sizeof *job);
+
+    if (job == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    job->type = gpio_job_write;
+    job->gpio_number = gpio_number;
+    job->high = high;
+    job->done = done;
+    job->done_ctx = done_ctx;
+    shard_submit(&gpio_worker_pool.shards[shard_index(gpio_number)], job);
+    success = true;
+
+done:
+    return success;
+}
+
+static bool
+submit_bulk(
+    gpio_job_type_t const type,
+    size_t const * const gpio_numbers,
+    size_t const count,
+    uint64_t * const state_words,
+    uint64_t * const read_ns,
+    gpio_worker_done_fn const done,
+    void * const done_ctx)
+{
+    bool success;
+    gpio_batch_st * batch = NULL;
+    gpio_job_st * * jobs = NULL;
+
+    if (!gpio_worker_pool.running || count == 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    batch = calloc(1, sizeof *batch);
+    jobs = calloc(gpio_worker_pool.num_shards, sizeof *jobs);
+    if (batch == NULL || jobs == NULL)
+    {
+        success = false;
+        goto done;
+    }
+    batch->state_words = state_words;
+    batch->read_ns = read_ns;
+    if (read_ns != NULL)
+    {
+        *read_ns = 0;
+    }
+    batch->done = done;
+    batch->done_ctx = done_ctx;
+
+    /* Count the pins on each controller first, so each job is sized once. */
+    for (size_t index = 0; index < count; index++)
+    {
+        size_t const shard = shard_index(gpio_numbers[index]);
+
+        if (jobs[shard] == NULL)
+        {
+            jobs[shard] = calloc(1, sizeof *jobs[shard]);
+            if (jobs[shard] == NULL)
+            {
+                success = false;
+                goto done;
+            }
+            jobs[shard]->type = type;
+            jobs[shard]->batch = batch;
+        }
+        jobs[shard]->count++;
+    }
+
+    for (size_t shard = 0; shard < gpio_worker_pool.num_shards; shard++)
+    {
+        gpio_job_st * const job = jobs[shard];
+
+        if (job == NULL)
+        {
+            continue;
+        }
+
+        job->gpio_numbers = calloc(job->count, sizeof *job->gpio_numbers);
+        job->indexes = calloc(job->count, sizeof *job->indexes);
+        job->state_words = calloc(pin_bitmap_num_words(job->count), sizeof *job->state_words);
+        if (job->gpio_numbers == NULL || job->indexes == NULL || job->state_words == NULL)
+        {
+            success = false;
+            goto done;
+        }
+        job->count = 0;
+    }
+
+    for (size_t index = 0; index < count; index++)
+    {
+        gpio_job_st * const job = jobs[shard_index(gpio_numbers[index])];
+
+        job->gpio_numbers[job->count] = gpio_numbers[index];
+        job->indexes[job->count] = index;
+        if (type == gpio_job_write_bulk)
+        {
+            pin_bitmap_assign(job->state_words, job->count, pin_bitmap_get(state_words, index));
+        }
+        job->count++;
+    }
+
+    for (size_t shard = 0; shard < gpio_worker_pool.num_shards; shard++)
+    {
+        if (jobs[shard] != NULL)
+        {
+            batch->pending++;
+        }
+    }
+
+    for (size_t shard = 0; shard < gpio_worker_pool.num_shards; shard++)
+    {
+        if (jobs[shard] != NULL)
+        {
+            shard_submit(&gpio_worker_pool.shards[shard], jobs[shard]);
+            jobs[shard] = NULL;
+        }
+    }
+    batch = NULL;
+    success = true;
+
+done:
+    if (jobs != NULL)
+    {
+        for (size_t shard = 0; shard < gpio_worker_pool.num_shards; shard++)
+        {
+            if (jobs[shard] != NULL)
+            {
+                job_free(jobs[shard]);
+            }
+        }
+        free(jobs);
+    }
+    free(batch);
+
+    return success;
+}
+
+bool gpio_worker_pool_read_bulk(
+    size_t const * const gpio_numbers,
+    size_t const count,
+    uint64_t * const state_words,
+    uint64_t * const read_ns,
+    gpio_worker_done_fn const done,
+    void * const done_ctx)
+{
+    return submit_bulk(
+        gpio_job_read_bulk, gpio_numbers, count, state_words, read_ns, done, done_ctx);
+}
+
+bool gpio_worker_pool_write_bulk(
+    size_t const * const gpio_numbers,
+    uint64_t const * const state_words,
+    size_t const count,
+    gpio_worker_done_fn const done,
+    void * const done_ctx)
+{
+    /* The states are copied into the jobs, so aren't written through. */
+    return submit_bulk(
+        gpio_job_write_bulk, gpio_numbers, count, (uint64_t *)state_words, NULL, done, done_ctx);
+}
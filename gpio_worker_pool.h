@@ -0,0 +1,66 @@
+#ifndef __GPIO_WORKER_POOL_H__
+#define __GPIO_WORKER_POOL_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Runs blocking backend operations on worker threads, so that a slow GPIO
+ * controller doesn't stall uloop. There is a thread for each controller
+ * (see gpio_backend_chip()) that configured pins are on, so operations on
+ * one controller are run in the order they were submitted, while
+ * controllers are accessed in parallel.
+ * Completions are called from uloop.
+ */
+typedef void (*gpio_worker_done_fn)(void * ctx, int result);
+
+/* Does nothing unless the configuration enables the pool. */
+bool gpio_worker_pool_start(configuration_st const * const configuration);
+
+/*
+ * Operations still outstanding are run on the calling thread, and all
+ * completions called, before this returns.
+ */
+void gpio_worker_pool_stop(void);
+
+bool gpio_worker_pool_is_running(void);
+
+size_t gpio_worker_pool_num_threads(void);
+
+bool gpio_worker_pool_write(
+    size_t const gpio_number,
+    bool const high,
+    gpio_worker_done_fn const done,
+    void * const done_ctx);
+
+/*
+ * Read count pins into the state_words pin bitmap, which must remain valid
+ * until done is called. The pins are split by controller, and done is
+ * called once all of them have been read. If read_ns isn't NULL it is set
+ * to when the last controller's pins were read, rather than when done is
+ * called, and must also remain valid.
+ */
+bool gpio_worker_pool_read_bulk(
+    size_t const * const gpio_numbers,
+    size_t const count,
+    uint64_t * const state_words,
+    uint64_t * const read_ns,
+    gpio_worker_done_fn const done,
+    void * const done_ctx);
+
+/*
+ * Write count pins from the state_words pin bitmap, which is copied. done is
+ * called once the pins on every controller have been written.
+ */
+bool gpio_worker_pool_write_bulk(
+    size_t const * const gpio_numbers,
+    uint64_t const * const state_words,
+    size_t const count,
+    gpio_worker_done_fn const done,
+    void * const done_ctx);
+
+
+#endif /* __GPIO_WORKER_POOL_H__ */
@@ -0,0 +1,607 @@
+#include "input_monitor.h"
+#include "gpio_backend.h"
+#include "gpio_worker_pool.h"
+#include "pin_bitmap.h"
+#include "debounce.h"
+#include "storm_guard.h"
+#include "interlock.h"
+#include "shm_state.h"
+#include "monotonic.h"
+#include "ubus.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_EVENT_ID "sysfs.gpio.input"
+
+typedef struct input_monitor_st
+{
+    bool cached;
+    unsigned int resync_ms;
+    struct uloop_timeout resync_timer;
+    /* Set while a resync is being read by the worker pool. */
+    bool resync_queued;
+    /* When the worker pool read the queued resync. */
+    uint64_t resync_read_ns;
+
+    size_t num_inputs;
+    size_t num_words;
+    size_t * gpio_numbers;
+
+    /* Pin bitmaps, indexed by input instance. */
+    uint64_t * read_words;
+    uint64_t * state_words;
+    uint64_t * valid_words;
+    uint64_t * all_inputs_words;
+    uint64_t * debounced_words;
+    uint64_t * held_words;
+    /*
+     * Inputs that have changed since the queued resync was submitted. Their
+     * state is newer than the one being read, so the read is ignored.
+     */
+    uint64_t * changed_words;
+
+    /* When each input was last refreshed. */
+    uint64_t * updated_ns;
+} input_monitor_st;
+
+static input_monitor_st input_monitor;
+static struct blob_buf input_event_buf;
+
+static void
+send_input_event(size_t const instance, bool const state, uint64_t const timestamp_ns)
+{
+    blob_buf_init(&input_event_buf, 0);
+    blobmsg_add_string(&input_event_buf, "io type", "binary-input");
+    blobmsg_add_u32(&input_event_buf, "instance", instance);
+    blobmsg_add_u8(&input_event_buf, "value", state);
+    blobmsg_add_u64(&input_event_buf, "timestamp", timestamp_ns);
+
+    gpio_ubus_send_event(INPUT_EVENT_ID, input_event_buf.head);
+}
+
+static void
+note_input_changed(size_t const instance)
+{
+    if (input_monitor.resync_queued)
+    {
+        pin_bitmap_assign(input_monitor.changed_words, instance, true);
+    }
+}
+
+/* A new (debounced, if configured) state for an input. */
+static void
+input_commit(size_t const instance, bool const state, uint64_t const timestamp_ns)
+{
+    if (input_monitor.cached)
+    {
+        note_input_changed(instance);
+        pin_bitmap_assign(input_monitor.state_words, instance, state);
+        pin_bitmap_assign(input_monitor.valid_words, instance, true);
+        input_monitor.updated_ns[instance] = timestamp_ns;
+    }
+
+    interlock_input_changed(instance, state);
+    shm_state_input_changed(instance, state, timestamp_ns);
+    send_input_event(instance, state, timestamp_ns);
+}
+
+/* A change seen on an input, either from an edge or from polling. */
+static void
+input_event(size_t const instance, bool const state, uint64_t const timestamp_ns)
+{
+    if (debounce_is_enabled(instance))
+    {
+        if (input_monitor.cached)
+        {
+            note_input_changed(instance);
+        }
+        debounce_input_event(instance, state, timestamp_ns);
+    }
+    else
+    {
+        input_commit(instance, state, timestamp_ns);
+    }
+}
+
+static void
+input_changed(
+    void * const callback_ctx,
+    size_t const gpio_number,
+    bool const state,
+    uint64_t const timestamp_ns)
+{
+    size_t const instance = (uintptr_t)callback_ctx;
+
+    input_event(instance, state, timestamp_ns);
+    storm_guard_edge(instance, timestamp_ns);
+}
+
+static void
+resync_input_changed(void * const ctx, size_t const instance, bool const state)
+{
+    uint64_t const * const now_ns = ctx;
+
+    /* The input changed without an edge being reported. */
+    interlock_input_changed(instance, state);
+    shm_state_input_changed(instance, state, *now_ns);
+    send_input_event(instance, state, *now_ns);
+}
+
+static void
+resync_debounced_input_changed(void * const ctx, size_t const instance, bool const state)
+{
+    uint64_t const * const now_ns = ctx;
+
+    debounce_input_event(instance, state, *now_ns);
+}
+
+/*
+ * Update the cache from the states read into read_words at read_ns. Inputs
+ * in skip_words, if not NULL, keep their cached state.
+ */
+static void
+resync_apply(uint64_t const * const skip_words, uint64_t read_ns)
+{
+    for (size_t word = 0; word < input_monitor.num_words && skip_words != NULL; word++)
+    {
+        input_monitor.read_words[word] =
+            (input_monitor.read_words[word] & ~skip_words[word])
+            | (input_monitor.state_words[word] & skip_words[word]);
+    }
+
+    /*
+     * Debounced inputs with a known state keep that state. Any difference
+     * is passed to the debouncer, which decides whether the input changed.
+     */
+    for (size_t word = 0; word < input_monitor.num_words; word++)
+    {
+        input_monitor.held_words[word] =
+            input_monitor.valid_words[word] & input_monitor.debounced_words[word];
+    }
+
+    pin_bitmap_for_each_change(
+        input_monitor.state_words,
+        input_monitor.read_words,
+        input_monitor.held_words,
+        input_monitor.num_words,
+        resync_debounced_input_changed,
+        &read_ns);
+
+    for (size_t word = 0; word < input_monitor.num_words; word++)
+    {
+        uint64_t const held = input_monitor.held_words[word];
+        uint64_t const unchanged =
+            ~(input_monitor.state_words[word] ^ input_monitor.read_words[word]);
+        uint64_t const skipped = skip_words != NULL ? skip_words[word] : 0;
+
+        /* Reuse the scratch space for the inputs that can change now. */
+        input_monitor.held_words[word] = input_monitor.valid_words[word] & ~held;
+        input_monitor.read_words[word] =
+            (input_monitor.read_words[word] & ~held) | (input_monitor.state_words[word] & held);
+
+        for (uint64_t refreshed =
+                 (~held | unchanged) & ~skipped & input_monitor.all_inputs_words[word];
+             refreshed != 0;
+             refreshed &= refreshed - 1)
+        {
+            size_t const instance =
+                word * PIN_BITMAP_WORD_BITS + pin_bitmap_next_bit(refreshed);
+
+            input_monitor.updated_ns[instance] = read_ns;
+        }
+    }
+
+    pin_bitmap_for_each_change(
+        input_monitor.state_words,
+        input_monitor.read_words,
+        input_monitor.held_words,
+        input_monitor.num_words,
+        resync_input_changed,
+        &read_ns);
+
+    size_t const num_bytes = input_monitor.num_words * sizeof *input_monitor.state_words;
+
+    memcpy(input_monitor.state_words, input_monitor.read_words, num_bytes);
+    memcpy(input_monitor.valid_words, input_monitor.all_inputs_words, num_bytes);
+}
+
+static void
+resync_inputs(void)
+{
+    if (gpio_backend_read_bulk(
+            input_monitor.gpio_numbers,
+            input_monitor.num_inputs,
+            input_monitor.read_words) < 0)
+    {
+        DPRINTF("Failed to resync inputs\n");
+        goto done;
+    }
+
+    resync_apply(NULL, monotonic_time_ns());
+
+done:
+    return;
+}
+
+static void
+queued_resync_done(void * const ctx, int const result)
+{
+    input_monitor.resync_queued = false;
+
+    if (result < 0)
+    {
+        DPRINTF("Failed to resync inputs\n");
+        goto done;
+    }
+
+    resync_apply(input_monitor.changed_words, input_monitor.resync_read_ns);
+
+done:
+    return;
+}
+
+static void
+resync_timer_expired(struct uloop_timeout * const timeout)
+{
+    if (!gpio_worker_pool_is_running())
+    {
+        resync_inputs();
+    }
+    else if (!input_monitor.resync_queued)
+    {
+        /* The read is done off the uloop thread. A slow resync is left to finish. */
+        pin_bitmap_clear(input_monitor.changed_words, input_monitor.num_words);
+        input_monitor.resync_queued = gpio_worker_pool_read_bulk(
+            input_monitor.gpio_numbers,
+            input_monitor.num_inputs,
+            input_monitor.read_words,
+            &input_monitor.resync_read_ns,
+            queued_resync_done,
+            NULL);
+    }
+    uloop_timeout_set(timeout, input_monitor.resync_ms);
+}
+
+static bool
+input_cache_start(configuration_st const * const configuration)
+{
+    bool success;
+
+    input_monitor.resync_ms = configuration_resync_ms(configuration);
+    input_monitor.state_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.state_words);
+    input_monitor.valid_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.valid_words);
+    input_monitor.held_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.held_words);
+    input_monitor.changed_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.changed_words);
+    input_monitor.updated_ns =
+        calloc(input_monitor.num_inputs, sizeof *input_monitor.updated_ns);
+    if (input_monitor.state_words == NULL
+        || input_monitor.valid_words == NULL
+        || input_monitor.held_words == NULL
+        || input_monitor.changed_words == NULL
+        || input_monitor.updated_ns == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    input_monitor.cached = true;
+    resync_inputs();
+
+    if (input_monitor.resync_ms > 0)
+    {
+        input_monitor.resync_timer.cb = resync_timer_expired;
+        uloop_timeout_set(&input_monitor.resync_timer, input_monitor.resync_ms);
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static void
+input_cache_stop(void)
+{
+    uloop_timeout_cancel(&input_monitor.resync_timer);
+    input_monitor.resync_queued = false;
+    input_monitor.cached = false;
+
+    free(input_monitor.state_words);
+    input_monitor.state_words = NULL;
+    free(input_monitor.valid_words);
+    input_monitor.valid_words = NULL;
+    free(input_monitor.held_words);
+    input_monitor.held_words = NULL;
+    free(input_monitor.changed_words);
+    input_monitor.changed_words = NULL;
+    free(input_monitor.updated_ns);
+    input_monitor.updated_ns = NULL;
+}
+
+static bool
+input_gpio_numbers_load(configuration_st const * const configuration)
+{
+    bool success;
+
+    input_monitor.num_words = pin_bitmap_num_words(input_monitor.num_inputs);
+    input_monitor.gpio_numbers =
+        calloc(input_monitor.num_inputs, sizeof *input_monitor.gpio_numbers);
+    input_monitor.read_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.read_words);
+    input_monitor.all_inputs_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.all_inputs_words);
+    input_monitor.debounced_words =
+        calloc(input_monitor.num_words, sizeof *input_monitor.debounced_words);
+    if (input_monitor.gpio_numbers == NULL
+        || input_monitor.read_words == NULL
+        || input_monitor.all_inputs_words == NULL
+        || input_monitor.debounced_words == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < input_monitor.num_inputs; index++)
+    {
+        if (!configuration_input_gpio_number(
+                configuration, index, &input_monitor.gpio_numbers[index]))
+        {
+            success = false;
+            goto done;
+        }
+        pin_bitmap_assign(input_monitor.all_inputs_words, index, true);
+        pin_bitmap_assign(
+            input_monitor.debounced_words,
+            index,
+            configuration_input_debounce_ms(configuration, index) > 0);
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static void
+input_gpio_numbers_free(void)
+{
+    free(input_monitor.gpio_numbers);
+    input_monitor.gpio_numbers = NULL;
+    free(input_monitor.read_words);
+    input_monitor.read_words = NULL;
+    free(input_monitor.all_inputs_words);
+    input_monitor.all_inputs_words = NULL;
+    free(input_monitor.debounced_words);
+    input_monitor.debounced_words = NULL;
+    input_monitor.num_words = 0;
+}
+
+bool input_monitor_start(configuration_st const * const configuration)
+{
+    bool success = true;
+
+    input_monitor.num_inputs = configuration_num_inputs(configuration);
+
+    if (!input_gpio_numbers_load(configuration))
+    {
+        DPRINTF("Unable to load input configuration\n");
+        input_gpio_numbers_free();
+        input_monitor.num_inputs = 0;
+        success = false;
+        goto done;
+    }
+
+    if (!debounce_start(configuration, input_commit))
+    {
+        DPRINTF("Unable to start input debouncing\n");
+        success = false;
+    }
+
+    if (!storm_guard_start(configuration, input_event, input_changed))
+    {
+        DPRINTF("Unable to start input storm protection\n");
+        success = false;
+    }
+
+    if (configuration_inputs_cached(configuration)
+        && !input_cache_start(configuration))
+    {
+        DPRINTF("Unable to start the input cache\n");
+        input_cache_stop();
+        success = false;
+    }
+
+    for (size_t index = 0; index < input_monitor.num_inputs; index++)
+    {
+        gpio_edge_t const edge = configuration_input_edge(configuration, index);
+
+        if (edge == gpio_edge_none)
+        {
+            continue;
+        }
+
+        if (gpio_backend_watch_edge(
+                input_monitor.gpio_numbers[index],
+                edge,
+                input_changed,
+                (void *)(uintptr_t)index) < 0)
+        {
+            DPRINTF("Unable to monitor input: %zu\n", index);
+            success = false;
+        }
+    }
+
+done:
+    return success;
+}
+
+void input_monitor_stop(configuration_st const * const configuration)
+{
+    for (size_t index = 0; index < configuration_num_inputs(configuration); index++)
+    {
+        size_t gpio_number;
+
+        if (configuration_input_edge(configuration, index) == gpio_edge_none
+            || !configuration_input_gpio_number(configuration, index, &gpio_number))
+        {
+            continue;
+        }
+
+        gpio_backend_unwatch_edge(gpio_number);
+    }
+
+    storm_guard_stop();
+    input_cache_stop();
+    debounce_stop();
+    input_gpio_numbers_free();
+    input_monitor.num_inputs = 0;
+    blob_buf_free(&input_event_buf);
+}
+
+bool input_monitor_is_cached(void)
+{
+    return input_monitor.cached;
+}
+
+bool input_monitor_cached_state(
+    size_t const instance,
+    bool * const state,
+    uint64_t * const updated_ns)
+{
+    bool success;
+
+    if (!input_monitor.cached
+        || instance >= input_monitor.num_inputs
+        || !pin_bitmap_get(input_monitor.valid_words, instance))
+    {
+        success = false;
+        goto done;
+    }
+
+    *state = pin_bitmap_get(input_monitor.state_words, instance);
+    if (updated_ns != NULL)
+    {
+        *updated_ns = input_monitor.updated_ns[instance];
+    }
+    success = true;
+
+done:
+    return success;
+}
+
+bool input_monitor_read(size_t const instance, bool * const state)
+{
+    bool success;
+
+    if (instance >= input_monitor.num_inputs)
+    {
+        success = false;
+        goto done;
+    }
+
+    if (input_monitor.cached)
+    {
+        success = input_monitor_cached_state(instance, state, NULL);
+        goto done;
+    }
+
+    if (debounce_is_enabled(instance))
+    {
+        success = debounce_stable_state(instance, state);
+        goto done;
+    }
+
+    success = gpio_backend_read(input_monitor.gpio_numbers[instance], state) == 0;
+
+done:
+    return success;
+}
+
+bool input_monitor_read_all(uint64_t * const state_words)
+{
+    bool success;
+    size_t const num_bytes = input_monitor.num_words * sizeof *state_words;
+
+    if (input_monitor.cached)
+    {
+        if (memcmp(input_monitor.valid_words, input_monitor.all_inputs_words, num_bytes) != 0)
+        {
+            success = false;
+            goto done;
+        }
+
+        memcpy(state_words, input_monitor.state_words, num_bytes);
+        success = true;
+        goto done;
+    }
+
+    pin_bitmap_clear(state_words, input_monitor.num_words);
+    if (gpio_backend_read_bulk(
+            input_monitor.gpio_numbers,
+            input_monitor.num_inputs,
+            state_words) < 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    /* Debounced inputs report their last stable state. */
+    for (size_t word = 0; word < input_monitor.num_words; word++)
+    {
+        for (uint64_t debounced = input_monitor.debounced_words[word];
+             debounced != 0;
+             debounced &= debounced - 1)
+        {
+            size_t const instance =
+                word * PIN_BITMAP_WORD_BITS + pin_bitmap_next_bit(debounced);
+            bool state;
+
+            if (debounce_stable_state(instance, &state))
+            {
+                pin_bitmap_assign(state_words, instance, state);
+            }
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+bool input_monitor_gpio_number(size_t const instance, size_t * const gpio_number)
+{
+    bool success;
+
+    if (instance >= input_monitor.num_inputs)
+    {
+        success = false;
+        goto done;
+    }
+
+    *gpio_number = input_monitor.gpio_numbers[instance];
+    success = true;
+
+done:
+    return success;
+}
+
+size_t input_monitor_num_inputs(void)
+{
+    return input_monitor.num_inputs;
+}
+
+size_t input_monitor_num_words(void)
+{
+    return input_monitor.num_words;
+}
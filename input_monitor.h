@@ -0,0 +1,50 @@
+#ifndef __INPUT_MONITOR_H__
+#define __INPUT_MONITOR_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Watch each input configured with an edge, and send a UBUS event each
+ * time one changes.
+ * If the configuration enables the input cache, the state of every input
+ * is also kept in memory. The cache is updated by edge events and by a
+ * periodic read of all inputs, which catches any missed edges.
+ */
+bool input_monitor_start(configuration_st const * const configuration);
+void input_monitor_stop(configuration_st const * const configuration);
+
+bool input_monitor_is_cached(void);
+
+/*
+ * Get the cached state of an input, along with the time (CLOCK_MONOTONIC)
+ * it was last refreshed.
+ */
+bool input_monitor_cached_state(
+    size_t const instance,
+    bool * const state,
+    uint64_t * const updated_ns);
+
+/*
+ * Read an input from the cache, from the debouncer, or from the hardware,
+ * depending on the configuration.
+ */
+bool input_monitor_read(size_t const instance, bool * const state);
+
+/*
+ * Read all inputs with a single backend operation into a pin bitmap of
+ * input_monitor_num_words() words.
+ */
+bool input_monitor_read_all(uint64_t * const state_words);
+
+size_t input_monitor_num_inputs(void);
+
+/* The GPIO an input is on. */
+bool input_monitor_gpio_number(size_t const instance, size_t * const gpio_number);
+
+size_t input_monitor_num_words(void);
+
+
+#endif /* __INPUT_MONITOR_H__ */
@@ -0,0 +1,196 @@
+#include "interlock.h"
+#include "output_state.h"
+#include "pwm_output.h"
+#include "input_monitor.h"
+#include "pin_bitmap.h"
+#include "debug.h"
+
+#include <stdlib.h>
+
+typedef struct interlock_action_st
+{
+    bool input_state;
+    size_t output;
+    bool output_state;
+} interlock_action_st;
+
+/*
+ * The actions for input N are actions[first_action[N]] up to
+ * actions[first_action[N + 1]].
+ */
+typedef struct interlock_st
+{
+    size_t num_inputs;
+    size_t * first_action;
+    interlock_action_st * actions;
+
+    /* The last state seen of each input, once known. */
+    uint64_t * input_words;
+    uint64_t * known_words;
+
+    /* The number of active rules holding each output. */
+    size_t num_outputs;
+    size_t * active_rules;
+} interlock_st;
+
+static interlock_st interlock;
+
+bool interlock_start(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_rules = configuration_num_rules(configuration);
+
+    if (num_rules == 0)
+    {
+        success = true;
+        goto done;
+    }
+
+    interlock.num_inputs = configuration_num_inputs(configuration);
+    interlock.first_action = calloc(interlock.num_inputs + 1, sizeof *interlock.first_action);
+    interlock.actions = calloc(num_rules, sizeof *interlock.actions);
+    interlock.input_words =
+        calloc(pin_bitmap_num_words(interlock.num_inputs), sizeof *interlock.input_words);
+    interlock.known_words =
+        calloc(pin_bitmap_num_words(interlock.num_inputs), sizeof *interlock.known_words);
+    interlock.num_outputs = configuration_num_outputs(configuration);
+    interlock.active_rules = calloc(interlock.num_outputs, sizeof *interlock.active_rules);
+    if (interlock.first_action == NULL
+        || interlock.actions == NULL
+        || interlock.input_words == NULL
+        || interlock.known_words == NULL
+        || (interlock.num_outputs > 0 && interlock.active_rules == NULL))
+    {
+        success = false;
+        goto done;
+    }
+
+    /* Count the rules for each input, then place each rule in its input's slots. */
+    for (size_t index = 0; index < num_rules; index++)
+    {
+        interlock.first_action[configuration_rule(configuration, index)->input + 1]++;
+    }
+
+    for (size_t input = 0; input < interlock.num_inputs; input++)
+    {
+        interlock.first_action[input + 1] += interlock.first_action[input];
+    }
+
+    size_t * const next_action = calloc(interlock.num_inputs, sizeof *next_action);
+
+    if (next_action == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < num_rules; index++)
+    {
+        configuration_rule_st const * const rule = configuration_rule(configuration, index);
+        size_t const slot = interlock.first_action[rule->input] + next_action[rule->input]++;
+
+        interlock.actions[slot] = (interlock_action_st)
+        {
+            .input_state = rule->input_state,
+            .output = rule->output,
+            .output_state = rule->output_state
+        };
+    }
+
+    free(next_action);
+
+    /* Bring the outputs into line with the inputs' current state. */
+    for (size_t input = 0; input < interlock.num_inputs; input++)
+    {
+        bool state;
+
+        if (interlock.first_action[input] != interlock.first_action[input + 1]
+            && input_monitor_read(input, &state))
+        {
+            interlock_input_changed(input, state);
+        }
+    }
+
+    success = true;
+
+done:
+    if (!success)
+    {
+        interlock_stop();
+    }
+
+    return success;
+}
+
+void interlock_stop(void)
+{
+    for (size_t output = 0; output < interlock.num_outputs; output++)
+    {
+        if (interlock.active_rules != NULL && interlock.active_rules[output] > 0)
+        {
+            output_state_release(output);
+        }
+    }
+
+    free(interlock.first_action);
+    interlock.first_action = NULL;
+    free(interlock.actions);
+    interlock.actions = NULL;
+    free(interlock.input_words);
+    interlock.input_words = NULL;
+    free(interlock.known_words);
+    interlock.known_words = NULL;
+    free(interlock.active_rules);
+    interlock.active_rules = NULL;
+    interlock.num_inputs = 0;
+    interlock.num_outputs = 0;
+}
+
+/*
+ * While an input is in a rule's state, the rule holds its output so that no
+ * client write can set it to the other level.
+ */
+void interlock_input_changed(size_t const instance, bool const state)
+{
+    if (instance >= interlock.num_inputs)
+    {
+        goto done;
+    }
+
+    bool const known = pin_bitmap_get(interlock.known_words, instance);
+    bool const previous = pin_bitmap_get(interlock.input_words, instance);
+
+    pin_bitmap_assign(interlock.known_words, instance, true);
+    pin_bitmap_assign(interlock.input_words, instance, state);
+
+    for (size_t index = interlock.first_action[instance];
+         index < interlock.first_action[instance + 1];
+         index++)
+    {
+        interlock_action_st const * const action = &interlock.actions[index];
+        bool const was_active = known && action->input_state == previous;
+
+        if (was_active && action->input_state != state
+            && --interlock.active_rules[action->output] == 0)
+        {
+            output_state_release(action->output);
+        }
+
+        if (action->input_state == state)
+        {
+            if (!was_active)
+            {
+                interlock.active_rules[action->output]++;
+            }
+            output_state_hold(action->output, action->output_state);
+            pwm_output_cancel(action->output);
+            if (!output_state_write(action->output, action->output_state))
+            {
+                DPRINTF("Interlock failed to write output: %zu\n", action->output);
+            }
+        }
+    }
+
+done:
+    return;
+}
@@ -0,0 +1,23 @@
+#ifndef __INTERLOCK_H__
+#define __INTERLOCK_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+
+/*
+ * Applies the configured rules, which set outputs when inputs change,
+ * without involving UBUS clients. The rules are compiled into a table
+ * indexed by input, so only the rules for the changed input are checked.
+ * While a rule's input stays in its state, writes that would set the
+ * output to the other level are rejected (see output_state_hold()).
+ * Start after the input monitor, as the rules are first applied to the
+ * current state of the inputs.
+ */
+bool interlock_start(configuration_st const * const configuration);
+void interlock_stop(void);
+
+void interlock_input_changed(size_t const instance, bool const state);
+
+
+#endif /* __INTERLOCK_H__ */
@@ -0,0 +1,118 @@
+#include "io_type_table.h"
+#include "debug.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_IO_TYPES 8
+/* A power of two, at least twice MAX_IO_TYPES to keep probe chains short. */
+#define IO_TYPE_SLOTS 16
+
+typedef struct io_type_table_st
+{
+    size_t num_io_types;
+    io_type_st io_types[MAX_IO_TYPES];
+    /* Index + 1 into io_types, or 0 for an empty slot. */
+    uint8_t slots[IO_TYPE_SLOTS];
+} io_type_table_st;
+
+static io_type_table_st io_type_table;
+
+/* FNV-1a */
+static uint32_t
+io_type_hash(char const * name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name != '\0')
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t
+find_slot(char const * const name)
+{
+    size_t slot = io_type_hash(name) & (IO_TYPE_SLOTS - 1);
+
+    /* The table is never full, so this ends at a match or an empty slot. */
+    while (io_type_table.slots[slot] != 0
+           && strcmp(io_type_table.io_types[io_type_table.slots[slot] - 1].name, name) != 0)
+    {
+        slot = (slot + 1) & (IO_TYPE_SLOTS - 1);
+    }
+
+    return slot;
+}
+
+bool io_type_register(io_type_st const * const io_type)
+{
+    bool success;
+
+    if (io_type_table.num_io_types >= MAX_IO_TYPES)
+    {
+        DPRINTF("Too many io types to register: %s\n", io_type->name);
+        success = false;
+        goto done;
+    }
+
+    size_t const slot = find_slot(io_type->name);
+
+    if (io_type_table.slots[slot] != 0)
+    {
+        DPRINTF("io type already registered: %s\n", io_type->name);
+        success = false;
+        goto done;
+    }
+
+    io_type_table.io_types[io_type_table.num_io_types] = *io_type;
+    io_type_table.num_io_types++;
+    io_type_table.slots[slot] = io_type_table.num_io_types;
+    success = true;
+
+done:
+    return success;
+}
+
+void io_type_clear(void)
+{
+    memset(&io_type_table, 0, sizeof io_type_table);
+}
+
+io_type_st const * io_type_lookup(char const * const name)
+{
+    uint8_t const index = io_type_table.slots[find_slot(name)];
+
+    return index != 0 ? &io_type_table.io_types[index - 1] : NULL;
+}
+
+bool io_type_get(char const * const name, size_t const instance, ubus_gpio_data_type_st * const value)
+{
+    io_type_st const * const io_type = io_type_lookup(name);
+
+    return io_type != NULL
+        && io_type->get != NULL
+        && instance < io_type->count
+        && io_type->get(instance, value);
+}
+
+bool io_type_set(char const * const name, size_t const instance, ubus_gpio_data_type_st const * const value)
+{
+    io_type_st const * const io_type = io_type_lookup(name);
+
+    return io_type != NULL
+        && io_type->set != NULL
+        && instance < io_type->count
+        && io_type->set(instance, value);
+}
+
+void io_type_for_each(void (* const callback)(void * ctx, io_type_st const * io_type), void * const ctx)
+{
+    for (size_t index = 0; index < io_type_table.num_io_types; index++)
+    {
+        callback(ctx, &io_type_table.io_types[index]);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef __IO_TYPE_TABLE_H__
+#define __IO_TYPE_TABLE_H__
+
+#include <libubusgpio/ubus_gpio_server.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The io types served over UBUS, registered once at startup. Each io type
+ * is found by a hash of its name, and its instance is bounds-checked
+ * against its count before its handler is called, so handlers only see
+ * valid instances.
+ */
+typedef bool (*io_type_get_fn)(size_t const instance, ubus_gpio_data_type_st * const value);
+typedef bool (*io_type_set_fn)(size_t const instance, ubus_gpio_data_type_st const * const value);
+
+typedef struct io_type_st
+{
+    char const * name;
+    size_t count;
+    /* NULL if the io type can't be read or written. */
+    io_type_get_fn get;
+    io_type_set_fn set;
+} io_type_st;
+
+bool io_type_register(io_type_st const * const io_type);
+void io_type_clear(void);
+
+/* NULL if the io type isn't registered. */
+io_type_st const * io_type_lookup(char const * const name);
+
+bool io_type_get(char const * const name, size_t const instance, ubus_gpio_data_type_st * const value);
+
+bool io_type_set(char const * const name, size_t const instance, ubus_gpio_data_type_st const * const value);
+
+/* Call 'callback' with each registered io type, in the order registered. */
+void io_type_for_each(void (* const callback)(void * ctx, io_type_st const * io_type), void * const ctx);
+
+
+#endif /* __IO_TYPE_TABLE_H__ */
@@ -1,5 +1,19 @@
 #include "daemonize.h"
-#include "sysfs_gpio_module.h"
+#include "gpio_backend.h"
+#include "input_monitor.h"
+#include "sampler.h"
+#include "pulse_counter.h"
+#include "pwm_output.h"
+#include "output_sequence.h"
+#include "interlock.h"
+#include "shm_state.h"
+#include "fast_socket.h"
+#include "io_type_table.h"
+#include "gpio_stats.h"
+#include "gpio_worker_pool.h"
+#include "monotonic.h"
+#include "output_state.h"
+#include "ubus_ext.h"
 #include "ubus.h"
 #include "configuration.h"
 #include "debug.h"
@@ -13,11 +27,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <time.h>
 #include <math.h>
 
 configuration_st const * configuration;
+static char const * configuration_filename;
 
 static void usage(char const * const program_name)
 {
@@ -29,114 +47,302 @@ static void usage(char const * const program_name)
     fprintf(stdout, "  -c %-21s %s\n", "config", "Configuration filename");
 }
 
-static bool get_callback(
-    void * const callback_ctx,
-    char const * const io_type,
-    size_t const instance,
-    ubus_gpio_data_type_st * const value)
+static bool get_binary_input(size_t const instance, ubus_gpio_data_type_st * const value)
 {
     bool read_io;
+    bool state;
+
+    read_io = input_monitor_read(instance, &state);
 
-    if (strcmp(io_type, "binary-input") != 0)
+    if (!read_io)
     {
-        read_io = false;
         goto done;
     }
 
-    if (instance >= configuration_num_inputs(configuration))
+    value->type = ubus_gpio_data_type_bool;
+    value->value.b = state;
+
+done:
+    return read_io;
+}
+
+static bool get_counter(size_t const instance, ubus_gpio_data_type_st * const value)
+{
+    bool read_io;
+    uint64_t count;
+
+    read_io = pulse_counter_read(instance, &count);
+
+    if (!read_io)
     {
-        read_io = false;
         goto done;
     }
 
-    size_t gpio_number;
+    /* The count wraps at 32 bits, the largest integer UBUS GPIO can carry. */
+    value->type = ubus_gpio_data_type_int;
+    value->value.u32 = count;
+
+done:
+    return read_io;
+}
+
+static bool get_counter_rate(size_t const instance, ubus_gpio_data_type_st * const value)
+{
+    bool read_io;
+    double rate;
+
+    read_io = pulse_counter_rate(instance, &rate);
 
-    if (!configuration_input_gpio_number(
-            configuration,
-            instance,
-            &gpio_number))
+    if (!read_io)
     {
-        read_io = false;
         goto done;
     }
 
-    bool state;
+    value->type = ubus_gpio_data_type_double;
+    value->value.dbl = rate;
 
-    read_io = GPIORead(gpio_number, &state) == 0;
+done:
+    return read_io;
+}
+
+static bool get_pwm_output(size_t const instance, ubus_gpio_data_type_st * const value)
+{
+    bool read_io;
+    double duty_percent;
+
+    read_io = pwm_output_duty(instance, &duty_percent);
 
     if (!read_io)
     {
         goto done;
     }
 
-    value->type = ubus_gpio_data_type_bool;
-    value->value.b = state; 
+    value->type = ubus_gpio_data_type_double;
+    value->value.dbl = duty_percent;
 
 done:
     return read_io;
 }
 
-static bool set_callback(
-    void * const callback_ctx,
-    char const * const io_type,
-    size_t const instance,
-    ubus_gpio_data_type_st const * const value)
+static bool set_binary_output(size_t const instance, ubus_gpio_data_type_st const * const value)
 {
     bool wrote_io;
+    bool state;
 
-    if (strcmp(io_type, "binary-output") != 0)
+    switch (value->type)
     {
-        wrote_io = false;
-        goto done;
+        case ubus_gpio_data_type_bool:
+            state = value->value.b;
+            break;
+        case ubus_gpio_data_type_int:
+            state = !!value->value.u32;
+            break;
+        case ubus_gpio_data_type_double:
+            state = fabs(value->value.dbl) > 0.01f;
+            break;
+        default:
+            wrote_io = false;
+            goto done;
     }
 
-    if (instance >= configuration_num_outputs(configuration))
-    {
-        wrote_io = false;
-        goto done;
-    }
+    pwm_output_cancel(instance);
+    wrote_io = output_state_write(instance, state);
+
+done:
+    return wrote_io;
+}
 
-    size_t gpio_number;
+/* Writing a counter sets its count, usually back to 0. */
+static bool set_counter(size_t const instance, ubus_gpio_data_type_st const * const value)
+{
+    bool wrote_io;
+    uint64_t count;
 
-    if (!configuration_output_gpio_number(
-            configuration,
-            instance,
-            &gpio_number))
+    switch (value->type)
     {
-        wrote_io = false;
-        goto done;
+        case ubus_gpio_data_type_bool:
+            count = 0;
+            break;
+        case ubus_gpio_data_type_int:
+            count = value->value.u32;
+            break;
+        case ubus_gpio_data_type_double:
+            if (value->value.dbl < 0)
+            {
+                wrote_io = false;
+                goto done;
+            }
+            count = value->value.dbl;
+            break;
+        default:
+            wrote_io = false;
+            goto done;
     }
 
-    bool state;
+    wrote_io = pulse_counter_set(instance, count);
+
+done:
+    return wrote_io;
+}
+
+/* Writing a pwm-output sets its duty cycle, in percent. */
+static bool set_pwm_output(size_t const instance, ubus_gpio_data_type_st const * const value)
+{
+    bool wrote_io;
+    double duty_percent;
+
     switch (value->type)
     {
         case ubus_gpio_data_type_bool:
-            state = value->value.b;
+            duty_percent = value->value.b ? 100.0 : 0.0;
             break;
         case ubus_gpio_data_type_int:
-            state = !!value->value.u32;
+            duty_percent = value->value.u32;
             break;
         case ubus_gpio_data_type_double:
-            state = fabs(value->value.dbl) > 0.01f;
+            duty_percent = value->value.dbl;
             break;
         default:
             wrote_io = false;
             goto done;
     }
 
-    wrote_io = GPIOWrite(gpio_number, state)== 0;
+    wrote_io = pwm_output_set(instance, 0, duty_percent);
 
 done:
     return wrote_io;
 }
 
+static bool register_io_types(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_counters = configuration_num_counters(configuration);
+    /* Counter types are only registered when counters are configured. */
+    struct
+    {
+        io_type_st io_type;
+        bool optional;
+    } const io_types[] =
+    {
+        {
+            .io_type =
+            {
+                .name = "binary-input",
+                .count = configuration_num_inputs(configuration),
+                .get = get_binary_input
+            }
+        },
+        {
+            .io_type =
+            {
+                .name = "binary-output",
+                .count = configuration_num_outputs(configuration),
+                .set = set_binary_output
+            }
+        },
+        {
+            .io_type =
+            {
+                .name = "pwm-output",
+                .count = configuration_num_outputs(configuration),
+                .get = get_pwm_output,
+                .set = set_pwm_output
+            }
+        },
+        {
+            .io_type =
+            {
+                .name = "counter",
+                .count = num_counters,
+                .get = get_counter,
+                .set = set_counter
+            },
+            .optional = true
+        },
+        {
+            .io_type =
+            {
+                .name = "counter-rate",
+                .count = num_counters,
+                .get = get_counter_rate
+            },
+            .optional = true
+        }
+    };
+
+    for (size_t index = 0; index < ARRAY_SIZE(io_types); index++)
+    {
+        if (io_types[index].optional && io_types[index].io_type.count == 0)
+        {
+            continue;
+        }
+
+        if (!io_type_register(&io_types[index].io_type))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static bool get_callback(
+    void * const callback_ctx,
+    char const * const io_type,
+    size_t const instance,
+    ubus_gpio_data_type_st * const value)
+{
+    uint64_t const start_ns = monotonic_time_ns();
+    bool const read_io = io_type_get(io_type, instance, value);
+
+    gpio_stats_record(gpio_stats_op_ubus_get, GPIO_STATS_NO_PIN, start_ns, read_io);
+
+    return read_io;
+}
+
+static bool set_callback(
+    void * const callback_ctx,
+    char const * const io_type,
+    size_t const instance,
+    ubus_gpio_data_type_st const * const value)
+{
+    uint64_t const start_ns = monotonic_time_ns();
+    bool const wrote_io = io_type_set(io_type, instance, value);
+
+    gpio_stats_record(gpio_stats_op_ubus_set, GPIO_STATS_NO_PIN, start_ns, wrote_io);
+
+    return wrote_io;
+}
+
+typedef struct count_ctx_st
+{
+    append_count_callback_fn append_callback;
+    void * append_ctx;
+} count_ctx_st;
+
+static void append_io_type_count(void * const ctx, io_type_st const * const io_type)
+{
+    count_ctx_st const * const count_ctx = ctx;
+
+    count_ctx->append_callback(count_ctx->append_ctx, io_type->name, io_type->count);
+}
+
 static void count_callback(
     void * const callback,
     append_count_callback_fn const append_callback,
     void * const append_ctx)
 {
-    append_callback(append_ctx, "binary-input", configuration_num_inputs(configuration));
-    append_callback(append_ctx, "binary-output", configuration_num_outputs(configuration));
+    count_ctx_st count_ctx =
+    {
+        .append_callback = append_callback,
+        .append_ctx = append_ctx
+    };
+
+    io_type_for_each(append_io_type_count, &count_ctx);
 }
 
 static ubus_gpio_server_handlers_st const ubus_gpio_server_handlers =
@@ -152,6 +358,228 @@ static ubus_gpio_server_handlers_st const ubus_gpio_server_handlers =
     }
 };
 
+/* Set up everything that serves the configured pins over UBUS. */
+static bool io_start(configuration_st const * const configuration, bool const reloading)
+{
+    /* Readers of the shared memory page keep it across a reload if possible. */
+    if (reloading)
+    {
+        shm_state_reload(configuration);
+    }
+    else
+    {
+        shm_state_start(configuration);
+    }
+    output_state_start(configuration);
+
+    return register_io_types(configuration);
+}
+
+static void io_stop(bool const reloading)
+{
+    output_state_stop();
+    if (!reloading)
+    {
+        shm_state_stop();
+    }
+    io_type_clear();
+}
+
+/* Start whatever watches or drives the pins from uloop and worker threads. */
+static void monitors_start(configuration_st const * const configuration, bool const reloading)
+{
+    gpio_worker_pool_start(configuration);
+    input_monitor_start(configuration);
+    /* PWM is on the new instances before an interlock rule can cancel it. */
+    if (reloading)
+    {
+        pwm_output_reload(configuration);
+    }
+    else
+    {
+        pwm_output_start(configuration);
+    }
+    interlock_start(configuration);
+    if (reloading)
+    {
+        fast_socket_reload(configuration);
+    }
+    else
+    {
+        fast_socket_start(configuration);
+    }
+    sampler_start(configuration);
+    if (reloading)
+    {
+        pulse_counter_resume(configuration);
+    }
+    else
+    {
+        pulse_counter_start(configuration);
+    }
+    if (reloading)
+    {
+        output_sequence_reload(configuration);
+    }
+    else
+    {
+        output_sequence_start(configuration);
+    }
+    gpio_backend_prewarm_start(configuration);
+}
+
+static void monitors_stop(configuration_st const * const configuration, bool const reloading)
+{
+    /* Outstanding operations are finished first, so nothing completes after this. */
+    gpio_worker_pool_stop();
+    /*
+     * Nothing is served from uloop while a reload runs, so fast path
+     * clients, sequences, PWM and pulse counts are carried over to the next
+     * configuration.
+     */
+    if (reloading)
+    {
+        pulse_counter_suspend();
+    }
+    else
+    {
+        fast_socket_stop();
+        output_sequence_stop();
+        pwm_output_stop();
+        pulse_counter_stop();
+    }
+    sampler_stop();
+    input_monitor_stop(configuration);
+    interlock_stop();
+}
+
+/*
+ * Load the configuration file again and move to it, only touching the pins
+ * that changed. This runs from uloop, so no UBUS request sees a mix of the
+ * two configurations. If the new configuration can't be used the old one is
+ * kept.
+ */
+static bool reload_configuration(gpio_reload_st * const reload)
+{
+    bool success;
+    configuration_st const * const next = configuration_load(configuration_filename);
+
+    if (next == NULL)
+    {
+        DPRINTF("Unable to load configuration file: %s\n", configuration_filename);
+        success = false;
+        goto done;
+    }
+
+    if (gpio_backend_lookup(configuration_backend_name(next))
+        != gpio_backend_lookup(configuration_backend_name(configuration)))
+    {
+        DPRINTF("The GPIO backend can't be changed without a restart\n");
+        configuration_free(next);
+        success = false;
+        goto done;
+    }
+
+    monitors_stop(configuration, true);
+    io_stop(true);
+
+    if (gpio_backend_reload(configuration, next, reload))
+    {
+        if (!gpio_stats_reconfigure(next))
+        {
+            DPRINTF("Unable to make room for the statistics of new pins\n");
+        }
+        configuration_free(configuration);
+        configuration = next;
+        success = true;
+    }
+    else
+    {
+        DPRINTF("Unable to apply the new configuration, keeping the old one\n");
+        configuration_free(next);
+        success = false;
+    }
+
+    if (!io_start(configuration, true))
+    {
+        DPRINTF("failed to register io types\n");
+    }
+    monitors_start(configuration, true);
+
+done:
+    return success;
+}
+
+static struct uloop_fd reload_signal_fd = { .fd = -1 };
+
+static void reload_signal_event(struct uloop_fd * const uloop_fd, unsigned int const events)
+{
+    struct signalfd_siginfo siginfo;
+    bool reload_requested = false;
+
+    /* Any number of queued SIGHUPs result in one reload. */
+    while (read(uloop_fd->fd, &siginfo, sizeof siginfo) == sizeof siginfo)
+    {
+        reload_requested = true;
+    }
+
+    if (reload_requested)
+    {
+        gpio_reload_st reload;
+
+        if (reload_configuration(&reload))
+        {
+            DPRINTF("Reloaded configuration: %zu pins added, %zu removed, %zu changed, %zu kept\n",
+                    reload.num_added, reload.num_removed, reload.num_changed, reload.num_kept);
+        }
+    }
+}
+
+/*
+ * SIGHUP is blocked and read from a signalfd, so the reload runs from uloop.
+ * This must be called before any thread is started, so that every thread
+ * inherits the blocked signal.
+ */
+static bool reload_signal_start(void)
+{
+    bool success;
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    reload_signal_fd.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (reload_signal_fd.fd < 0)
+    {
+        success = false;
+        goto done;
+    }
+
+    reload_signal_fd.cb = reload_signal_event;
+    success = uloop_fd_add(&reload_signal_fd, ULOOP_READ) == 0;
+
+done:
+    return success;
+}
+
+static void reload_signal_stop(void)
+{
+    if (reload_signal_fd.registered)
+    {
+        uloop_fd_delete(&reload_signal_fd);
+    }
+    if (reload_signal_fd.fd >= 0)
+    {
+        close(reload_signal_fd.fd);
+        reload_signal_fd.fd = -1;
+    }
+}
+
 int main(int argc, char * * argv)
 {
     bool daemonise = false;
@@ -160,7 +588,6 @@ int main(int argc, char * * argv)
     unsigned int args_remaining;
     int option;
     char const * path = NULL;
-    char const * configuration_filename = NULL;
 
     while ((option = getopt(argc, argv, "c:s:?d")) != -1)
     {
@@ -216,8 +643,30 @@ int main(int argc, char * * argv)
         goto done;
     }
 
+    if (!gpio_backend_select(configuration_backend_name(configuration)))
+    {
+        DPRINTF("Unknown GPIO backend: %s\n", configuration_backend_name(configuration));
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
+    uloop_init();
+
+    if (!reload_signal_start())
+    {
+        DPRINTF("Unable to handle SIGHUP, reloading will only be possible over UBUS\n");
+    }
+
+    gpio_stats_start(configuration);
     enable_gpio_pins(configuration);
 
+    if (!io_start(configuration, false))
+    {
+        DPRINTF("\r\nfailed to register io types\n");
+        exit_code = EXIT_FAILURE;
+        goto done;
+    }
+
     struct ubus_context * const ubus_ctx = gpio_ubus_initialise(path);
 
     if (ubus_ctx == NULL)
@@ -234,15 +683,27 @@ int main(int argc, char * * argv)
             &ubus_gpio_server_handlers,
             NULL);
 
+    ubus_ext_initialise(ubus_ctx, reload_configuration);
+
+    monitors_start(configuration, false);
+
     uloop_run();
 
+    monitors_stop(configuration, false);
+    reload_signal_stop();
+
+    ubus_ext_done();
+
     ubus_gpio_server_done(ubus_server_ctx);
 
     uloop_done(); 
 
     gpio_ubus_done();
 
+    io_stop(false);
+
     disable_gpio_pins(configuration);
+    gpio_stats_stop();
 
     configuration_free(configuration);
 
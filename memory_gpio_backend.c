@@ -0,0 +1,335 @@
+#include "memory_gpio_backend.h"
+#include "monotonic.h"
+#include "pin_bitmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct memory_gpio_st
+{
+    bool exported;
+    bool outgoing;
+    bool state;
+    gpio_edge_t edge;
+    gpio_edge_callback_fn callback;
+    void * callback_ctx;
+} memory_gpio_st;
+
+typedef struct memory_gpio_context_st
+{
+    size_t num_gpio;
+    memory_gpio_st * gpios;
+} memory_gpio_context_st;
+
+static memory_gpio_context_st memory_gpio_context;
+
+static memory_gpio_st *
+memory_gpio_lookup(size_t const gpio_number)
+{
+    memory_gpio_st * gpio;
+
+    if (gpio_number >= memory_gpio_context.num_gpio)
+    {
+        gpio = NULL;
+        goto done;
+    }
+
+    gpio = &memory_gpio_context.gpios[gpio_number];
+
+done:
+    return gpio;
+}
+
+static bool
+memory_open(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_gpio = configuration_highest_gpio_number(configuration) + 1;
+
+    memory_gpio_context.gpios = calloc(num_gpio, sizeof *memory_gpio_context.gpios);
+    if (memory_gpio_context.gpios == NULL)
+    {
+        success = false;
+        goto done;
+    }
+    memory_gpio_context.num_gpio = num_gpio;
+
+    success = true;
+
+done:
+    return success;
+}
+
+/* Pins in both configurations keep their state. */
+static bool
+memory_reconfigure(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_gpio = configuration_highest_gpio_number(configuration) + 1;
+
+    if (num_gpio <= memory_gpio_context.num_gpio)
+    {
+        success = true;
+        goto done;
+    }
+
+    memory_gpio_st * const gpios =
+        realloc(memory_gpio_context.gpios, num_gpio * sizeof *gpios);
+
+    if (gpios == NULL)
+    {
+        success = false;
+        goto done;
+    }
+    memset(
+        &gpios[memory_gpio_context.num_gpio],
+        0,
+        (num_gpio - memory_gpio_context.num_gpio) * sizeof *gpios);
+    memory_gpio_context.gpios = gpios;
+    memory_gpio_context.num_gpio = num_gpio;
+
+    success = true;
+
+done:
+    return success;
+}
+
+static void
+memory_close(void)
+{
+    free(memory_gpio_context.gpios);
+    memory_gpio_context.gpios = NULL;
+    memory_gpio_context.num_gpio = 0;
+}
+
+static int
+memory_export_pin(size_t const gpio_number)
+{
+    int result;
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL)
+    {
+        result = -1;
+        goto done;
+    }
+
+    gpio->exported = true;
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+memory_unexport_pin(size_t const gpio_number)
+{
+    int result;
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL)
+    {
+        result = -1;
+        goto done;
+    }
+
+    gpio->exported = false;
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+memory_set_direction(size_t const gpio_number, gpio_direction_t const direction)
+{
+    int result;
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL || !gpio->exported)
+    {
+        result = -1;
+        goto done;
+    }
+
+    gpio->outgoing = direction != gpio_direction_in;
+    if (gpio->outgoing)
+    {
+        gpio->state = direction == gpio_direction_out_high;
+    }
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+memory_read(size_t const gpio_number, bool * const state)
+{
+    int result;
+    memory_gpio_st const * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL || !gpio->exported)
+    {
+        result = -1;
+        goto done;
+    }
+
+    *state = gpio->state;
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+memory_write(size_t const gpio_number, bool const high)
+{
+    int result;
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL || !gpio->exported || !gpio->outgoing)
+    {
+        result = -1;
+        goto done;
+    }
+
+    gpio->state = high;
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+memory_read_bulk(size_t const * const gpio_numbers, size_t const count, uint64_t * const state_words)
+{
+    int result;
+
+    for (size_t index = 0; index < count; index++)
+    {
+        bool state;
+
+        if (memory_read(gpio_numbers[index], &state) < 0)
+        {
+            result = -1;
+            goto done;
+        }
+        pin_bitmap_assign(state_words, index, state);
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static int
+memory_write_bulk(size_t const * const gpio_numbers, uint64_t const * const state_words, size_t const count)
+{
+    int result = 0;
+
+    for (size_t index = 0; index < count; index++)
+    {
+        if (memory_write(gpio_numbers[index], pin_bitmap_get(state_words, index)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+static int
+memory_watch_edge(
+    size_t const gpio_number,
+    gpio_edge_t const edge,
+    gpio_edge_callback_fn const callback,
+    void * const callback_ctx)
+{
+    int result;
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL || !gpio->exported || gpio->outgoing || edge == gpio_edge_none)
+    {
+        result = -1;
+        goto done;
+    }
+
+    gpio->edge = edge;
+    gpio->callback = callback;
+    gpio->callback_ctx = callback_ctx;
+    result = 0;
+
+done:
+    return result;
+}
+
+static void
+memory_unwatch_edge(size_t const gpio_number)
+{
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL)
+    {
+        goto done;
+    }
+
+    gpio->edge = gpio_edge_none;
+    gpio->callback = NULL;
+    gpio->callback_ctx = NULL;
+
+done:
+    return;
+}
+
+int
+memory_gpio_backend_set_input(size_t const gpio_number, bool const state)
+{
+    int result;
+    memory_gpio_st * const gpio = memory_gpio_lookup(gpio_number);
+
+    if (gpio == NULL || !gpio->exported || gpio->outgoing)
+    {
+        result = -1;
+        goto done;
+    }
+
+    bool const changed = gpio->state != state;
+
+    gpio->state = state;
+    result = 0;
+
+    if (!changed || gpio->callback == NULL)
+    {
+        goto done;
+    }
+
+    if (gpio->edge == gpio_edge_both
+        || (gpio->edge == gpio_edge_rising && state)
+        || (gpio->edge == gpio_edge_falling && !state))
+    {
+        gpio->callback(gpio->callback_ctx, gpio_number, state, monotonic_time_ns());
+    }
+
+done:
+    return result;
+}
+
+gpio_backend_st const memory_gpio_backend =
+{
+    .name = "memory",
+    .open = memory_open,
+    .close = memory_close,
+    .export_pin = memory_export_pin,
+    .unexport_pin = memory_unexport_pin,
+    .set_direction = memory_set_direction,
+    .read = memory_read,
+    .write = memory_write,
+    .read_bulk = memory_read_bulk,
+    .write_bulk = memory_write_bulk,
+    .watch_edge = memory_watch_edge,
+    .unwatch_edge = memory_unwatch_edge,
+    .reconfigure = memory_reconfigure
+};
@@ -0,0 +1,20 @@
+#ifndef __MEMORY_GPIO_BACKEND_H__
+#define __MEMORY_GPIO_BACKEND_H__
+
+#include "gpio_backend.h"
+
+/*
+ * A GPIO backend that keeps pin state in memory. Writes to outputs are
+ * remembered and read back. Useful for load testing without hardware.
+ */
+extern gpio_backend_st const memory_gpio_backend;
+
+/*
+ * Change the state of a simulated input. Any edge watch on the input is
+ * called immediately.
+ */
+int
+memory_gpio_backend_set_input(size_t const gpio_number, bool const state);
+
+
+#endif /* __MEMORY_GPIO_BACKEND_H__ */
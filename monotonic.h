@@ -0,0 +1,18 @@
+#ifndef __MONOTONIC_H__
+#define __MONOTONIC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t
+monotonic_time_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+#endif /* __MONOTONIC_H__ */
@@ -0,0 +1,289 @@
+#include "output_sequence.h"
+#include "output_state.h"
+#include "pwm_output.h"
+#include "monotonic.h"
+#include "ubus.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SEQUENCE_EVENT_ID "sysfs.gpio.sequence"
+#define MAX_SEQUENCES 8
+#define NS_PER_MS 1000000ULL
+
+typedef struct output_sequence_run_st
+{
+    struct uloop_timeout timer;
+    bool active;
+    uint32_t id;
+    uint64_t start_ns;
+    size_t next_step;
+    size_t num_steps;
+    output_sequence_step_st steps[OUTPUT_SEQUENCE_MAX_STEPS];
+} output_sequence_run_st;
+
+typedef struct output_sequence_context_st
+{
+    size_t num_outputs;
+    /* The GPIO of each output instance, to tell whether a reload moved it. */
+    size_t * gpio_numbers;
+    uint32_t last_id;
+    output_sequence_run_st runs[MAX_SEQUENCES];
+} output_sequence_context_st;
+
+static output_sequence_context_st output_sequence;
+static struct blob_buf sequence_event_buf;
+
+static void
+sequence_finished(output_sequence_run_st * const run, char const * const status)
+{
+    uloop_timeout_cancel(&run->timer);
+    run->active = false;
+
+    blob_buf_init(&sequence_event_buf, 0);
+    blobmsg_add_u32(&sequence_event_buf, "id", run->id);
+    blobmsg_add_string(&sequence_event_buf, "status", status);
+    blobmsg_add_u32(&sequence_event_buf, "steps", run->next_step);
+
+    gpio_ubus_send_event(SEQUENCE_EVENT_ID, sequence_event_buf.head);
+}
+
+static void
+sequence_timer_expired(struct uloop_timeout * const timer)
+{
+    output_sequence_run_st * const run =
+        container_of(timer, output_sequence_run_st, timer);
+    uint64_t const elapsed_ms = (monotonic_time_ns() - run->start_ns) / NS_PER_MS;
+
+    /* Perform every step that is due, including any the timer was late for. */
+    while (run->next_step < run->num_steps
+           && run->steps[run->next_step].at_ms <= elapsed_ms)
+    {
+        output_sequence_step_st const * const step = &run->steps[run->next_step];
+
+        if (output_state_write_rejected(step->instance, step->state))
+        {
+            sequence_finished(run, "interlocked");
+            goto done;
+        }
+
+        pwm_output_cancel(step->instance);
+        if (!output_state_write(step->instance, step->state))
+        {
+            sequence_finished(run, "failed");
+            goto done;
+        }
+        run->next_step++;
+    }
+
+    if (run->next_step == run->num_steps)
+    {
+        sequence_finished(run, "completed");
+        goto done;
+    }
+
+    uloop_timeout_set(&run->timer, run->steps[run->next_step].at_ms - elapsed_ms);
+
+done:
+    return;
+}
+
+static size_t *
+load_gpio_numbers(configuration_st const * const configuration, size_t const num_outputs)
+{
+    size_t * gpio_numbers = calloc(num_outputs + 1, sizeof *gpio_numbers);
+
+    if (gpio_numbers == NULL)
+    {
+        goto done;
+    }
+
+    for (size_t instance = 0; instance < num_outputs; instance++)
+    {
+        if (!configuration_output_gpio_number(configuration, instance, &gpio_numbers[instance]))
+        {
+            free(gpio_numbers);
+            gpio_numbers = NULL;
+            goto done;
+        }
+    }
+
+done:
+    return gpio_numbers;
+}
+
+/* Whether the steps still to come only write outputs that are on the same GPIO. */
+static bool
+sequence_unchanged(
+    output_sequence_run_st const * const run,
+    size_t const * const gpio_numbers,
+    size_t const num_outputs)
+{
+    bool unchanged = true;
+
+    for (size_t index = run->next_step; index < run->num_steps && unchanged; index++)
+    {
+        size_t const instance = run->steps[index].instance;
+
+        unchanged = instance < num_outputs
+            && output_sequence.gpio_numbers[instance] == gpio_numbers[instance];
+    }
+
+    return unchanged;
+}
+
+bool output_sequence_start(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_outputs = configuration_num_outputs(configuration);
+
+    output_sequence.gpio_numbers = load_gpio_numbers(configuration, num_outputs);
+    if (output_sequence.gpio_numbers == NULL)
+    {
+        success = false;
+        goto done;
+    }
+    output_sequence.num_outputs = num_outputs;
+
+    for (size_t index = 0; index < MAX_SEQUENCES; index++)
+    {
+        output_sequence.runs[index].timer.cb = sequence_timer_expired;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+void output_sequence_stop(void)
+{
+    for (size_t index = 0; index < MAX_SEQUENCES; index++)
+    {
+        output_sequence_run_st * const run = &output_sequence.runs[index];
+
+        if (run->active)
+        {
+            sequence_finished(run, "cancelled");
+        }
+    }
+    blob_buf_free(&sequence_event_buf);
+
+    free(output_sequence.gpio_numbers);
+    output_sequence.gpio_numbers = NULL;
+    output_sequence.num_outputs = 0;
+}
+
+bool output_sequence_reload(configuration_st const * const configuration)
+{
+    bool success;
+    size_t const num_outputs = configuration_num_outputs(configuration);
+    size_t * const gpio_numbers = load_gpio_numbers(configuration, num_outputs);
+
+    if (gpio_numbers == NULL)
+    {
+        output_sequence_stop();
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < MAX_SEQUENCES; index++)
+    {
+        output_sequence_run_st * const run = &output_sequence.runs[index];
+
+        if (run->active && !sequence_unchanged(run, gpio_numbers, num_outputs))
+        {
+            sequence_finished(run, "cancelled");
+        }
+    }
+
+    free(output_sequence.gpio_numbers);
+    output_sequence.gpio_numbers = gpio_numbers;
+    output_sequence.num_outputs = num_outputs;
+    success = true;
+
+done:
+    return success;
+}
+
+bool output_sequence_run(
+    output_sequence_step_st const * const steps,
+    size_t const num_steps,
+    uint32_t * const id)
+{
+    bool success;
+    output_sequence_run_st * run = NULL;
+
+    if (num_steps == 0 || num_steps > OUTPUT_SEQUENCE_MAX_STEPS)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < num_steps; index++)
+    {
+        if (steps[index].instance >= output_sequence.num_outputs
+            || (index > 0 && steps[index].at_ms < steps[index - 1].at_ms))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    for (size_t index = 0; index < MAX_SEQUENCES && run == NULL; index++)
+    {
+        if (!output_sequence.runs[index].active)
+        {
+            run = &output_sequence.runs[index];
+        }
+    }
+
+    if (run == NULL)
+    {
+        DPRINTF("Too many output sequences running\n");
+        success = false;
+        goto done;
+    }
+
+    memcpy(run->steps, steps, num_steps * sizeof *steps);
+    run->num_steps = num_steps;
+    run->next_step = 0;
+    run->id = ++output_sequence.last_id;
+    run->start_ns = monotonic_time_ns();
+    run->active = true;
+
+    /* Any steps at time 0 are performed from the timer too. */
+    uloop_timeout_set(&run->timer, 0);
+
+    *id = run->id;
+    success = true;
+
+done:
+    return success;
+}
+
+bool output_sequence_cancel(uint32_t const id)
+{
+    bool success;
+
+    for (size_t index = 0; index < MAX_SEQUENCES; index++)
+    {
+        output_sequence_run_st * const run = &output_sequence.runs[index];
+
+        if (run->active && run->id == id)
+        {
+            sequence_finished(run, "cancelled");
+            success = true;
+            goto done;
+        }
+    }
+
+    success = false;
+
+done:
+    return success;
+}
@@ -0,0 +1,43 @@
+#ifndef __OUTPUT_SEQUENCE_H__
+#define __OUTPUT_SEQUENCE_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Runs timed sequences of output writes. Each step is timed from the start
+ * of its sequence, so the steps don't drift when the application is busy.
+ * A UBUS event is sent when a sequence finishes, fails or is cancelled.
+ */
+#define OUTPUT_SEQUENCE_MAX_STEPS 256
+
+typedef struct output_sequence_step_st
+{
+    /* When to write the output, relative to the start of the sequence. */
+    uint32_t at_ms;
+    size_t instance;
+    bool state;
+} output_sequence_step_st;
+
+bool output_sequence_start(configuration_st const * const configuration);
+void output_sequence_stop(void);
+
+/*
+ * Move to a reloaded configuration. A running sequence carries on if every
+ * output it has still to write is on the same GPIO, and is cancelled
+ * otherwise.
+ */
+bool output_sequence_reload(configuration_st const * const configuration);
+
+/* The steps must be in time order. */
+bool output_sequence_run(
+    output_sequence_step_st const * const steps,
+    size_t const num_steps,
+    uint32_t * const id);
+
+bool output_sequence_cancel(uint32_t const id);
+
+
+#endif /* __OUTPUT_SEQUENCE_H__ */
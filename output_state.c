@@ -0,0 +1,470 @@
+#include "output_state.h"
+#include "gpio_backend.h"
+#include "gpio_worker_pool.h"
+#include "pin_bitmap.h"
+#include "shm_state.h"
+#include "debug.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct output_state_st
+{
+    bool force_writes;
+    size_t num_outputs;
+    size_t num_words;
+    size_t * gpio_numbers;
+
+    /* Pin bitmaps, indexed by output instance. */
+    uint64_t * shadow_words;
+    /* Clear until the state of the output is known. */
+    uint64_t * valid_words;
+    /* Outputs held by an interlock rule, and the level each is held at. */
+    uint64_t * held_words;
+    uint64_t * held_state_words;
+
+    /* Scratch space for bulk writes. */
+    size_t * write_gpio_numbers;
+    uint64_t * write_words;
+    uint64_t * written_words;
+
+    output_write_counters_st counters;
+} output_state_st;
+
+static output_state_st output_state;
+
+static void
+read_back_outputs(void)
+{
+    if (gpio_backend_read_bulk(
+            output_state.gpio_numbers,
+            output_state.num_outputs,
+            output_state.shadow_words) < 0)
+    {
+        DPRINTF("Failed to read back outputs\n");
+        goto done;
+    }
+
+    for (size_t instance = 0; instance < output_state.num_outputs; instance++)
+    {
+        pin_bitmap_assign(output_state.valid_words, instance, true);
+    }
+    shm_state_outputs_changed(output_state.shadow_words, output_state.num_words);
+
+done:
+    return;
+}
+
+bool output_state_start(configuration_st const * const configuration)
+{
+    bool success;
+
+    output_state.force_writes = configuration_force_writes(configuration);
+    output_state.num_outputs = configuration_num_outputs(configuration);
+    output_state.num_words = pin_bitmap_num_words(output_state.num_outputs);
+    output_state.gpio_numbers =
+        calloc(output_state.num_outputs, sizeof *output_state.gpio_numbers);
+    output_state.shadow_words =
+        calloc(output_state.num_words, sizeof *output_state.shadow_words);
+    output_state.valid_words =
+        calloc(output_state.num_words, sizeof *output_state.valid_words);
+    output_state.held_words =
+        calloc(output_state.num_words, sizeof *output_state.held_words);
+    output_state.held_state_words =
+        calloc(output_state.num_words, sizeof *output_state.held_state_words);
+    output_state.write_gpio_numbers =
+        calloc(output_state.num_outputs, sizeof *output_state.write_gpio_numbers);
+    output_state.write_words =
+        calloc(output_state.num_words, sizeof *output_state.write_words);
+    output_state.written_words =
+        calloc(output_state.num_words, sizeof *output_state.written_words);
+    if (output_state.gpio_numbers == NULL
+        || output_state.shadow_words == NULL
+        || output_state.valid_words == NULL
+        || output_state.held_words == NULL
+        || output_state.held_state_words == NULL
+        || output_state.write_gpio_numbers == NULL
+        || output_state.write_words == NULL
+        || output_state.written_words == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t index = 0; index < output_state.num_outputs; index++)
+    {
+        if (!configuration_output_gpio_number(
+                configuration, index, &output_state.gpio_numbers[index]))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    /*
+     * Reading back would configure any outputs deferred by lazy export, so
+     * their state is left unknown until they are first written instead.
+     */
+    if (!configuration_lazy_export(configuration))
+    {
+        read_back_outputs();
+    }
+
+    success = true;
+
+done:
+    if (!success)
+    {
+        output_state_stop();
+    }
+
+    return success;
+}
+
+void output_state_stop(void)
+{
+    free(output_state.gpio_numbers);
+    output_state.gpio_numbers = NULL;
+    free(output_state.shadow_words);
+    output_state.shadow_words = NULL;
+    free(output_state.valid_words);
+    output_state.valid_words = NULL;
+    free(output_state.held_words);
+    output_state.held_words = NULL;
+    free(output_state.held_state_words);
+    output_state.held_state_words = NULL;
+    free(output_state.write_gpio_numbers);
+    output_state.write_gpio_numbers = NULL;
+    free(output_state.write_words);
+    output_state.write_words = NULL;
+    free(output_state.written_words);
+    output_state.written_words = NULL;
+    output_state.num_outputs = 0;
+    output_state.num_words = 0;
+}
+
+/*
+ * A write run on a worker thread has finished. The shadow already holds the
+ * state written, unless a later write has changed it since.
+ */
+static void
+queued_write_done(void * const ctx, int const result)
+{
+    uintptr_t const queued = (uintptr_t)ctx;
+    size_t const instance = queued >> 1;
+    bool const state = queued & 1;
+
+    if (result < 0
+        && instance < output_state.num_outputs
+        && pin_bitmap_get(output_state.shadow_words, instance) == state)
+    {
+        DPRINTF("Failed to write output %zu\n", instance);
+        pin_bitmap_assign(output_state.valid_words, instance, false);
+    }
+}
+
+bool output_state_write(size_t const instance, bool const state)
+{
+    bool success;
+
+    if (instance >= output_state.num_outputs)
+    {
+        success = false;
+        goto done;
+    }
+
+    if (output_state_write_rejected(instance, state))
+    {
+        success = false;
+        goto done;
+    }
+
+    if (!output_state.force_writes
+        && pin_bitmap_get(output_state.valid_words, instance)
+        && pin_bitmap_get(output_state.shadow_words, instance) == state)
+    {
+        output_state.counters.suppressed++;
+        success = true;
+        goto done;
+    }
+
+    output_state.counters.issued++;
+    if (gpio_worker_pool_is_running())
+    {
+        success = gpio_worker_pool_write(
+            output_state.gpio_numbers[instance],
+            state,
+            queued_write_done,
+            (void *)(((uintptr_t)instance << 1) | state));
+    }
+    else
+    {
+        success = gpio_backend_write(output_state.gpio_numbers[instance], state) == 0;
+    }
+
+    /* After a failed write the state of the output is unknown. */
+    pin_bitmap_assign(output_state.valid_words, instance, success);
+    pin_bitmap_assign(output_state.shadow_words, instance, state);
+    shm_state_outputs_changed(output_state.shadow_words, output_state.num_words);
+
+done:
+    return success;
+}
+
+/* The outputs written by a bulk write queued on the worker pool. */
+typedef struct queued_write_bulk_st
+{
+    size_t num_words;
+    uint64_t written_words[];
+} queued_write_bulk_st;
+
+static void
+queued_write_bulk_done(void * const ctx, int const result)
+{
+    queued_write_bulk_st * const queued = ctx;
+
+    if (result < 0)
+    {
+        DPRINTF("Failed to write outputs\n");
+
+        size_t const num_words =
+            queued->num_words < output_state.num_words ? queued->num_words : output_state.num_words;
+
+        for (size_t word = 0; word < num_words; word++)
+        {
+            output_state.valid_words[word] &= ~queued->written_words[word];
+        }
+    }
+    free(queued);
+}
+
+static bool
+queue_write_bulk(size_t const num_writes, size_t const num_words)
+{
+    bool success;
+    queued_write_bulk_st * const queued =
+        malloc(sizeof *queued + num_words * sizeof *queued->written_words);
+
+    if (queued == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    queued->num_words = num_words;
+    memcpy(queued->written_words,
+           output_state.written_words,
+           num_words * sizeof *queued->written_words);
+
+    success = gpio_worker_pool_write_bulk(
+        output_state.write_gpio_numbers,
+        output_state.write_words,
+        num_writes,
+        queued_write_bulk_done,
+        queued);
+    if (!success)
+    {
+        free(queued);
+    }
+
+done:
+    return success;
+}
+
+/* The outputs in a word of a mask write that an interlock rule holds at the other level. */
+static uint64_t
+rejected_outputs(size_t const word, uint64_t const value_word, uint64_t const mask_word)
+{
+    return mask_word
+        & output_state.held_words[word]
+        & (output_state.held_state_words[word] ^ value_word);
+}
+
+/* The bits of a bitmap word that correspond to configured outputs. */
+static uint64_t
+configured_outputs(size_t const word)
+{
+    uint64_t configured;
+    size_t const first_instance = word * PIN_BITMAP_WORD_BITS;
+
+    if (first_instance >= output_state.num_outputs)
+    {
+        configured = 0;
+    }
+    else if (output_state.num_outputs - first_instance >= PIN_BITMAP_WORD_BITS)
+    {
+        configured = UINT64_MAX;
+    }
+    else
+    {
+        configured = (UINT64_C(1) << (output_state.num_outputs - first_instance)) - 1;
+    }
+
+    return configured;
+}
+
+bool output_state_write_mask(
+    uint64_t const * const value_words,
+    uint64_t const * const mask_words,
+    size_t const num_words)
+{
+    bool success;
+    size_t num_writes = 0;
+    size_t num_requested = 0;
+
+    /* Reject any bits beyond the last configured output. */
+    for (size_t word = 0; word < num_words; word++)
+    {
+        if ((mask_words[word] & ~configured_outputs(word)) != 0)
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    size_t const num_words_used =
+        num_words < output_state.num_words ? num_words : output_state.num_words;
+
+    /* Write none of the outputs if any is held at the other level. */
+    if (output_state_write_mask_rejected(value_words, mask_words, num_words_used))
+    {
+        success = false;
+        goto done;
+    }
+
+    pin_bitmap_clear(output_state.write_words, output_state.num_words);
+
+    for (size_t word = 0; word < num_words_used; word++)
+    {
+        uint64_t to_write = mask_words[word];
+
+        num_requested += __builtin_popcountll(to_write);
+        if (!output_state.force_writes)
+        {
+            /* Only write outputs whose state is unknown or would change. */
+            to_write &= ~output_state.valid_words[word]
+                | (output_state.shadow_words[word] ^ value_words[word]);
+        }
+        output_state.written_words[word] = to_write;
+
+        while (to_write != 0)
+        {
+            unsigned int const bit = pin_bitmap_next_bit(to_write);
+            size_t const instance = word * PIN_BITMAP_WORD_BITS + bit;
+
+            to_write &= to_write - 1;
+            output_state.write_gpio_numbers[num_writes] = output_state.gpio_numbers[instance];
+            pin_bitmap_assign(output_state.write_words, num_writes, (value_words[word] >> bit) & 1);
+            num_writes++;
+        }
+    }
+
+    output_state.counters.suppressed += num_requested - num_writes;
+
+    if (num_writes == 0)
+    {
+        success = true;
+        goto done;
+    }
+
+    output_state.counters.issued += num_writes;
+    if (gpio_worker_pool_is_running())
+    {
+        success = queue_write_bulk(num_writes, num_words_used);
+    }
+    else
+    {
+        success = gpio_backend_write_bulk(
+            output_state.write_gpio_numbers, output_state.write_words, num_writes) == 0;
+    }
+
+    for (size_t word = 0; word < num_words_used; word++)
+    {
+        uint64_t const written = output_state.written_words[word];
+
+        output_state.shadow_words[word] =
+            (output_state.shadow_words[word] & ~written) | (value_words[word] & written);
+        if (success)
+        {
+            output_state.valid_words[word] |= written;
+        }
+        else
+        {
+            output_state.valid_words[word] &= ~written;
+        }
+    }
+    shm_state_outputs_changed(output_state.shadow_words, output_state.num_words);
+
+done:
+    return success;
+}
+
+void output_state_hold(size_t const instance, bool const state)
+{
+    if (instance < output_state.num_outputs)
+    {
+        pin_bitmap_assign(output_state.held_words, instance, true);
+        pin_bitmap_assign(output_state.held_state_words, instance, state);
+    }
+}
+
+void output_state_release(size_t const instance)
+{
+    if (instance < output_state.num_outputs)
+    {
+        pin_bitmap_assign(output_state.held_words, instance, false);
+    }
+}
+
+bool output_state_write_rejected(size_t const instance, bool const state)
+{
+    bool const rejected = instance < output_state.num_outputs
+        && pin_bitmap_get(output_state.held_words, instance)
+        && pin_bitmap_get(output_state.held_state_words, instance) != state;
+
+    if (rejected)
+    {
+        output_state.counters.rejected++;
+    }
+
+    return rejected;
+}
+
+bool output_state_write_mask_rejected(
+    uint64_t const * const value_words,
+    uint64_t const * const mask_words,
+    size_t const num_words)
+{
+    uint64_t num_rejected = 0;
+    size_t const num_words_used =
+        num_words < output_state.num_words ? num_words : output_state.num_words;
+
+    for (size_t word = 0; word < num_words_used; word++)
+    {
+        num_rejected +=
+            __builtin_popcountll(rejected_outputs(word, value_words[word], mask_words[word]));
+    }
+    output_state.counters.rejected += num_rejected;
+
+    return num_rejected > 0;
+}
+
+size_t output_state_num_outputs(void)
+{
+    return output_state.num_outputs;
+}
+
+size_t output_state_num_words(void)
+{
+    return output_state.num_words;
+}
+
+void output_state_write_counters(output_write_counters_st * const counters)
+{
+    *counters = output_state.counters;
+}
+
+void output_state_reset_write_counters(void)
+{
+    output_state.counters = (output_write_counters_st){ 0 };
+}
@@ -0,0 +1,70 @@
+#ifndef __OUTPUT_STATE_H__
+#define __OUTPUT_STATE_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Keeps a shadow copy of the last state written to each output. Writes that
+ * wouldn't change an output are skipped unless the configuration forces
+ * every write through to the hardware.
+ */
+bool output_state_start(configuration_st const * const configuration);
+void output_state_stop(void);
+
+/*
+ * With the worker pool running, success means the write was queued. If it
+ * later fails the output's state becomes unknown again.
+ */
+bool output_state_write(size_t const instance, bool const state);
+
+/*
+ * Set each output whose bit is set in the mask bitmap to the corresponding
+ * bit in the value bitmap, using a single backend operation.
+ * num_words may be fewer than output_state_num_words().
+ */
+bool output_state_write_mask(
+    uint64_t const * const value_words,
+    uint64_t const * const mask_words,
+    size_t const num_words);
+
+/*
+ * Hold an output at a level while an interlock rule is active. Writes of the
+ * other level, on their own or in a mask, are rejected until it is released.
+ */
+void output_state_hold(size_t const instance, bool const state);
+void output_state_release(size_t const instance);
+
+/*
+ * Whether a write would be rejected by a hold. Each rejected output is
+ * counted in the write counters here, so a request rejected before it is
+ * written, over UBUS or the fast path, is counted the same as one rejected
+ * by output_state_write().
+ */
+bool output_state_write_rejected(size_t const instance, bool const state);
+
+bool output_state_write_mask_rejected(
+    uint64_t const * const value_words,
+    uint64_t const * const mask_words,
+    size_t const num_words);
+
+size_t output_state_num_outputs(void);
+
+size_t output_state_num_words(void);
+
+typedef struct output_write_counters_st
+{
+    uint64_t issued;
+    uint64_t suppressed;
+    /* Writes rejected because an interlock rule holds the output. */
+    uint64_t rejected;
+} output_write_counters_st;
+
+void output_state_write_counters(output_write_counters_st * const counters);
+
+void output_state_reset_write_counters(void);
+
+
+#endif /* __OUTPUT_STATE_H__ */
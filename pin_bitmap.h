@@ -0,0 +1,104 @@
+#ifndef __PIN_BITMAP_H__
+#define __PIN_BITMAP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Pin state held as an array of 64-bit words. Bit (N % 64) of word (N / 64)
+ * holds the state of pin N, where N is the configuration instance.
+ */
+#define PIN_BITMAP_WORD_BITS 64
+
+typedef void (*pin_bitmap_change_fn)(void * ctx, size_t pin, bool state);
+
+static inline size_t
+pin_bitmap_num_words(size_t const num_pins)
+{
+    return (num_pins + PIN_BITMAP_WORD_BITS - 1) / PIN_BITMAP_WORD_BITS;
+}
+
+static inline uint64_t
+pin_bitmap_bit(size_t const pin)
+{
+    return UINT64_C(1) << (pin % PIN_BITMAP_WORD_BITS);
+}
+
+static inline bool
+pin_bitmap_get(uint64_t const * const words, size_t const pin)
+{
+    return (words[pin / PIN_BITMAP_WORD_BITS] & pin_bitmap_bit(pin)) != 0;
+}
+
+static inline void
+pin_bitmap_assign(uint64_t * const words, size_t const pin, bool const state)
+{
+    if (state)
+    {
+        words[pin / PIN_BITMAP_WORD_BITS] |= pin_bitmap_bit(pin);
+    }
+    else
+    {
+        words[pin / PIN_BITMAP_WORD_BITS] &= ~pin_bitmap_bit(pin);
+    }
+}
+
+static inline void
+pin_bitmap_clear(uint64_t * const words, size_t const num_words)
+{
+    memset(words, 0, num_words * sizeof *words);
+}
+
+/* The lowest set bit in 'word', or PIN_BITMAP_WORD_BITS if none are set. */
+static inline unsigned int
+pin_bitmap_next_bit(uint64_t const word)
+{
+    return word == 0 ? PIN_BITMAP_WORD_BITS : (unsigned int)__builtin_ctzll(word);
+}
+
+/*
+ * Call 'changed' for every pin selected by 'mask' whose state differs
+ * between 'previous' and 'current'. 'mask' may be NULL to select all pins.
+ * Returns the number of changed pins.
+ */
+static inline size_t
+pin_bitmap_for_each_change(
+    uint64_t const * const previous,
+    uint64_t const * const current,
+    uint64_t const * const mask,
+    size_t const num_words,
+    pin_bitmap_change_fn const changed,
+    void * const ctx)
+{
+    size_t num_changed = 0;
+
+    for (size_t word = 0; word < num_words; word++)
+    {
+        uint64_t differences = previous[word] ^ current[word];
+
+        if (mask != NULL)
+        {
+            differences &= mask[word];
+        }
+
+        while (differences != 0)
+        {
+            unsigned int const bit = pin_bitmap_next_bit(differences);
+            size_t const pin = word * PIN_BITMAP_WORD_BITS + bit;
+
+            differences &= differences - 1;
+            num_changed++;
+            if (changed != NULL)
+            {
+                changed(ctx, pin, (current[word] >> bit) & 1);
+            }
+        }
+    }
+
+    return num_changed;
+}
+
+
+#endif /* __PIN_BITMAP_H__ */
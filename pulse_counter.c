@@ -0,0 +1,234 @@
+#include "pulse_counter.h"
+#include "gpio_backend.h"
+#include "monotonic.h"
+#include "debug.h"
+
+#include <stdlib.h>
+
+#define NS_PER_SECOND 1e9
+
+typedef struct pulse_counter_input_st
+{
+    size_t gpio_number;
+    bool watched;
+    uint64_t count;
+    uint64_t last_edge_ns;
+    uint64_t interval_ns;
+} pulse_counter_input_st;
+
+typedef struct pulse_counter_st
+{
+    size_t num_counters;
+    pulse_counter_input_st * counters;
+} pulse_counter_st;
+
+static pulse_counter_st pulse_counter;
+
+static void
+counter_edge(
+    void * const callback_ctx,
+    size_t const gpio_number,
+    bool const state,
+    uint64_t const timestamp_ns)
+{
+    size_t const instance = (uintptr_t)callback_ctx;
+    pulse_counter_input_st * const counter = &pulse_counter.counters[instance];
+
+    counter->count++;
+    if (counter->last_edge_ns != 0 && timestamp_ns > counter->last_edge_ns)
+    {
+        counter->interval_ns = timestamp_ns - counter->last_edge_ns;
+    }
+    counter->last_edge_ns = timestamp_ns;
+}
+
+/* The counter that was on a GPIO before a reload, if there was one. */
+static pulse_counter_input_st const *
+previous_counter(pulse_counter_st const * const previous, size_t const gpio_number)
+{
+    pulse_counter_input_st const * counter = NULL;
+
+    for (size_t instance = 0; instance < previous->num_counters; instance++)
+    {
+        if (previous->counters[instance].gpio_number == gpio_number)
+        {
+            counter = &previous->counters[instance];
+            break;
+        }
+    }
+
+    return counter;
+}
+
+static bool
+counters_start(
+    configuration_st const * const configuration,
+    pulse_counter_st const * const previous)
+{
+    bool success;
+
+    pulse_counter.num_counters = configuration_num_counters(configuration);
+    if (pulse_counter.num_counters == 0)
+    {
+        success = true;
+        goto done;
+    }
+
+    pulse_counter.counters =
+        calloc(pulse_counter.num_counters, sizeof *pulse_counter.counters);
+    if (pulse_counter.counters == NULL)
+    {
+        pulse_counter.num_counters = 0;
+        success = false;
+        goto done;
+    }
+
+    success = true;
+
+    for (size_t instance = 0; instance < pulse_counter.num_counters; instance++)
+    {
+        pulse_counter_input_st * const counter = &pulse_counter.counters[instance];
+
+        if (!configuration_counter_gpio_number(configuration, instance, &counter->gpio_number))
+        {
+            success = false;
+            continue;
+        }
+
+        pulse_counter_input_st const * const kept =
+            previous_counter(previous, counter->gpio_number);
+
+        if (kept != NULL)
+        {
+            counter->count = kept->count;
+            counter->last_edge_ns = kept->last_edge_ns;
+            counter->interval_ns = kept->interval_ns;
+        }
+
+        if (gpio_backend_watch_edge(
+                counter->gpio_number,
+                configuration_counter_edge(configuration, instance),
+                counter_edge,
+                (void *)(uintptr_t)instance) < 0)
+        {
+            DPRINTF("Unable to watch edges on counter: %zu\n", instance);
+            success = false;
+            continue;
+        }
+        counter->watched = true;
+    }
+
+done:
+    return success;
+}
+
+bool pulse_counter_start(configuration_st const * const configuration)
+{
+    pulse_counter_st const previous = { 0 };
+
+    return counters_start(configuration, &previous);
+}
+
+void pulse_counter_suspend(void)
+{
+    for (size_t instance = 0; instance < pulse_counter.num_counters; instance++)
+    {
+        pulse_counter_input_st * const counter = &pulse_counter.counters[instance];
+
+        if (counter->watched)
+        {
+            gpio_backend_unwatch_edge(counter->gpio_number);
+            counter->watched = false;
+        }
+    }
+}
+
+bool pulse_counter_resume(configuration_st const * const configuration)
+{
+    pulse_counter_st const previous = pulse_counter;
+
+    pulse_counter = (pulse_counter_st){ 0 };
+
+    bool const success = counters_start(configuration, &previous);
+
+    free(previous.counters);
+
+    return success;
+}
+
+void pulse_counter_stop(void)
+{
+    pulse_counter_suspend();
+
+    free(pulse_counter.counters);
+    pulse_counter.counters = NULL;
+    pulse_counter.num_counters = 0;
+}
+
+bool pulse_counter_read(size_t const instance, uint64_t * const count)
+{
+    bool success;
+
+    if (instance >= pulse_counter.num_counters)
+    {
+        success = false;
+        goto done;
+    }
+
+    *count = pulse_counter.counters[instance].count;
+    success = true;
+
+done:
+    return success;
+}
+
+bool pulse_counter_rate(size_t const instance, double * const rate)
+{
+    bool success;
+
+    if (instance >= pulse_counter.num_counters)
+    {
+        success = false;
+        goto done;
+    }
+
+    pulse_counter_input_st const * const counter = &pulse_counter.counters[instance];
+
+    if (counter->interval_ns == 0)
+    {
+        *rate = 0.0;
+        success = true;
+        goto done;
+    }
+
+    uint64_t const since_last_ns = monotonic_time_ns() - counter->last_edge_ns;
+    uint64_t const interval_ns =
+        since_last_ns > counter->interval_ns ? since_last_ns : counter->interval_ns;
+
+    *rate = NS_PER_SECOND / interval_ns;
+    success = true;
+
+done:
+    return success;
+}
+
+bool pulse_counter_set(size_t const instance, uint64_t const count)
+{
+    bool success;
+
+    if (instance >= pulse_counter.num_counters)
+    {
+        success = false;
+        goto done;
+    }
+
+    pulse_counter_input_st * const counter = &pulse_counter.counters[instance];
+
+    counter->count = count;
+    counter->last_edge_ns = 0;
+    counter->interval_ns = 0;
+    success = true;
+
+done:
+    return success;
+}
@@ -0,0 +1,36 @@
+#ifndef __PULSE_COUNTER_H__
+#define __PULSE_COUNTER_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Count the edges on each configured counter input from edge events, so
+ * that clients don't need to poll the input to see each pulse.
+ */
+bool pulse_counter_start(configuration_st const * const configuration);
+void pulse_counter_stop(void);
+
+/* Stop watching edges while the pins are reloaded, keeping the counts. */
+void pulse_counter_suspend(void);
+
+/*
+ * Watch the counters of a reloaded configuration. A counter on the same GPIO
+ * as before keeps its count and rate.
+ */
+bool pulse_counter_resume(configuration_st const * const configuration);
+
+bool pulse_counter_read(size_t const instance, uint64_t * const count);
+
+/*
+ * The rate in edges per second, from the time between the last two edges.
+ * The rate decays towards 0 once the next edge is overdue.
+ */
+bool pulse_counter_rate(size_t const instance, double * const rate);
+
+bool pulse_counter_set(size_t const instance, uint64_t const count);
+
+
+#endif /* __PULSE_COUNTER_H__ */
@@ -0,0 +1,446 @@
+#include "pwm_output.h"
+#include "pwm_schedule.h"
+#include "output_state.h"
+#include "monotonic.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+
+#include <stdlib.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define NS_PER_SECOND 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+typedef enum pwm_mode_t
+{
+    pwm_mode_idle,
+    pwm_mode_pwm,
+    pwm_mode_pulse
+} pwm_mode_t;
+
+typedef struct pwm_output_st
+{
+    struct uloop_fd timer_fd;
+    size_t instance;
+    size_t gpio_number;
+    pwm_mode_t mode;
+    uint64_t deadline_ns;
+
+    unsigned int period_ms;
+    /* True while the output is driven by pwm_output_set(). */
+    bool driven;
+    double duty_percent;
+    pwm_schedule_st schedule;
+
+    bool pulse_end_state;
+} pwm_output_st;
+
+typedef struct pwm_output_context_st
+{
+    size_t num_outputs;
+    pwm_output_st * outputs;
+    pwm_output_jitter_st jitter;
+} pwm_output_context_st;
+
+static pwm_output_context_st pwm_output;
+
+static pwm_output_st *
+pwm_output_lookup(size_t const instance)
+{
+    return instance < pwm_output.num_outputs ? &pwm_output.outputs[instance] : NULL;
+}
+
+static bool
+arm_timer(pwm_output_st * const output, uint64_t const deadline_ns)
+{
+    bool success;
+    struct itimerspec const spec =
+    {
+        .it_value =
+        {
+            .tv_sec = deadline_ns / NS_PER_SECOND,
+            .tv_nsec = deadline_ns % NS_PER_SECOND
+        }
+    };
+
+    if (output->timer_fd.fd < 0)
+    {
+        output->timer_fd.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (output->timer_fd.fd < 0)
+        {
+            DPRINTF("Unable to create PWM timer: %m\n");
+            success = false;
+            goto done;
+        }
+        uloop_fd_add(&output->timer_fd, ULOOP_READ);
+    }
+
+    if (timerfd_settime(output->timer_fd.fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+    {
+        DPRINTF("Unable to set PWM timer: %m\n");
+        success = false;
+        goto done;
+    }
+
+    output->deadline_ns = deadline_ns;
+    success = true;
+
+done:
+    return success;
+}
+
+static void
+disarm_timer(pwm_output_st * const output)
+{
+    struct itimerspec const spec = { 0 };
+
+    if (output->timer_fd.fd >= 0)
+    {
+        timerfd_settime(output->timer_fd.fd, 0, &spec, NULL);
+    }
+    output->mode = pwm_mode_idle;
+}
+
+static void
+record_lateness(uint64_t const now_ns, uint64_t const deadline_ns)
+{
+    uint64_t const late_ns = now_ns > deadline_ns ? now_ns - deadline_ns : 0;
+
+    pwm_output.jitter.edges++;
+    pwm_output.jitter.total_late_ns += late_ns;
+    if (late_ns > pwm_output.jitter.max_late_ns)
+    {
+        pwm_output.jitter.max_late_ns = late_ns;
+    }
+}
+
+static void
+pwm_timer_expired(struct uloop_fd * const u, unsigned int const events)
+{
+    pwm_output_st * const output = container_of(u, pwm_output_st, timer_fd);
+    uint64_t expirations;
+
+    if (read(u->fd, &expirations, sizeof expirations) != sizeof expirations)
+    {
+        goto done;
+    }
+
+    uint64_t const now_ns = monotonic_time_ns();
+
+    record_lateness(now_ns, output->deadline_ns);
+
+    switch (output->mode)
+    {
+        case pwm_mode_pwm:
+            pwm_output.jitter.missed_cycles +=
+                pwm_schedule_advance(&output->schedule, now_ns);
+            output_state_write(output->instance, output->schedule.level);
+            if (!arm_timer(output, pwm_schedule_deadline(&output->schedule)))
+            {
+                output->mode = pwm_mode_idle;
+            }
+            break;
+        case pwm_mode_pulse:
+            output_state_write(output->instance, output->pulse_end_state);
+            output->mode = pwm_mode_idle;
+            break;
+        case pwm_mode_idle:
+            break;
+    }
+
+done:
+    return;
+}
+
+/* The output that was on a GPIO before a reload, if there was one. */
+static pwm_output_st *
+previous_output(pwm_output_context_st const * const previous, size_t const gpio_number)
+{
+    pwm_output_st * output = NULL;
+
+    for (size_t instance = 0; instance < previous->num_outputs; instance++)
+    {
+        if (previous->outputs[instance].gpio_number == gpio_number)
+        {
+            output = &previous->outputs[instance];
+            break;
+        }
+    }
+
+    return output;
+}
+
+/* Carry a running PWM or pulse, and its timer, over to a reloaded output. */
+static void
+output_move(pwm_output_st * const output, pwm_output_st * const kept)
+{
+    if (kept->timer_fd.fd >= 0)
+    {
+        uloop_fd_delete(&kept->timer_fd);
+        output->timer_fd.fd = kept->timer_fd.fd;
+        kept->timer_fd.fd = -1;
+        uloop_fd_add(&output->timer_fd, ULOOP_READ);
+    }
+
+    output->mode = kept->mode;
+    output->deadline_ns = kept->deadline_ns;
+    output->driven = kept->driven;
+    output->duty_percent = kept->duty_percent;
+    output->schedule = kept->schedule;
+    output->pulse_end_state = kept->pulse_end_state;
+    if (kept->driven)
+    {
+        output->period_ms = kept->period_ms;
+    }
+}
+
+static bool
+outputs_start(
+    configuration_st const * const configuration,
+    pwm_output_context_st const * const previous)
+{
+    bool success;
+
+    pwm_output.num_outputs = configuration_num_outputs(configuration);
+    pwm_output.outputs = calloc(pwm_output.num_outputs, sizeof *pwm_output.outputs);
+    if (pwm_output.num_outputs > 0 && pwm_output.outputs == NULL)
+    {
+        pwm_output.num_outputs = 0;
+        success = false;
+        goto done;
+    }
+
+    success = true;
+
+    for (size_t instance = 0; instance < pwm_output.num_outputs; instance++)
+    {
+        pwm_output_st * const output = &pwm_output.outputs[instance];
+
+        output->timer_fd.fd = -1;
+        output->timer_fd.cb = pwm_timer_expired;
+        output->instance = instance;
+        output->period_ms = configuration_output_pwm_period_ms(configuration, instance);
+
+        if (!configuration_output_gpio_number(configuration, instance, &output->gpio_number))
+        {
+            output->gpio_number = SIZE_MAX;
+            success = false;
+            continue;
+        }
+
+        pwm_output_st * const kept = previous_output(previous, output->gpio_number);
+
+        if (kept != NULL)
+        {
+            output_move(output, kept);
+        }
+    }
+
+done:
+    return success;
+}
+
+static void
+outputs_free(pwm_output_context_st * const context)
+{
+    for (size_t instance = 0; instance < context->num_outputs; instance++)
+    {
+        pwm_output_st * const output = &context->outputs[instance];
+
+        if (output->timer_fd.fd >= 0)
+        {
+            uloop_fd_delete(&output->timer_fd);
+            close(output->timer_fd.fd);
+        }
+    }
+
+    free(context->outputs);
+    context->outputs = NULL;
+    context->num_outputs = 0;
+}
+
+bool pwm_output_start(configuration_st const * const configuration)
+{
+    pwm_output_context_st const previous = { 0 };
+
+    return outputs_start(configuration, &previous);
+}
+
+void pwm_output_stop(void)
+{
+    outputs_free(&pwm_output);
+}
+
+bool pwm_output_reload(configuration_st const * const configuration)
+{
+    pwm_output_context_st previous = pwm_output;
+
+    pwm_output.num_outputs = 0;
+    pwm_output.outputs = NULL;
+
+    bool const success = outputs_start(configuration, &previous);
+
+    /* Outputs that were removed, or are now inputs, stop where they are. */
+    outputs_free(&previous);
+
+    return success;
+}
+
+/* The time the output is on in each period, for a duty cycle. */
+static uint64_t
+on_time_ns(uint64_t const period_ns, double const duty_percent)
+{
+    return period_ns * (duty_percent / 100.0);
+}
+
+bool pwm_output_set_rejected(
+    size_t const instance,
+    unsigned int const period_ms,
+    double const duty_percent)
+{
+    bool rejected;
+    pwm_output_st const * const output = pwm_output_lookup(instance);
+
+    if (output == NULL)
+    {
+        rejected = false;
+        goto done;
+    }
+
+    uint64_t const period_ns = (period_ms > 0 ? period_ms : output->period_ms) * NS_PER_MS;
+    uint64_t const on_ns = on_time_ns(period_ns, duty_percent);
+
+    /* A constant level may be the one the output is held at. */
+    if (on_ns == 0 || on_ns >= period_ns)
+    {
+        rejected = output_state_write_rejected(instance, on_ns > 0);
+    }
+    else
+    {
+        rejected = pwm_output_pulse_rejected(instance);
+    }
+
+done:
+    return rejected;
+}
+
+bool pwm_output_pulse_rejected(size_t const instance)
+{
+    return output_state_write_rejected(instance, true)
+        || output_state_write_rejected(instance, false);
+}
+
+bool pwm_output_set(
+    size_t const instance,
+    unsigned int const period_ms,
+    double const duty_percent)
+{
+    bool success;
+    pwm_output_st * const output = pwm_output_lookup(instance);
+
+    if (output == NULL
+        || !(duty_percent >= 0.0 && duty_percent <= 100.0)
+        || pwm_output_set_rejected(instance, period_ms, duty_percent))
+    {
+        success = false;
+        goto done;
+    }
+
+    disarm_timer(output);
+    if (period_ms > 0)
+    {
+        output->period_ms = period_ms;
+    }
+    output->duty_percent = duty_percent;
+    output->driven = true;
+
+    uint64_t const period_ns = output->period_ms * NS_PER_MS;
+    uint64_t const on_ns = on_time_ns(period_ns, duty_percent);
+
+    if (on_ns == 0 || on_ns >= period_ns)
+    {
+        success = output_state_write(instance, on_ns > 0);
+        goto done;
+    }
+
+    pwm_schedule_start(&output->schedule, monotonic_time_ns(), period_ns, on_ns);
+    if (!output_state_write(instance, output->schedule.level)
+        || !arm_timer(output, pwm_schedule_deadline(&output->schedule)))
+    {
+        success = false;
+        goto done;
+    }
+
+    output->mode = pwm_mode_pwm;
+    success = true;
+
+done:
+    return success;
+}
+
+bool pwm_output_duty(size_t const instance, double * const duty_percent)
+{
+    bool success;
+    pwm_output_st const * const output = pwm_output_lookup(instance);
+
+    if (output == NULL || !output->driven)
+    {
+        success = false;
+        goto done;
+    }
+
+    *duty_percent = output->duty_percent;
+    success = true;
+
+done:
+    return success;
+}
+
+bool pwm_output_pulse(size_t const instance, bool const state, unsigned int const width_ms)
+{
+    bool success;
+    pwm_output_st * const output = pwm_output_lookup(instance);
+
+    if (output == NULL || width_ms == 0 || pwm_output_pulse_rejected(instance))
+    {
+        success = false;
+        goto done;
+    }
+
+    disarm_timer(output);
+    output->driven = false;
+
+    uint64_t const start_ns = monotonic_time_ns();
+
+    if (!output_state_write(instance, state)
+        || !arm_timer(output, start_ns + width_ms * NS_PER_MS))
+    {
+        success = false;
+        goto done;
+    }
+
+    output->pulse_end_state = !state;
+    output->mode = pwm_mode_pulse;
+    success = true;
+
+done:
+    return success;
+}
+
+void pwm_output_cancel(size_t const instance)
+{
+    pwm_output_st * const output = pwm_output_lookup(instance);
+
+    if (output != NULL)
+    {
+        disarm_timer(output);
+        output->driven = false;
+    }
+}
+
+void pwm_output_jitter(pwm_output_jitter_st * const jitter)
+{
+    *jitter = pwm_output.jitter;
+}
@@ -0,0 +1,65 @@
+#ifndef __PWM_OUTPUT_H__
+#define __PWM_OUTPUT_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Drive outputs as PWM outputs, or with one-shot pulses, timed by the
+ * application rather than by a client writing each edge. Each output has
+ * its own timerfd, armed with absolute CLOCK_MONOTONIC deadlines.
+ * Writing to an output as a binary-output should first cancel any PWM or
+ * pulse on it.
+ */
+bool pwm_output_start(configuration_st const * const configuration);
+void pwm_output_stop(void);
+
+/*
+ * Move to a reloaded configuration without stopping the timers. An output
+ * on the same GPIO as before carries on with its PWM or pulse.
+ */
+bool pwm_output_reload(configuration_st const * const configuration);
+
+/*
+ * Drive an output on for duty_percent of each period. A period of 0 keeps
+ * the output's current period. A duty of 0 or 100 drives the output
+ * constantly off or on.
+ */
+bool pwm_output_set(
+    size_t const instance,
+    unsigned int const period_ms,
+    double const duty_percent);
+
+/*
+ * Whether an interlock rule holding the output would reject the PWM or
+ * pulse. Only a constant level matching the held one is allowed.
+ */
+bool pwm_output_set_rejected(
+    size_t const instance,
+    unsigned int const period_ms,
+    double const duty_percent);
+
+bool pwm_output_pulse_rejected(size_t const instance);
+
+bool pwm_output_duty(size_t const instance, double * const duty_percent);
+
+/* Drive an output to 'state' for width_ms, then back to !state. */
+bool pwm_output_pulse(size_t const instance, bool const state, unsigned int const width_ms);
+
+void pwm_output_cancel(size_t const instance);
+
+typedef struct pwm_output_jitter_st
+{
+    uint64_t edges;
+    uint64_t total_late_ns;
+    uint64_t max_late_ns;
+    uint64_t missed_cycles;
+} pwm_output_jitter_st;
+
+/* How late edges have been written compared to when they were due. */
+void pwm_output_jitter(pwm_output_jitter_st * const jitter);
+
+
+#endif /* __PWM_OUTPUT_H__ */
@@ -0,0 +1,71 @@
+#ifndef __PWM_SCHEDULE_H__
+#define __PWM_SCHEDULE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The timing of a PWM output. Each deadline is calculated from the start
+ * of the current cycle rather than from when the last deadline was
+ * handled, so lateness in handling one edge doesn't shift later edges.
+ * An output is on for the first on_ns of each period_ns cycle.
+ */
+typedef struct pwm_schedule_st
+{
+    uint64_t period_ns;
+    uint64_t on_ns;
+    uint64_t cycle_start_ns;
+    bool level;
+} pwm_schedule_st;
+
+static inline void
+pwm_schedule_start(
+    pwm_schedule_st * const schedule,
+    uint64_t const now_ns,
+    uint64_t const period_ns,
+    uint64_t const on_ns)
+{
+    schedule->period_ns = period_ns;
+    schedule->on_ns = on_ns;
+    schedule->cycle_start_ns = now_ns;
+    schedule->level = true;
+}
+
+/* The time at which the output next changes. */
+static inline uint64_t
+pwm_schedule_deadline(pwm_schedule_st const * const schedule)
+{
+    return schedule->cycle_start_ns
+        + (schedule->level ? schedule->on_ns : schedule->period_ns);
+}
+
+/*
+ * Move on to the next edge once the deadline has passed. Returns the
+ * number of whole cycles skipped because the deadline was handled too
+ * late to produce them.
+ */
+static inline uint64_t
+pwm_schedule_advance(pwm_schedule_st * const schedule, uint64_t const now_ns)
+{
+    uint64_t missed = 0;
+
+    if (schedule->level)
+    {
+        schedule->level = false;
+        goto done;
+    }
+
+    schedule->cycle_start_ns += schedule->period_ns;
+    if (now_ns >= schedule->cycle_start_ns + schedule->period_ns)
+    {
+        missed = (now_ns - schedule->cycle_start_ns) / schedule->period_ns;
+        schedule->cycle_start_ns += missed * schedule->period_ns;
+    }
+    schedule->level = true;
+
+done:
+    return missed;
+}
+
+
+#endif /* __PWM_SCHEDULE_H__ */
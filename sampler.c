@@ -0,0 +1,252 @@
+#include "sampler.h"
+#include "gpio_backend.h"
+#include "pin_bitmap.h"
+#include "monotonic.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#define NS_PER_SECOND 1000000000ULL
+
+typedef struct sampler_st
+{
+    struct uloop_fd timer_fd;
+    bool running;
+
+    size_t num_inputs;
+    size_t num_words;
+    size_t * gpio_numbers;
+
+    /* History of history_size samples, with num_words words per sample. */
+    size_t history_size;
+    uint64_t * timestamps_ns;
+    uint64_t * history_words;
+    uint64_t next_sequence;
+    uint64_t overruns;
+} sampler_st;
+
+static sampler_st sampler;
+
+static void
+take_sample(void)
+{
+    size_t const slot = sampler.next_sequence % sampler.history_size;
+    uint64_t * const state_words = &sampler.history_words[slot * sampler.num_words];
+
+    pin_bitmap_clear(state_words, sampler.num_words);
+    if (gpio_backend_read_bulk(sampler.gpio_numbers, sampler.num_inputs, state_words) < 0)
+    {
+        goto done;
+    }
+
+    sampler.timestamps_ns[slot] = monotonic_time_ns();
+    sampler.next_sequence++;
+
+done:
+    return;
+}
+
+static void
+sample_timer_expired(struct uloop_fd * const u, unsigned int const events)
+{
+    uint64_t expirations;
+
+    if (read(u->fd, &expirations, sizeof expirations) != sizeof expirations)
+    {
+        goto done;
+    }
+
+    /*
+     * A late timer only gets one sample. The periods missed are counted
+     * rather than filled with samples taken at the wrong time.
+     */
+    if (expirations > 1)
+    {
+        sampler.overruns += expirations - 1;
+    }
+
+    take_sample();
+
+done:
+    return;
+}
+
+static bool
+start_timer(unsigned int const sample_hz)
+{
+    bool success;
+    int const fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (fd < 0)
+    {
+        DPRINTF("Unable to create sample timer: %m\n");
+        success = false;
+        goto done;
+    }
+
+    uint64_t const period_ns = NS_PER_SECOND / sample_hz;
+    struct itimerspec const spec =
+    {
+        .it_interval =
+        {
+            .tv_sec = period_ns / NS_PER_SECOND,
+            .tv_nsec = period_ns % NS_PER_SECOND
+        },
+        .it_value =
+        {
+            .tv_sec = period_ns / NS_PER_SECOND,
+            .tv_nsec = period_ns % NS_PER_SECOND
+        }
+    };
+
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0)
+    {
+        DPRINTF("Unable to start sample timer: %m\n");
+        close(fd);
+        success = false;
+        goto done;
+    }
+
+    sampler.timer_fd.fd = fd;
+    sampler.timer_fd.cb = sample_timer_expired;
+    uloop_fd_add(&sampler.timer_fd, ULOOP_READ);
+
+    success = true;
+
+done:
+    return success;
+}
+
+bool sampler_start(configuration_st const * const configuration)
+{
+    bool success;
+    unsigned int const sample_hz = configuration_sample_hz(configuration);
+
+    if (sample_hz == 0)
+    {
+        success = true;
+        goto done;
+    }
+
+    sampler.num_inputs = configuration_num_inputs(configuration);
+    sampler.num_words = pin_bitmap_num_words(sampler.num_inputs);
+    sampler.history_size = configuration_history_size(configuration);
+    sampler.next_sequence = 0;
+    sampler.overruns = 0;
+
+    sampler.gpio_numbers = calloc(sampler.num_inputs, sizeof *sampler.gpio_numbers);
+    sampler.timestamps_ns = calloc(sampler.history_size, sizeof *sampler.timestamps_ns);
+    sampler.history_words =
+        calloc(sampler.history_size * sampler.num_words, sizeof *sampler.history_words);
+    if ((sampler.num_inputs > 0 && sampler.gpio_numbers == NULL)
+        || sampler.timestamps_ns == NULL
+        || (sampler.num_words > 0 && sampler.history_words == NULL))
+    {
+        success = false;
+        goto done;
+    }
+
+    for (size_t instance = 0; instance < sampler.num_inputs; instance++)
+    {
+        if (!configuration_input_gpio_number(
+                configuration, instance, &sampler.gpio_numbers[instance]))
+        {
+            success = false;
+            goto done;
+        }
+    }
+
+    if (!start_timer(sample_hz))
+    {
+        success = false;
+        goto done;
+    }
+
+    sampler.running = true;
+    success = true;
+
+done:
+    if (!success)
+    {
+        sampler_stop();
+    }
+
+    return success;
+}
+
+void sampler_stop(void)
+{
+    if (sampler.running)
+    {
+        uloop_fd_delete(&sampler.timer_fd);
+        close(sampler.timer_fd.fd);
+        sampler.running = false;
+    }
+
+    free(sampler.gpio_numbers);
+    sampler.gpio_numbers = NULL;
+    free(sampler.timestamps_ns);
+    sampler.timestamps_ns = NULL;
+    free(sampler.history_words);
+    sampler.history_words = NULL;
+    sampler.num_inputs = 0;
+    sampler.num_words = 0;
+    sampler.history_size = 0;
+}
+
+bool sampler_is_running(void)
+{
+    return sampler.running;
+}
+
+uint64_t sampler_oldest_sequence(void)
+{
+    return sampler.next_sequence > sampler.history_size
+        ? sampler.next_sequence - sampler.history_size
+        : 0;
+}
+
+uint64_t sampler_next_sequence(void)
+{
+    return sampler.next_sequence;
+}
+
+uint64_t sampler_overruns(void)
+{
+    return sampler.overruns;
+}
+
+size_t sampler_num_words(void)
+{
+    return sampler.num_words;
+}
+
+bool sampler_get(
+    uint64_t const sequence,
+    uint64_t * const timestamp_ns,
+    uint64_t const * * const state_words)
+{
+    bool success;
+
+    if (!sampler.running
+        || sequence < sampler_oldest_sequence()
+        || sequence >= sampler.next_sequence)
+    {
+        success = false;
+        goto done;
+    }
+
+    size_t const slot = sequence % sampler.history_size;
+
+    *timestamp_ns = sampler.timestamps_ns[slot];
+    *state_words = &sampler.history_words[slot * sampler.num_words];
+    success = true;
+
+done:
+    return success;
+}
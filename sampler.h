@@ -0,0 +1,41 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Samples every input at a fixed rate, for inputs on pins without edge
+ * support. Each sample is kept as a pin bitmap, indexed by input instance,
+ * in a fixed size history so that clients can reconstruct waveforms.
+ * Samples are numbered by an ever increasing sequence number.
+ */
+bool sampler_start(configuration_st const * const configuration);
+void sampler_stop(void);
+
+bool sampler_is_running(void);
+
+/* The sequence number of the oldest sample still in the history. */
+uint64_t sampler_oldest_sequence(void);
+
+/* The sequence number the next sample will be given. */
+uint64_t sampler_next_sequence(void);
+
+/* The number of sample periods missed because the daemon was busy. */
+uint64_t sampler_overruns(void);
+
+size_t sampler_num_words(void);
+
+/*
+ * Get a sample from the history. The state words remain valid until the
+ * next sample is taken.
+ */
+bool sampler_get(
+    uint64_t const sequence,
+    uint64_t * const timestamp_ns,
+    uint64_t const * * const state_words);
+
+
+#endif /* __SAMPLER_H__ */
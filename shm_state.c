@@ -0,0 +1,227 @@
+#include "shm_state.h"
+#include "sysfs_gpio_shm.h"
+#include "input_monitor.h"
+#include "pin_bitmap.h"
+#include "monotonic.h"
+#include "debug.h"
+
+#include <libubox/uloop.h>
+
+#include <stdlib.h>
+
+typedef struct shm_state_st
+{
+    sysfs_gpio_shm_st * shm;
+    size_t size;
+    unsigned int refresh_ms;
+    struct uloop_timeout refresh_timer;
+    uint64_t * read_words;
+} shm_state_st;
+
+static shm_state_st shm_state;
+
+static void
+update_begin(sysfs_gpio_shm_st * const shm)
+{
+    __atomic_store_n(&shm->sequence, shm->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+update_end(sysfs_gpio_shm_st * const shm, uint64_t const now_ns)
+{
+    shm->updated_ns = now_ns;
+    __atomic_store_n(&shm->sequence, shm->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void
+refresh_inputs(struct uloop_timeout * const timer)
+{
+    sysfs_gpio_shm_st * const shm = shm_state.shm;
+    size_t const num_words = sysfs_gpio_shm_num_words(shm->num_inputs);
+    uint64_t * const input_words = sysfs_gpio_shm_input_words(shm);
+    uint64_t * const changed_ns = sysfs_gpio_shm_input_changed_ns(shm);
+
+    if (!input_monitor_read_all(shm_state.read_words))
+    {
+        goto done;
+    }
+
+    uint64_t const now_ns = monotonic_time_ns();
+
+    update_begin(shm);
+    for (size_t word = 0; word < num_words; word++)
+    {
+        uint64_t const changes = input_words[word] ^ shm_state.read_words[word];
+
+        for (uint64_t changed = changes; changed != 0; changed &= changed - 1)
+        {
+            changed_ns[word * PIN_BITMAP_WORD_BITS + pin_bitmap_next_bit(changed)] = now_ns;
+        }
+        shm->input_changes += __builtin_popcountll(changes);
+        input_words[word] = shm_state.read_words[word];
+    }
+    update_end(shm, now_ns);
+
+done:
+    uloop_timeout_set(&shm_state.refresh_timer, shm_state.refresh_ms);
+}
+
+bool shm_state_start(configuration_st const * const configuration)
+{
+    bool success;
+    int fd = -1;
+
+    if (!configuration_shared_memory(configuration))
+    {
+        success = true;
+        goto done;
+    }
+
+    uint32_t const num_inputs = configuration_num_inputs(configuration);
+    uint32_t const num_outputs = configuration_num_outputs(configuration);
+
+    shm_state.size = sysfs_gpio_shm_size(num_inputs, num_outputs);
+    shm_state.read_words =
+        calloc(sysfs_gpio_shm_num_words(num_inputs) + 1, sizeof *shm_state.read_words);
+    if (shm_state.read_words == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    fd = shm_open(SYSFS_GPIO_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, shm_state.size) < 0)
+    {
+        DPRINTF("Unable to create shared memory %s: %m\n", SYSFS_GPIO_SHM_NAME);
+        success = false;
+        goto done;
+    }
+
+    void * const mapping =
+        mmap(NULL, shm_state.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        DPRINTF("Unable to map shared memory: %m\n");
+        success = false;
+        goto done;
+    }
+
+    /*
+     * Readers check the magic number, so it is written last. The page is
+     * zeroed first in case it is left over from an earlier run.
+     */
+    shm_state.shm = mapping;
+    memset(shm_state.shm, 0, shm_state.size);
+    shm_state.shm->version = SYSFS_GPIO_SHM_VERSION;
+    shm_state.shm->num_inputs = num_inputs;
+    shm_state.shm->num_outputs = num_outputs;
+    __atomic_store_n(&shm_state.shm->magic, SYSFS_GPIO_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    shm_state.refresh_ms = configuration_resync_ms(configuration);
+    shm_state.refresh_timer.cb = refresh_inputs;
+    uloop_timeout_set(&shm_state.refresh_timer, 0);
+
+    success = true;
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (!success)
+    {
+        shm_state_stop();
+    }
+
+    return success;
+}
+
+void shm_state_stop(void)
+{
+    if (shm_state.shm != NULL)
+    {
+        uloop_timeout_cancel(&shm_state.refresh_timer);
+
+        /* Readers that still have the page mapped see that it was retired. */
+        update_begin(shm_state.shm);
+        __atomic_store_n(&shm_state.shm->magic, 0, __ATOMIC_RELAXED);
+        update_end(shm_state.shm, monotonic_time_ns());
+
+        munmap(shm_state.shm, shm_state.size);
+        shm_state.shm = NULL;
+        shm_unlink(SYSFS_GPIO_SHM_NAME);
+    }
+
+    free(shm_state.read_words);
+    shm_state.read_words = NULL;
+}
+
+bool shm_state_reload(configuration_st const * const configuration)
+{
+    bool success;
+    sysfs_gpio_shm_st * const shm = shm_state.shm;
+
+    if (shm == NULL
+        || !configuration_shared_memory(configuration)
+        || shm->num_inputs != configuration_num_inputs(configuration)
+        || shm->num_outputs != configuration_num_outputs(configuration))
+    {
+        shm_state_stop();
+        success = shm_state_start(configuration);
+        goto done;
+    }
+
+    /* The instances may be on other pins now, so the inputs are read again. */
+    shm_state.refresh_ms = configuration_resync_ms(configuration);
+    uloop_timeout_set(&shm_state.refresh_timer, 0);
+    success = true;
+
+done:
+    return success;
+}
+
+void shm_state_input_changed(size_t const instance, bool const state, uint64_t const timestamp_ns)
+{
+    sysfs_gpio_shm_st * const shm = shm_state.shm;
+
+    if (shm == NULL || instance >= shm->num_inputs)
+    {
+        goto done;
+    }
+
+    update_begin(shm);
+    pin_bitmap_assign(sysfs_gpio_shm_input_words(shm), instance, state);
+    sysfs_gpio_shm_input_changed_ns(shm)[instance] = timestamp_ns;
+    shm->input_changes++;
+    update_end(shm, timestamp_ns);
+
+done:
+    return;
+}
+
+void shm_state_outputs_changed(uint64_t const * const state_words, size_t const num_words)
+{
+    sysfs_gpio_shm_st * const shm = shm_state.shm;
+
+    if (shm == NULL)
+    {
+        goto done;
+    }
+
+    uint64_t * const output_words = sysfs_gpio_shm_output_words(shm);
+    size_t const num_output_words = sysfs_gpio_shm_num_words(shm->num_outputs);
+    size_t const num_words_used = num_words < num_output_words ? num_words : num_output_words;
+
+    update_begin(shm);
+    for (size_t word = 0; word < num_words_used; word++)
+    {
+        shm->output_changes += __builtin_popcountll(output_words[word] ^ state_words[word]);
+        output_words[word] = state_words[word];
+    }
+    update_end(shm, monotonic_time_ns());
+
+done:
+    return;
+}
@@ -0,0 +1,30 @@
+#ifndef __SHM_STATE_H__
+#define __SHM_STATE_H__
+
+#include "configuration.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Publishes the state of the inputs and outputs in the shared memory page
+ * described by sysfs_gpio_shm.h, if the configuration enables it.
+ * Inputs are published as their changes are seen, and are also refreshed
+ * every resync_ms.
+ */
+bool shm_state_start(configuration_st const * const configuration);
+void shm_state_stop(void);
+
+/*
+ * Move to a reloaded configuration. The page is kept if the number of inputs
+ * and outputs is unchanged, otherwise it is retired and a new one created.
+ */
+bool shm_state_reload(configuration_st const * const configuration);
+
+void shm_state_input_changed(size_t const instance, bool const state, uint64_t const timestamp_ns);
+
+/* Publish the state of all outputs, as a pin bitmap. */
+void shm_state_outputs_changed(uint64_t const * const state_words, size_t const num_words);
+
+
+#endif /* __SHM_STATE_H__ */
@@ -0,0 +1,221 @@
+#include "storm_guard.h"
+#include "monotonic.h"
+#include "ubus.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+#include <libubox/uloop.h>
+
+#include <stdlib.h>
+
+#define STORM_EVENT_ID "sysfs.gpio.storm"
+#define RATE_WINDOW_NS 1000000000ULL
+#define NS_PER_MS 1000000ULL
+
+typedef struct storm_input_st
+{
+    struct uloop_timeout poll_timer;
+    size_t instance;
+    size_t gpio_number;
+    gpio_edge_t edge;
+
+    uint64_t window_start_ns;
+    unsigned int window_edges;
+
+    bool polling;
+    bool polled_state;
+    uint64_t last_change_ns;
+} storm_input_st;
+
+typedef struct storm_guard_st
+{
+    unsigned int max_edges;
+    unsigned int poll_ms;
+    unsigned int rearm_ms;
+    storm_guard_event_fn event;
+    gpio_edge_callback_fn edge_callback;
+
+    size_t num_inputs;
+    storm_input_st * inputs;
+} storm_guard_st;
+
+static storm_guard_st storm_guard;
+static struct blob_buf storm_event_buf;
+
+static void
+send_storm_event(storm_input_st const * const input, uint64_t const edges_per_second)
+{
+    blob_buf_init(&storm_event_buf, 0);
+    blobmsg_add_string(&storm_event_buf, "io type", "binary-input");
+    blobmsg_add_u32(&storm_event_buf, "instance", input->instance);
+    blobmsg_add_string(&storm_event_buf, "mode", input->polling ? "polling" : "edge");
+    if (input->polling)
+    {
+        blobmsg_add_u64(&storm_event_buf, "rate", edges_per_second);
+    }
+
+    gpio_ubus_send_event(STORM_EVENT_ID, storm_event_buf.head);
+}
+
+static void
+rearm_edge(storm_input_st * const input)
+{
+    if (gpio_backend_watch_edge(
+            input->gpio_number,
+            input->edge,
+            storm_guard.edge_callback,
+            (void *)(uintptr_t)input->instance) < 0)
+    {
+        /* Keep polling and try again later. */
+        DPRINTF("Unable to re-enable edge monitoring on input: %zu\n", input->instance);
+        uloop_timeout_set(&input->poll_timer, storm_guard.poll_ms);
+        goto done;
+    }
+
+    input->polling = false;
+    input->window_start_ns = monotonic_time_ns();
+    input->window_edges = 0;
+    send_storm_event(input, 0);
+
+done:
+    return;
+}
+
+static void
+poll_timer_expired(struct uloop_timeout * const timer)
+{
+    storm_input_st * const input = container_of(timer, storm_input_st, poll_timer);
+    uint64_t const now_ns = monotonic_time_ns();
+    bool state;
+
+    if (gpio_backend_read(input->gpio_number, &state) == 0 && state != input->polled_state)
+    {
+        input->polled_state = state;
+        input->last_change_ns = now_ns;
+        storm_guard.event(input->instance, state, now_ns);
+    }
+
+    if (now_ns - input->last_change_ns >= storm_guard.rearm_ms * NS_PER_MS)
+    {
+        rearm_edge(input);
+        goto done;
+    }
+
+    uloop_timeout_set(&input->poll_timer, storm_guard.poll_ms);
+
+done:
+    return;
+}
+
+static void
+start_polling(storm_input_st * const input, uint64_t const timestamp_ns)
+{
+    DPRINTF("Input %zu is generating too many edges. Polling it instead\n", input->instance);
+
+    gpio_backend_unwatch_edge(input->gpio_number);
+
+    input->polling = true;
+    input->last_change_ns = timestamp_ns;
+    if (gpio_backend_read(input->gpio_number, &input->polled_state) == 0)
+    {
+        storm_guard.event(input->instance, input->polled_state, timestamp_ns);
+    }
+    uloop_timeout_set(&input->poll_timer, storm_guard.poll_ms);
+
+    send_storm_event(input, input->window_edges);
+}
+
+bool storm_guard_start(
+    configuration_st const * const configuration,
+    storm_guard_event_fn const event,
+    gpio_edge_callback_fn const edge_callback)
+{
+    bool success;
+
+    storm_guard.max_edges = configuration_storm_max_edges(configuration);
+    storm_guard.poll_ms = configuration_storm_poll_ms(configuration);
+    storm_guard.rearm_ms = configuration_storm_rearm_ms(configuration);
+    storm_guard.event = event;
+    storm_guard.edge_callback = edge_callback;
+
+    if (storm_guard.max_edges == 0)
+    {
+        success = true;
+        goto done;
+    }
+
+    storm_guard.num_inputs = configuration_num_inputs(configuration);
+    storm_guard.inputs = calloc(storm_guard.num_inputs, sizeof *storm_guard.inputs);
+    if (storm_guard.inputs == NULL)
+    {
+        storm_guard.num_inputs = 0;
+        success = false;
+        goto done;
+    }
+
+    for (size_t instance = 0; instance < storm_guard.num_inputs; instance++)
+    {
+        storm_input_st * const input = &storm_guard.inputs[instance];
+
+        input->poll_timer.cb = poll_timer_expired;
+        input->instance = instance;
+        input->edge = configuration_input_edge(configuration, instance);
+        if (!configuration_input_gpio_number(configuration, instance, &input->gpio_number))
+        {
+            input->edge = gpio_edge_none;
+        }
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+void storm_guard_stop(void)
+{
+    for (size_t instance = 0; instance < storm_guard.num_inputs; instance++)
+    {
+        uloop_timeout_cancel(&storm_guard.inputs[instance].poll_timer);
+    }
+
+    free(storm_guard.inputs);
+    storm_guard.inputs = NULL;
+    storm_guard.num_inputs = 0;
+    blob_buf_free(&storm_event_buf);
+}
+
+void storm_guard_edge(size_t const instance, uint64_t const timestamp_ns)
+{
+    if (instance >= storm_guard.num_inputs)
+    {
+        goto done;
+    }
+
+    storm_input_st * const input = &storm_guard.inputs[instance];
+
+    if (input->polling || input->edge == gpio_edge_none)
+    {
+        goto done;
+    }
+
+    if (timestamp_ns - input->window_start_ns >= RATE_WINDOW_NS)
+    {
+        input->window_start_ns = timestamp_ns;
+        input->window_edges = 0;
+    }
+
+    input->window_edges++;
+    if (input->window_edges > storm_guard.max_edges)
+    {
+        start_polling(input, timestamp_ns);
+    }
+
+done:
+    return;
+}
+
+bool storm_guard_is_polling(size_t const instance)
+{
+    return instance < storm_guard.num_inputs && storm_guard.inputs[instance].polling;
+}
@@ -0,0 +1,36 @@
+#ifndef __STORM_GUARD_H__
+#define __STORM_GUARD_H__
+
+#include "configuration.h"
+#include "gpio_backend.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Protects the daemon from inputs generating edges faster than the
+ * configured "storm_max_edges" per second. Edge monitoring is disabled on
+ * such an input, which is then polled every "storm_poll_ms" until it has
+ * been stable for "storm_rearm_ms", when edge monitoring is re-enabled.
+ * Each switch between edge monitoring and polling is sent as a UBUS event.
+ */
+typedef void (*storm_guard_event_fn)(size_t instance, bool state, uint64_t timestamp_ns);
+
+/*
+ * 'event' is called with each change seen while polling. 'edge_callback'
+ * is used to re-enable edge monitoring, with the input instance as context.
+ */
+bool storm_guard_start(
+    configuration_st const * const configuration,
+    storm_guard_event_fn const event,
+    gpio_edge_callback_fn const edge_callback);
+
+void storm_guard_stop(void);
+
+/* Account for an edge on an input. */
+void storm_guard_edge(size_t const instance, uint64_t const timestamp_ns);
+
+bool storm_guard_is_polling(size_t const instance);
+
+
+#endif /* __STORM_GUARD_H__ */
@@ -0,0 +1,56 @@
+#ifndef __SYSFS_GPIO_FAST_H__
+#define __SYSFS_GPIO_FAST_H__
+
+/*
+ * The binary protocol used on sysfs_gpio_module's fast path socket, a
+ * SOCK_SEQPACKET Unix socket enabled with "fast_socket" in the
+ * configuration. Each packet holds exactly one request or one response.
+ * Requests on a connection are answered in order. All fields are in host
+ * byte order, as the socket is only reachable from the same host.
+ */
+
+#include <stdint.h>
+
+/* Enough pin bitmap words for 512 GPIO of each type. */
+#define SYSFS_GPIO_FAST_MAX_WORDS 8
+
+typedef enum sysfs_gpio_fast_op_t
+{
+    /* Read binary-input 'instance' into 'value'. */
+    sysfs_gpio_fast_op_get = 1,
+    /* Set binary-output 'instance' to 'value'. */
+    sysfs_gpio_fast_op_set = 2,
+    /* Read all binary-inputs into 'words'. */
+    sysfs_gpio_fast_op_get_all = 3,
+    /* Set each binary-output whose bit is set in 'mask' to its bit in 'words'. */
+    sysfs_gpio_fast_op_set_mask = 4
+} sysfs_gpio_fast_op_t;
+
+typedef struct sysfs_gpio_fast_request_st
+{
+    /* Returned in the response, to match it with the request. */
+    uint32_t tag;
+    uint16_t op;
+    uint16_t reserved;
+    uint32_t instance;
+    uint32_t value;
+    uint64_t words[SYSFS_GPIO_FAST_MAX_WORDS];
+    uint64_t mask[SYSFS_GPIO_FAST_MAX_WORDS];
+} sysfs_gpio_fast_request_st;
+
+typedef struct sysfs_gpio_fast_response_st
+{
+    uint32_t tag;
+    uint16_t op;
+    uint16_t reserved;
+    /*
+     * 0 on success, otherwise a negative errno value. -EPERM means an
+     * interlock rule holds an output at the other level.
+     */
+    int32_t status;
+    uint32_t value;
+    uint64_t words[SYSFS_GPIO_FAST_MAX_WORDS];
+} sysfs_gpio_fast_response_st;
+
+
+#endif /* __SYSFS_GPIO_FAST_H__ */
@@ -1,10 +1,20 @@
 /* Taken from https://elinux.org/RPi_GPIO_Code_Samples#sysfs */
 #include "sysfs_gpio_module.h"
+#include "monotonic.h"
+#include "gpio_stats.h"
+#include "pin_bitmap.h"
+#include "uring_batch.h"
 #include "ubus_common.h"
 
+#include <libubox/uloop.h>
+
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -85,18 +95,22 @@ static gpio_definition_st const gpio_definitions[] =
 };
 #define NUM_GPIO_DEFINITIONS ARRAY_SIZE(gpio_definitions)
 
-#define GPIO_BASE_PATH "/sys/class/gpio"
+#define DEFAULT_GPIO_BASE_PATH "/sys/class/gpio"
 
+/* May be pointed elsewhere by the configuration, e.g. at a fake tree for testing. */
+static char const * gpio_base_path = DEFAULT_GPIO_BASE_PATH;
 
 #define BUFFER_MAX 10
 static int
 GPIOExport(int const pin)
 {
 	char buffer[BUFFER_MAX];
+	char path[PATH_MAX];
 	ssize_t bytes_written;
 	int fd;
 
-    fd = open(GPIO_BASE_PATH "/export", O_WRONLY);
+    snprintf(path, sizeof path, "%s/export", gpio_base_path);
+    fd = open(path, O_WRONLY);
 	if (-1 == fd) 
     {
 		fprintf(stderr, "Failed to open export for writing!\n");
@@ -114,10 +128,12 @@ static int
 GPIOUnexport(int const pin)
 {
 	char buffer[BUFFER_MAX];
+	char path[PATH_MAX];
 	ssize_t bytes_written;
 	int fd;
 
-    fd = open(GPIO_BASE_PATH "/unexport", O_WRONLY);
+    snprintf(path, sizeof path, "%s/unexport", gpio_base_path);
+    fd = open(path, O_WRONLY);
 	if (-1 == fd) 
     {
 		fprintf(stderr, "Failed to open unexport for writing!\n");
@@ -132,14 +148,20 @@ GPIOUnexport(int const pin)
 }
 
 static int
-GPIODirection(int pin, bool const outgoing)
+GPIODirection(int pin, gpio_direction_t const direction)
 {
-#define DIRECTION_MAX 35
-	char path[DIRECTION_MAX];
+    /* "high" and "low" set the level along with the direction, unlike "out". */
+    static char const * const direction_strs[] =
+    {
+        [gpio_direction_in] = "in",
+        [gpio_direction_out_low] = "low",
+        [gpio_direction_out_high] = "high"
+    };
+	char path[PATH_MAX];
 	int fd;
     int result;
 
-    snprintf(path, DIRECTION_MAX, GPIO_BASE_PATH "/gpio%d/direction", pin);
+    snprintf(path, sizeof path, "%s/gpio%d/direction", gpio_base_path, pin);
 	fd = open(path, O_WRONLY);
 	if (-1 == fd) 
     {
@@ -148,7 +170,7 @@ GPIODirection(int pin, bool const outgoing)
         goto done;
 	}
 
-    char const * const direction_str = outgoing ? "out" : "in";
+    char const * const direction_str = direction_strs[direction];
 
     if (-1 == write(fd, direction_str, strlen(direction_str)))
     {
@@ -168,32 +190,38 @@ done:
 	return result;
 }
 
-int
-GPIORead(int const pin, bool * const state)
+static int
+GPIOEdge(int const pin, gpio_edge_t const edge)
 {
-#define VALUE_MAX 30
-	char path[VALUE_MAX];
-	char value_str[3];
+    static char const * const edge_strs[] =
+    {
+        [gpio_edge_none] = "none",
+        [gpio_edge_rising] = "rising",
+        [gpio_edge_falling] = "falling",
+        [gpio_edge_both] = "both"
+    };
+	char path[PATH_MAX];
 	int fd;
     int result;
 
-    snprintf(path, VALUE_MAX, GPIO_BASE_PATH "/gpio%d/value", pin);
-	fd = open(path, O_RDONLY);
-	if (fd < 0) 
+    snprintf(path, sizeof path, "%s/gpio%d/edge", gpio_base_path, pin);
+	fd = open(path, O_WRONLY);
+	if (-1 == fd)
     {
-		fprintf(stderr, "Failed to open gpio value for reading!\n");
-        result = -1;
+		fprintf(stderr, "Failed to open gpio edge for writing!\n");
+		result = -1;
         goto done;
 	}
 
-	if (read(fd, value_str, sizeof value_str) < 0) 
+    char const * const edge_str = edge_strs[edge];
+
+    if (-1 == write(fd, edge_str, strlen(edge_str)))
     {
-		fprintf(stderr, "Failed to read value!\n");
+        fprintf(stderr, "Failed to set edge!\n");
         result = -1;
         goto done;
     }
 
-    *state = atoi(value_str);
     result = 0;
 
 done:
@@ -205,59 +233,153 @@ done:
 	return result;
 }
 
-int
-GPIOWrite(int const pin, bool const high)
+typedef struct sysfs_edge_watch_st
 {
-	char path[VALUE_MAX];
-	int fd;
-    int result;
+    struct uloop_fd uloop_fd;
+    size_t gpio_number;
+    /* Set once the notification pending at registration has been consumed. */
+    bool armed;
+    gpio_edge_callback_fn callback;
+    void * callback_ctx;
+} sysfs_edge_watch_st;
 
-    snprintf(path, sizeof path, GPIO_BASE_PATH "/gpio%d/value", pin);
-	fd = open(path, O_WRONLY);
-	if (-1 == fd) 
+typedef struct value_fd_cache_st
+{
+    int * fds;
+    /* Edge watches use the cached value fd, so are kept alongside it. */
+    sysfs_edge_watch_st * * watches;
+    size_t num_fds;
+
+    /*
+     * Pins may also be read and written from worker threads. Cached fds
+     * are only replaced with the lock held, and a watched pin's fd only
+     * from the uloop thread, which owns the watch.
+     */
+    pthread_mutex_t lock;
+    pthread_t loop_thread;
+} value_fd_cache_st;
+
+/*
+ * The 'value' file of each configured GPIO is opened once and kept open so
+ * that reads and writes don't need to open/close the file each time.
+ * The table is indexed by GPIO number.
+ */
+static value_fd_cache_st value_fd_cache =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static bool
+value_fd_cache_init(size_t const num_fds)
+{
+    bool success;
+
+    value_fd_cache.fds = calloc(num_fds, sizeof *value_fd_cache.fds);
+    value_fd_cache.watches = calloc(num_fds, sizeof *value_fd_cache.watches);
+    if (value_fd_cache.fds == NULL || value_fd_cache.watches == NULL)
     {
-		fprintf(stderr, "Failed to open gpio value for writing!\n");
-        result = -1;
+        free(value_fd_cache.fds);
+        value_fd_cache.fds = NULL;
+        free(value_fd_cache.watches);
+        value_fd_cache.watches = NULL;
+        value_fd_cache.num_fds = 0;
+        success = false;
         goto done;
-	}
+    }
 
-	if (1 != write(fd, high ? "1" : "0", 1)) 
+    value_fd_cache.num_fds = num_fds;
+    value_fd_cache.loop_thread = pthread_self();
+    for (size_t index = 0; index < value_fd_cache.num_fds; index++)
     {
-		fprintf(stderr, "Failed to write value!\n");
-        result = -1;
-        goto done;
+        value_fd_cache.fds[index] = -1;
     }
 
-    result = 0;
+    success = true;
 
 done:
-    if (fd >= 0)
+    return success;
+}
+
+/* Must be called with the lock held. */
+static bool
+value_fd_replaceable(size_t const pin)
+{
+    return value_fd_cache.watches[pin] == NULL
+        || pthread_equal(pthread_self(), value_fd_cache.loop_thread);
+}
+
+static void
+value_fd_invalidate(size_t const pin)
+{
+    if (pin >= value_fd_cache.num_fds)
     {
-        close(fd);
+        goto done;
     }
 
-	return result;
+    pthread_mutex_lock(&value_fd_cache.lock);
+
+    if (value_fd_cache.fds[pin] >= 0 && value_fd_replaceable(pin))
+    {
+        sysfs_edge_watch_st * const watch = value_fd_cache.watches[pin];
+
+        if (watch != NULL && watch->uloop_fd.registered)
+        {
+            uloop_fd_delete(&watch->uloop_fd);
+        }
+
+        uint64_t const start_ns = monotonic_time_ns();
+        bool const closed = close(value_fd_cache.fds[pin]) == 0;
+
+        gpio_stats_record(gpio_stats_op_close, pin, start_ns, closed);
+        __atomic_store_n(&value_fd_cache.fds[pin], -1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&value_fd_cache.lock);
+
+done:
+    return;
 }
 
-static bool 
-configure_gpio(size_t const gpio_number, bool const outgoing)
+/*
+ * Make room for pins up to num_fds, keeping the fds and watches of the pins
+ * already cached. Only called while no other thread uses the cache.
+ */
+static bool
+value_fd_cache_grow(size_t const num_fds)
 {
     bool success;
 
-    if (GPIOExport(gpio_number) < 0)
+    if (num_fds <= value_fd_cache.num_fds)
+    {
+        success = true;
+        goto done;
+    }
+
+    int * const fds = realloc(value_fd_cache.fds, num_fds * sizeof *fds);
+
+    if (fds == NULL)
     {
         success = false;
         goto done;
     }
+    value_fd_cache.fds = fds;
 
-    /*
-     * Set GPIO direction.
-     */
-    if (GPIODirection(gpio_number, outgoing) < 0)
+    sysfs_edge_watch_st * * const watches =
+        realloc(value_fd_cache.watches, num_fds * sizeof *watches);
+
+    if (watches == NULL)
     {
         success = false;
         goto done;
     }
+    value_fd_cache.watches = watches;
+
+    for (size_t index = value_fd_cache.num_fds; index < num_fds; index++)
+    {
+        value_fd_cache.fds[index] = -1;
+        value_fd_cache.watches[index] = NULL;
+    }
+    value_fd_cache.num_fds = num_fds;
 
     success = true;
 
@@ -265,61 +387,331 @@ done:
     return success;
 }
 
-static bool 
-enable_inputs(configuration_st const * const configuration)
+static void
+value_fd_cache_free(void)
 {
-    bool success;
+    for (size_t pin = 0; pin < value_fd_cache.num_fds; pin++)
+    {
+        value_fd_invalidate(pin);
+        free(value_fd_cache.watches[pin]);
+    }
+    free(value_fd_cache.fds);
+    value_fd_cache.fds = NULL;
+    free(value_fd_cache.watches);
+    value_fd_cache.watches = NULL;
+    value_fd_cache.num_fds = 0;
+}
+
+static void
+watch_register(sysfs_edge_watch_st * const watch, int const fd)
+{
+    /*
+     * uloop has no way to ask for POLLPRI. sysfs reports EPOLLIN whenever
+     * it reports EPOLLPRI, so an edge triggered read registration gives the
+     * same notifications. sysfs also flags a change as an error, so the
+     * callback must still be called in that case.
+     */
+    watch->uloop_fd.fd = fd;
+    watch->armed = false;
+    uloop_fd_add(&watch->uloop_fd, ULOOP_READ | ULOOP_EDGE_TRIGGER | ULOOP_ERROR_CB);
+}
+
+/* Must be called with the lock held. */
+static int
+value_fd_open(size_t const pin)
+{
+    int fd = value_fd_cache.fds[pin];
+
+    /* Another thread may have got here first. */
+    if (fd >= 0)
+    {
+        goto done;
+    }
+
+    if (!value_fd_replaceable(pin))
+    {
+        goto done;
+    }
+
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof path, "%s/gpio%zu/value", gpio_base_path, pin);
+
+    uint64_t const start_ns = monotonic_time_ns();
+
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    gpio_stats_record(gpio_stats_op_open, pin, start_ns, fd >= 0);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open gpio value!\n");
+        goto done;
+    }
+
+    __atomic_store_n(&value_fd_cache.fds[pin], fd, __ATOMIC_RELEASE);
+
+    sysfs_edge_watch_st * const watch = value_fd_cache.watches[pin];
+
+    if (watch != NULL)
+    {
+        watch_register(watch, fd);
+    }
+
+done:
+    return fd;
+}
+
+static int
+value_fd_get(size_t const pin)
+{
+    int fd;
+
+    if (pin >= value_fd_cache.num_fds)
+    {
+        fprintf(stderr, "GPIO %zu is not configured!\n", pin);
+        fd = -1;
+        goto done;
+    }
+
+    fd = __atomic_load_n(&value_fd_cache.fds[pin], __ATOMIC_ACQUIRE);
+    if (fd >= 0)
+    {
+        goto done;
+    }
+
+    pthread_mutex_lock(&value_fd_cache.lock);
+    fd = value_fd_open(pin);
+    pthread_mutex_unlock(&value_fd_cache.lock);
+
+done:
+    return fd;
+}
 
-    for (size_t index = 0; index < configuration_num_inputs(configuration); index++)
+int
+GPIORead(int const pin, bool * const state)
+{
+    char value_str[3];
+    ssize_t bytes_read = -1;
+    int result;
+
+    /*
+     * If the cached descriptor has gone bad, close it and try once more
+     * with a freshly opened one.
+     */
+    for (size_t attempt = 0; attempt < 2 && bytes_read <= 0; attempt++)
     {
-        size_t gpio_number;
+        int const fd = value_fd_get(pin);
 
-        if (!configuration_input_gpio_number(configuration, index, &gpio_number))
+        if (fd < 0)
         {
-            success = false;
-            goto done;
+            break;
+        }
+
+        bytes_read = pread(fd, value_str, sizeof value_str - 1, 0);
+        if (bytes_read <= 0)
+        {
+            value_fd_invalidate(pin);
         }
-        configure_gpio(gpio_number, false);
     }
 
-    success = true;
+    if (bytes_read <= 0)
+    {
+        fprintf(stderr, "Failed to read value!\n");
+        result = -1;
+        goto done;
+    }
+
+    value_str[bytes_read] = '\0';
+    *state = atoi(value_str);
+    result = 0;
+
+done:
+    return result;
+}
+
+int
+GPIOWrite(int const pin, bool const high)
+{
+    ssize_t bytes_written = -1;
+    int result;
+
+    for (size_t attempt = 0; attempt < 2 && bytes_written != 1; attempt++)
+    {
+        int const fd = value_fd_get(pin);
+
+        if (fd < 0)
+        {
+            break;
+        }
+
+        bytes_written = pwrite(fd, high ? "1" : "0", 1, 0);
+        if (bytes_written != 1)
+        {
+            value_fd_invalidate(pin);
+        }
+    }
+
+    if (bytes_written != 1)
+    {
+        fprintf(stderr, "Failed to write value!\n");
+        result = -1;
+        goto done;
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+typedef struct sysfs_chip_st
+{
+    size_t base;
+    size_t ngpio;
+} sysfs_chip_st;
+
+typedef struct sysfs_chip_table_st
+{
+    size_t num_chips;
+    sysfs_chip_st * chips;
+} sysfs_chip_table_st;
+
+/* The GPIO controllers found under the base path, used to group pins by chip. */
+static sysfs_chip_table_st sysfs_chips;
+
+static bool
+read_chip_attribute(char const * const chip_name, char const * const attribute, size_t * const value)
+{
+    bool success;
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof path, "%s/%s/%s", gpio_base_path, chip_name, attribute);
+
+    FILE * const file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    success = fscanf(file, "%zu", value) == 1;
+    fclose(file);
 
 done:
     return success;
 }
 
 static void
-disable_inputs(configuration_st const * const configuration)
+sysfs_chips_load(void)
 {
-    for (size_t index = 0; index < configuration_num_inputs(configuration); index++)
+    DIR * const dir = opendir(gpio_base_path);
+
+    if (dir == NULL)
     {
-        size_t gpio_number;
+        goto done;
+    }
 
-        if (!configuration_input_gpio_number(configuration, index, &gpio_number))
+    for (struct dirent const * entry = readdir(dir); entry != NULL; entry = readdir(dir))
+    {
+        static char const chip_prefix[] = "gpiochip";
+        sysfs_chip_st chip;
+
+        if (strncmp(entry->d_name, chip_prefix, sizeof chip_prefix - 1) != 0
+            || !read_chip_attribute(entry->d_name, "base", &chip.base)
+            || !read_chip_attribute(entry->d_name, "ngpio", &chip.ngpio))
         {
             continue;
         }
-        GPIOUnexport(gpio_number);
+
+        sysfs_chip_st * const chips =
+            realloc(sysfs_chips.chips, (sysfs_chips.num_chips + 1) * sizeof *chips);
+
+        if (chips == NULL)
+        {
+            break;
+        }
+        sysfs_chips.chips = chips;
+        sysfs_chips.chips[sysfs_chips.num_chips] = chip;
+        sysfs_chips.num_chips++;
     }
+
+    closedir(dir);
+
+done:
+    return;
 }
 
-static bool 
-enable_outputs(configuration_st const * const configuration)
+static void
+sysfs_chips_free(void)
 {
-    bool success;
+    free(sysfs_chips.chips);
+    sysfs_chips.chips = NULL;
+    sysfs_chips.num_chips = 0;
+}
 
-    for (size_t index = 0; index < configuration_num_outputs(configuration); index++)
+static int
+sysfs_chip_of(size_t const gpio_number, size_t * const chip)
+{
+    int result;
+
+    for (size_t index = 0; index < sysfs_chips.num_chips; index++)
     {
-        size_t gpio_number;
+        sysfs_chip_st const * const candidate = &sysfs_chips.chips[index];
 
-        if (!configuration_output_gpio_number(configuration, index, &gpio_number))
+        if (gpio_number >= candidate->base
+            && gpio_number - candidate->base < candidate->ngpio)
         {
-            success = false;
+            *chip = candidate->base;
+            result = 0;
             goto done;
         }
-        configure_gpio(gpio_number, true);
     }
 
+    result = -1;
+
+done:
+    return result;
+}
+
+static bool
+sysfs_open(configuration_st const * const configuration)
+{
+    char const * const base_path = configuration_base_path(configuration);
+
+    gpio_base_path = base_path != NULL ? base_path : DEFAULT_GPIO_BASE_PATH;
+    sysfs_chips_load();
+
+    return value_fd_cache_init(configuration_highest_gpio_number(configuration) + 1);
+}
+
+/* Pins in both configurations keep their cached value fds and edge watches. */
+static bool
+sysfs_reconfigure(configuration_st const * const configuration)
+{
+    bool success;
+    char const * const base_path = configuration_base_path(configuration);
+    char const * const next_base_path = base_path != NULL ? base_path : DEFAULT_GPIO_BASE_PATH;
+
+    if (strcmp(next_base_path, gpio_base_path) != 0)
+    {
+        fprintf(stderr, "The GPIO base path can't be changed by a reload!\n");
+        success = false;
+        goto done;
+    }
+
+    if (!value_fd_cache_grow(configuration_highest_gpio_number(configuration) + 1))
+    {
+        success = false;
+        goto done;
+    }
+
+    /* The old path belongs to the configuration being replaced. */
+    gpio_base_path = next_base_path;
+
+    /* Controllers may have come or gone since the last load. */
+    sysfs_chips_free();
+    sysfs_chips_load();
+
     success = true;
 
 done:
@@ -327,45 +719,498 @@ done:
 }
 
 static void
-disable_outputs(configuration_st const * const configuration)
+sysfs_close(void)
 {
-    for (size_t index = 0; index < configuration_num_outputs(configuration); index++)
+    value_fd_cache_free();
+    sysfs_chips_free();
+    gpio_base_path = DEFAULT_GPIO_BASE_PATH;
+}
+
+static bool
+gpio_exported(size_t const gpio_number)
+{
+    char path[PATH_MAX];
+    struct stat gpio_stat;
+
+    snprintf(path, sizeof path, "%s/gpio%zu", gpio_base_path, gpio_number);
+
+    return stat(path, &gpio_stat) == 0 && S_ISDIR(gpio_stat.st_mode);
+}
+
+static int
+sysfs_export_pin(size_t const gpio_number)
+{
+    int result;
+
+    /* Exporting an exported pin fails with EBUSY, so don't try. */
+    if (gpio_exported(gpio_number))
     {
-        size_t gpio_number;
+        result = 1;
+        goto done;
+    }
 
-        if (!configuration_output_gpio_number(configuration, index, &gpio_number))
-        {
-            continue;
-        }
-        GPIOUnexport(gpio_number);
+    result = GPIOExport(gpio_number);
+
+done:
+    return result;
+}
+
+static int
+sysfs_unexport_pin(size_t const gpio_number)
+{
+    value_fd_invalidate(gpio_number);
+
+    return GPIOUnexport(gpio_number);
+}
+
+static int
+sysfs_set_direction(size_t const gpio_number, gpio_direction_t const direction)
+{
+    int result;
+
+    if (GPIODirection(gpio_number, direction) < 0)
+    {
+        result = -1;
+        goto done;
+    }
+
+    /* The value file only exists once the pin is exported, so cache it now. */
+    if (value_fd_get(gpio_number) < 0)
+    {
+        result = -1;
+        goto done;
     }
+
+    result = 0;
+
+done:
+    return result;
 }
 
-bool enable_gpio_pins(configuration_st const * const configuration)
+static int
+sysfs_read(size_t const gpio_number, bool * const state)
 {
-    bool success;
+    return GPIORead(gpio_number, state);
+}
 
-    if (!enable_inputs(configuration))
+static int
+sysfs_write(size_t const gpio_number, bool const high)
+{
+    return GPIOWrite(gpio_number, high);
+}
+
+static void
+sysfs_unwatch_edge(size_t const gpio_number);
+
+static void
+sysfs_edge_event(struct uloop_fd * const uloop_fd, unsigned int const events)
+{
+    sysfs_edge_watch_st * const watch =
+        container_of(uloop_fd, sysfs_edge_watch_st, uloop_fd);
+    uint64_t const timestamp_ns = monotonic_time_ns();
+    bool state;
+
+    uloop_fd->error = false;
+
+    /* Reading the value acknowledges the notification. */
+    if (GPIORead(watch->gpio_number, &state) < 0)
     {
-        success = false;
         goto done;
     }
 
-    if (!enable_outputs(configuration))
+    if (!watch->armed)
+    {
+        /* Registering the fd always reports it as ready once. */
+        watch->armed = true;
+        goto done;
+    }
+
+    watch->callback(watch->callback_ctx, watch->gpio_number, state, timestamp_ns);
+
+done:
+    return;
+}
+
+static int
+sysfs_watch_edge(
+    size_t const gpio_number,
+    gpio_edge_t const edge,
+    gpio_edge_callback_fn const callback,
+    void * const callback_ctx)
+{
+    int result;
+
+    if (gpio_number >= value_fd_cache.num_fds || edge == gpio_edge_none)
+    {
+        result = -1;
+        goto done;
+    }
+
+    if (value_fd_cache.watches[gpio_number] != NULL)
+    {
+        fprintf(stderr, "GPIO %zu is already being watched!\n", gpio_number);
+        result = -1;
+        goto done;
+    }
+
+    if (GPIOEdge(gpio_number, edge) < 0)
+    {
+        result = -1;
+        goto done;
+    }
+
+    sysfs_edge_watch_st * const watch = calloc(1, sizeof *watch);
+
+    if (watch == NULL)
+    {
+        result = -1;
+        goto done;
+    }
+
+    watch->uloop_fd.cb = sysfs_edge_event;
+    watch->gpio_number = gpio_number;
+    watch->callback = callback;
+    watch->callback_ctx = callback_ctx;
+    pthread_mutex_lock(&value_fd_cache.lock);
+    value_fd_cache.watches[gpio_number] = watch;
+    pthread_mutex_unlock(&value_fd_cache.lock);
+
+    int const fd = value_fd_get(gpio_number);
+
+    if (fd < 0)
+    {
+        sysfs_unwatch_edge(gpio_number);
+        result = -1;
+        goto done;
+    }
+
+    if (!watch->uloop_fd.registered)
+    {
+        watch_register(watch, fd);
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static void
+sysfs_unwatch_edge(size_t const gpio_number)
+{
+    if (gpio_number >= value_fd_cache.num_fds)
+    {
+        goto done;
+    }
+
+    sysfs_edge_watch_st * const watch = value_fd_cache.watches[gpio_number];
+
+    if (watch == NULL)
+    {
+        goto done;
+    }
+
+    if (watch->uloop_fd.registered)
+    {
+        uloop_fd_delete(&watch->uloop_fd);
+    }
+    pthread_mutex_lock(&value_fd_cache.lock);
+    value_fd_cache.watches[gpio_number] = NULL;
+    pthread_mutex_unlock(&value_fd_cache.lock);
+    free(watch);
+
+    GPIOEdge(gpio_number, gpio_edge_none);
+
+done:
+    return;
+}
+
+gpio_backend_st const sysfs_gpio_backend =
+{
+    .name = "sysfs",
+    .open = sysfs_open,
+    .close = sysfs_close,
+    .export_pin = sysfs_export_pin,
+    .unexport_pin = sysfs_unexport_pin,
+    .set_direction = sysfs_set_direction,
+    .read = sysfs_read,
+    .write = sysfs_write,
+    .watch_edge = sysfs_watch_edge,
+    .unwatch_edge = sysfs_unwatch_edge,
+    .chip_of = sysfs_chip_of,
+    .reconfigure = sysfs_reconfigure
+};
+
+/* The most pins read or written with one io_uring submission. */
+#define URING_ENTRIES 64
+
+typedef struct sysfs_uring_st
+{
+    /* Worker threads may share the ring, but only one at a time. */
+    pthread_mutex_t lock;
+    uring_batch_st * batch;
+} sysfs_uring_st;
+
+static sysfs_uring_st sysfs_uring =
+{
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static bool
+sysfs_uring_open(configuration_st const * const configuration)
+{
+    bool success;
+
+    if (!sysfs_open(configuration))
     {
         success = false;
         goto done;
     }
 
+    sysfs_uring.batch = uring_batch_open(URING_ENTRIES);
+    if (sysfs_uring.batch == NULL)
+    {
+        fprintf(stderr, "io_uring isn't available, using plain system calls!\n");
+    }
+
     success = true;
 
 done:
     return success;
 }
 
-void disable_gpio_pins(configuration_st const * const configuration)
+static void
+sysfs_uring_close(void)
+{
+    uring_batch_close(sysfs_uring.batch);
+    sysfs_uring.batch = NULL;
+    sysfs_close();
+}
+
+/*
+ * Returns false if the ring is unavailable, or in use by another thread,
+ * in which case the caller falls back to plain system calls.
+ */
+static bool
+sysfs_uring_acquire(void)
 {
-    disable_inputs(configuration);
-    disable_outputs(configuration);
+    bool acquired;
+
+    if (sysfs_uring.batch == NULL || pthread_mutex_trylock(&sysfs_uring.lock) != 0)
+    {
+        acquired = false;
+        goto done;
+    }
+
+    /* The ring may have failed while the lock was held by another thread. */
+    if (sysfs_uring.batch == NULL)
+    {
+        pthread_mutex_unlock(&sysfs_uring.lock);
+        acquired = false;
+        goto done;
+    }
+
+    acquired = true;
+
+done:
+    return acquired;
 }
 
+static int
+sysfs_uring_run(uring_batch_op_st * const ops, size_t const count)
+{
+    int const result = uring_batch_run(sysfs_uring.batch, ops, count);
+
+    if (result < 0)
+    {
+        fprintf(stderr, "io_uring failed, using plain system calls!\n");
+        uring_batch_close(sysfs_uring.batch);
+        sysfs_uring.batch = NULL;
+    }
+
+    return result;
+}
+
+/* Read up to URING_ENTRIES pins with the ring held. */
+static int
+sysfs_uring_read_chunk(
+    size_t const * const gpio_numbers,
+    size_t const count,
+    uint64_t * const state_words,
+    size_t const first_bit)
+{
+    int result = 0;
+    uring_batch_op_st ops[URING_ENTRIES];
+    char values[URING_ENTRIES][2];
+
+    for (size_t index = 0; index < count; index++)
+    {
+        ops[index] = (uring_batch_op_st)
+        {
+            .fd = value_fd_get(gpio_numbers[index]),
+            .buffer = values[index],
+            .length = sizeof values[index],
+            .result = -EBADF
+        };
+    }
+
+    if (sysfs_uring_run(ops, count) < 0)
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            ops[index].result = -EIO;
+        }
+    }
+
+    for (size_t index = 0; index < count; index++)
+    {
+        bool state;
+
+        if (ops[index].result > 0)
+        {
+            state = values[index][0] == '1';
+        }
+        /* Retried alone, which also replaces a bad cached fd. */
+        else if (GPIORead(gpio_numbers[index], &state) < 0)
+        {
+            result = -1;
+            continue;
+        }
+        pin_bitmap_assign(state_words, first_bit + index, state);
+    }
+
+    return result;
+}
+
+static int
+sysfs_uring_write_chunk(
+    size_t const * const gpio_numbers,
+    uint64_t const * const state_words,
+    size_t const count,
+    size_t const first_bit)
+{
+    int result = 0;
+    uring_batch_op_st ops[URING_ENTRIES];
+
+    for (size_t index = 0; index < count; index++)
+    {
+        ops[index] = (uring_batch_op_st)
+        {
+            .fd = value_fd_get(gpio_numbers[index]),
+            .write = true,
+            .buffer = (char *)(pin_bitmap_get(state_words, first_bit + index) ? "1" : "0"),
+            .length = 1,
+            .result = -EBADF
+        };
+    }
+
+    if (sysfs_uring_run(ops, count) < 0)
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            ops[index].result = -EIO;
+        }
+    }
+
+    for (size_t index = 0; index < count; index++)
+    {
+        if (ops[index].result != 1
+            && GPIOWrite(gpio_numbers[index], pin_bitmap_get(state_words, first_bit + index)) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+static int
+sysfs_uring_read_bulk(size_t const * const gpio_numbers, size_t const count, uint64_t * const state_words)
+{
+    int result = 0;
+
+    if (!sysfs_uring_acquire())
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            bool state;
+
+            if (GPIORead(gpio_numbers[index], &state) < 0)
+            {
+                result = -1;
+                goto done;
+            }
+            pin_bitmap_assign(state_words, index, state);
+        }
+        goto done;
+    }
+
+    for (size_t first = 0; first < count; first += URING_ENTRIES)
+    {
+        size_t const chunk = count - first < URING_ENTRIES ? count - first : URING_ENTRIES;
+
+        if (sysfs_uring_read_chunk(gpio_numbers + first, chunk, state_words, first) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&sysfs_uring.lock);
+
+done:
+    return result;
+}
+
+static int
+sysfs_uring_write_bulk(
+    size_t const * const gpio_numbers,
+    uint64_t const * const state_words,
+    size_t const count)
+{
+    int result = 0;
+
+    if (!sysfs_uring_acquire())
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            if (GPIOWrite(gpio_numbers[index], pin_bitmap_get(state_words, index)) < 0)
+            {
+                result = -1;
+            }
+        }
+        goto done;
+    }
+
+    for (size_t first = 0; first < count; first += URING_ENTRIES)
+    {
+        size_t const chunk = count - first < URING_ENTRIES ? count - first : URING_ENTRIES;
+
+        if (sysfs_uring_write_chunk(gpio_numbers + first, state_words, chunk, first) < 0)
+        {
+            result = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&sysfs_uring.lock);
+
+done:
+    return result;
+}
+
+gpio_backend_st const sysfs_uring_gpio_backend =
+{
+    .name = "sysfs-uring",
+    .open = sysfs_uring_open,
+    .close = sysfs_uring_close,
+    .export_pin = sysfs_export_pin,
+    .unexport_pin = sysfs_unexport_pin,
+    .set_direction = sysfs_set_direction,
+    .read = sysfs_read,
+    .write = sysfs_write,
+    .read_bulk = sysfs_uring_read_bulk,
+    .write_bulk = sysfs_uring_write_bulk,
+    .watch_edge = sysfs_watch_edge,
+    .unwatch_edge = sysfs_unwatch_edge,
+    .chip_of = sysfs_chip_of,
+    .reconfigure = sysfs_reconfigure
+};
@@ -1,7 +1,7 @@
 #ifndef __SYSFS_GPIO_MODULE_H__
 #define __SYSFS_GPIO_MODULE_H__
 
-#include "configuration.h"
+#include "gpio_backend.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -12,8 +12,14 @@ GPIORead(int const pin, bool * const state);
 int
 GPIOWrite(int const pin, bool const high);
 
-bool enable_gpio_pins(configuration_st const * const configuration);
-void disable_gpio_pins(configuration_st const * const configuration);
+extern gpio_backend_st const sysfs_gpio_backend;
+
+/*
+ * The sysfs backend, with the reads and writes of multi-pin requests
+ * submitted together with io_uring. Falls back to plain system calls when
+ * io_uring isn't available.
+ */
+extern gpio_backend_st const sysfs_uring_gpio_backend;
 
 
 #endif /* __SYSFS_GPIO_MODULE_H__ */
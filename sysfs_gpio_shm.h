@@ -0,0 +1,206 @@
+#ifndef __SYSFS_GPIO_SHM_H__
+#define __SYSFS_GPIO_SHM_H__
+
+/*
+ * The layout of the shared memory page in which sysfs_gpio_module publishes
+ * the state of its inputs and outputs, and functions for local processes
+ * to read it without any system calls after it has been opened.
+ *
+ * The page is updated under a seqlock. Readers copy what they need, and
+ * retry if the sequence number was odd (update in progress) or changed
+ * while they were copying.
+ *
+ * Link with -lrt on C libraries where shm_open() lives there.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SYSFS_GPIO_SHM_NAME "/sysfs_gpio_module"
+#define SYSFS_GPIO_SHM_MAGIC 0x4f495047u
+#define SYSFS_GPIO_SHM_VERSION 1u
+
+typedef struct sysfs_gpio_shm_st
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+
+    /* Odd while the page is being updated. */
+    uint64_t sequence;
+
+    /* The number of input and output changes published. */
+    uint64_t input_changes;
+    uint64_t output_changes;
+    /* The time (CLOCK_MONOTONIC, ns) of the last update. */
+    uint64_t updated_ns;
+
+    /*
+     * The input pin bitmap, the output pin bitmap, then the time each
+     * input last changed. Bit N of the bitmaps is binary-input/output N.
+     */
+    uint64_t data[];
+} sysfs_gpio_shm_st;
+
+static inline size_t
+sysfs_gpio_shm_num_words(uint32_t const num_pins)
+{
+    return (num_pins + 63) / 64;
+}
+
+static inline size_t
+sysfs_gpio_shm_size(uint32_t const num_inputs, uint32_t const num_outputs)
+{
+    return sizeof(sysfs_gpio_shm_st)
+        + (sysfs_gpio_shm_num_words(num_inputs)
+           + sysfs_gpio_shm_num_words(num_outputs)
+           + num_inputs) * sizeof(uint64_t);
+}
+
+static inline uint64_t *
+sysfs_gpio_shm_input_words(sysfs_gpio_shm_st * const shm)
+{
+    return shm->data;
+}
+
+static inline uint64_t *
+sysfs_gpio_shm_output_words(sysfs_gpio_shm_st * const shm)
+{
+    return shm->data + sysfs_gpio_shm_num_words(shm->num_inputs);
+}
+
+static inline uint64_t *
+sysfs_gpio_shm_input_changed_ns(sysfs_gpio_shm_st * const shm)
+{
+    return shm->data
+        + sysfs_gpio_shm_num_words(shm->num_inputs)
+        + sysfs_gpio_shm_num_words(shm->num_outputs);
+}
+
+/* Map the page read-only. Returns NULL if it isn't available. */
+static inline sysfs_gpio_shm_st const *
+sysfs_gpio_shm_open(void)
+{
+    sysfs_gpio_shm_st const * shm = NULL;
+    struct stat shm_stat;
+    void * mapping;
+    int const fd = shm_open(SYSFS_GPIO_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0)
+    {
+        goto done;
+    }
+
+    if (fstat(fd, &shm_stat) < 0 || (size_t)shm_stat.st_size < sizeof *shm)
+    {
+        goto done;
+    }
+
+    mapping = mmap(NULL, shm_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        goto done;
+    }
+
+    shm = (sysfs_gpio_shm_st const *)mapping;
+    if (shm->magic != SYSFS_GPIO_SHM_MAGIC
+        || shm->version != SYSFS_GPIO_SHM_VERSION
+        || (size_t)shm_stat.st_size < sysfs_gpio_shm_size(shm->num_inputs, shm->num_outputs))
+    {
+        munmap(mapping, shm_stat.st_size);
+        shm = NULL;
+    }
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    return shm;
+}
+
+static inline void
+sysfs_gpio_shm_close(sysfs_gpio_shm_st const * const shm)
+{
+    if (shm != NULL)
+    {
+        munmap((void *)shm, sysfs_gpio_shm_size(shm->num_inputs, shm->num_outputs));
+    }
+}
+
+typedef struct sysfs_gpio_shm_snapshot_st
+{
+    uint64_t input_changes;
+    uint64_t output_changes;
+    uint64_t updated_ns;
+} sysfs_gpio_shm_snapshot_st;
+
+/*
+ * Take a consistent copy of the page. Any of the arrays may be NULL.
+ * input_words and output_words need sysfs_gpio_shm_num_words() words for
+ * the inputs and outputs respectively, and input_changed_ns num_inputs
+ * entries.
+ * Returns false if the page has been retired, because the module stopped
+ * or a reload changed the number of inputs or outputs. It should then be
+ * closed and opened again.
+ */
+static inline bool
+sysfs_gpio_shm_read(
+    sysfs_gpio_shm_st const * const shm,
+    sysfs_gpio_shm_snapshot_st * const snapshot,
+    uint64_t * const input_words,
+    uint64_t * const output_words,
+    uint64_t * const input_changed_ns)
+{
+    sysfs_gpio_shm_st * const page = (sysfs_gpio_shm_st *)shm;
+    size_t const num_input_words = sysfs_gpio_shm_num_words(shm->num_inputs);
+    size_t const num_output_words = sysfs_gpio_shm_num_words(shm->num_outputs);
+    uint64_t sequence;
+    uint32_t magic;
+
+    do
+    {
+        do
+        {
+            sequence = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        }
+        while (sequence & 1);
+
+        magic = page->magic;
+        snapshot->input_changes = page->input_changes;
+        snapshot->output_changes = page->output_changes;
+        snapshot->updated_ns = page->updated_ns;
+        if (input_words != NULL)
+        {
+            memcpy(input_words, sysfs_gpio_shm_input_words(page),
+                   num_input_words * sizeof *input_words);
+        }
+        if (output_words != NULL)
+        {
+            memcpy(output_words, sysfs_gpio_shm_output_words(page),
+                   num_output_words * sizeof *output_words);
+        }
+        if (input_changed_ns != NULL)
+        {
+            memcpy(input_changed_ns, sysfs_gpio_shm_input_changed_ns(page),
+                   shm->num_inputs * sizeof *input_changed_ns);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    while (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) != sequence);
+
+    return magic == SYSFS_GPIO_SHM_MAGIC;
+}
+
+
+#endif /* __SYSFS_GPIO_SHM_H__ */
@@ -65,6 +65,20 @@ done:
     return ubus_ctx;
 }
 
+void
+gpio_ubus_send_event(char const * const id, struct blob_attr * const data)
+{
+    if (ubus_ctx == NULL)
+    {
+        goto done;
+    }
+
+    ubus_send_event(ubus_ctx, id, data);
+
+done:
+    return;
+}
+
 void
 gpio_ubus_done(void)
 {
@@ -11,5 +11,8 @@ gpio_ubus_initialise(char const * const path);
 void
 gpio_ubus_done(void);
 
+void
+gpio_ubus_send_event(char const * const id, struct blob_attr * const data);
+
 
 #endif /* __UBUS_H__ */
@@ -0,0 +1,1030 @@
+#include "ubus_ext.h"
+#include "input_monitor.h"
+#include "output_state.h"
+#include "sampler.h"
+#include "pwm_output.h"
+#include "output_sequence.h"
+#include "gpio_backend.h"
+#include "gpio_stats.h"
+#include "gpio_worker_pool.h"
+#include "memory_gpio_backend.h"
+#include "pin_bitmap.h"
+#include "monotonic.h"
+#include "debug.h"
+
+#include <libubox/blobmsg.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define UBUS_EXT_OBJECT_NAME "sysfs.gpio.ext"
+
+static struct ubus_context * ext_ubus_ctx;
+static ubus_ext_reload_fn ext_reload;
+static struct blob_buf reply_buf;
+
+static int
+cache_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+
+    if (!input_monitor_is_cached())
+    {
+        status = UBUS_STATUS_NOT_SUPPORTED;
+        goto done;
+    }
+
+    uint64_t const now_ns = monotonic_time_ns();
+
+    blob_buf_init(&reply_buf, 0);
+
+    void * const inputs_cookie = blobmsg_open_array(&reply_buf, "inputs");
+
+    for (size_t instance = 0; instance < input_monitor_num_inputs(); instance++)
+    {
+        bool state;
+        uint64_t updated_ns;
+        void * const input_cookie = blobmsg_open_table(&reply_buf, NULL);
+        bool const have_state =
+            input_monitor_cached_state(instance, &state, &updated_ns);
+
+        blobmsg_add_string(&reply_buf, "io type", "binary-input");
+        blobmsg_add_u32(&reply_buf, "instance", instance);
+        if (have_state)
+        {
+            blobmsg_add_u8(&reply_buf, "value", state);
+            blobmsg_add_u32(&reply_buf, "age", (now_ns - updated_ns) / 1000000);
+        }
+        blobmsg_add_u8(&reply_buf, "result", have_state);
+
+        blobmsg_close_table(&reply_buf, input_cookie);
+    }
+
+    blobmsg_close_array(&reply_buf, inputs_cookie);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+static int
+write_counters_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    output_write_counters_st counters;
+
+    output_state_write_counters(&counters);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u64(&reply_buf, "issued", counters.issued);
+    blobmsg_add_u64(&reply_buf, "suppressed", counters.suppressed);
+    blobmsg_add_u64(&reply_buf, "rejected", counters.rejected);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+
+    return UBUS_STATUS_OK;
+}
+
+/*
+ * A pin bitmap is sent as a single integer or, when there are more than 64
+ * pins, as an array of integers with the lowest pins first.
+ */
+static void
+add_bitmap(
+    struct blob_buf * const buf,
+    char const * const name,
+    uint64_t const * const words,
+    size_t const num_words)
+{
+    if (num_words <= 1)
+    {
+        blobmsg_add_u64(buf, name, num_words == 1 ? words[0] : 0);
+    }
+    else
+    {
+        void * const cookie = blobmsg_open_array(buf, name);
+
+        for (size_t word = 0; word < num_words; word++)
+        {
+            blobmsg_add_u64(buf, NULL, words[word]);
+        }
+        blobmsg_close_array(buf, cookie);
+    }
+}
+
+static int
+get_all_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    size_t const num_words = input_monitor_num_words();
+    uint64_t * const state_words = calloc(num_words, sizeof *state_words);
+
+    if (num_words > 0 && state_words == NULL)
+    {
+        status = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    if (!input_monitor_read_all(state_words))
+    {
+        status = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    blob_buf_init(&reply_buf, 0);
+    add_bitmap(&reply_buf, "binary-input", state_words, num_words);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    free(state_words);
+
+    return status;
+}
+
+/*
+ * The ubus CLI sends integers that fit in 32 bits as INT32 and larger ones
+ * as INT64, so accept any integer type.
+ */
+static bool
+get_integer(struct blob_attr * const attr, uint64_t * const value)
+{
+    bool success;
+
+    switch (blobmsg_type(attr))
+    {
+        case BLOBMSG_TYPE_INT64:
+            *value = blobmsg_get_u64(attr);
+            break;
+        case BLOBMSG_TYPE_INT32:
+            *value = blobmsg_get_u32(attr);
+            break;
+        case BLOBMSG_TYPE_INT16:
+            *value = blobmsg_get_u16(attr);
+            break;
+        case BLOBMSG_TYPE_INT8:
+            *value = blobmsg_get_u8(attr);
+            break;
+        default:
+            success = false;
+            goto done;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+/*
+ * A pin bitmap is sent either as a single integer or, when there are more
+ * than 64 pins, as an array of integers with the lowest pins first.
+ */
+static bool
+get_bitmap(
+    struct blob_attr * const attr,
+    uint64_t * const words,
+    size_t const max_words,
+    size_t * const num_words)
+{
+    bool success;
+
+    if (attr == NULL)
+    {
+        success = false;
+        goto done;
+    }
+
+    if (blobmsg_type(attr) != BLOBMSG_TYPE_ARRAY)
+    {
+        success = max_words > 0 && get_integer(attr, &words[0]);
+        *num_words = 1;
+        goto done;
+    }
+
+    struct blob_attr * cur;
+    int rem;
+
+    *num_words = 0;
+    blobmsg_for_each_attr(cur, attr, rem)
+    {
+        if (*num_words >= max_words || !get_integer(cur, &words[*num_words]))
+        {
+            success = false;
+            goto done;
+        }
+        (*num_words)++;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+enum
+{
+    SET_MASK_VALUE,
+    SET_MASK_MASK,
+    SET_MASK_MAX
+};
+
+static struct blobmsg_policy const set_mask_policy[SET_MASK_MAX] =
+{
+    [SET_MASK_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_UNSPEC },
+    [SET_MASK_MASK] = { .name = "mask", .type = BLOBMSG_TYPE_UNSPEC }
+};
+
+static int
+set_mask_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[SET_MASK_MAX];
+    size_t const max_words = output_state_num_words();
+    uint64_t * const value_words = calloc(max_words, sizeof *value_words);
+    uint64_t * const mask_words = calloc(max_words, sizeof *mask_words);
+    size_t num_value_words;
+    size_t num_mask_words;
+
+    if (max_words > 0 && (value_words == NULL || mask_words == NULL))
+    {
+        status = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    blobmsg_parse(set_mask_policy, SET_MASK_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!get_bitmap(tb[SET_MASK_VALUE], value_words, max_words, &num_value_words)
+        || !get_bitmap(tb[SET_MASK_MASK], mask_words, max_words, &num_mask_words))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    if (output_state_write_mask_rejected(value_words, mask_words, num_mask_words))
+    {
+        status = UBUS_STATUS_PERMISSION_DENIED;
+        goto done;
+    }
+
+    /* Outputs written here are no longer driven by PWM. */
+    for (size_t word = 0; word < num_mask_words; word++)
+    {
+        for (uint64_t mask = mask_words[word]; mask != 0; mask &= mask - 1)
+        {
+            pwm_output_cancel(word * PIN_BITMAP_WORD_BITS + pin_bitmap_next_bit(mask));
+        }
+    }
+
+    /* Missing value words are taken as zero. */
+    bool const result = output_state_write_mask(value_words, mask_words, num_mask_words);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u8(&reply_buf, "result", result);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    free(value_words);
+    free(mask_words);
+
+    return status;
+}
+
+/* Limit the size of a history reply. Clients ask again for the rest. */
+#define HISTORY_MAX_SAMPLES 1000
+
+enum
+{
+    HISTORY_SINCE,
+    HISTORY_MAX
+};
+
+static struct blobmsg_policy const history_policy[HISTORY_MAX] =
+{
+    [HISTORY_SINCE] = { .name = "since", .type = BLOBMSG_TYPE_UNSPEC }
+};
+
+static int
+history_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[HISTORY_MAX];
+    uint64_t since = 0;
+
+    if (!sampler_is_running())
+    {
+        status = UBUS_STATUS_NOT_SUPPORTED;
+        goto done;
+    }
+
+    blobmsg_parse(history_policy, HISTORY_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[HISTORY_SINCE] != NULL && !get_integer(tb[HISTORY_SINCE], &since))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    uint64_t const oldest = sampler_oldest_sequence();
+    uint64_t const first = since < oldest ? oldest : since;
+    uint64_t last = sampler_next_sequence();
+
+    if (first < last && last - first > HISTORY_MAX_SAMPLES)
+    {
+        last = first + HISTORY_MAX_SAMPLES;
+    }
+
+    blob_buf_init(&reply_buf, 0);
+    /* Samples between 'since' and 'first' have been overwritten. */
+    blobmsg_add_u64(&reply_buf, "lost", since < oldest ? oldest - since : 0);
+    blobmsg_add_u64(&reply_buf, "overruns", sampler_overruns());
+
+    void * const samples_cookie = blobmsg_open_array(&reply_buf, "samples");
+
+    for (uint64_t sequence = first; sequence < last; sequence++)
+    {
+        uint64_t timestamp_ns;
+        uint64_t const * state_words;
+
+        if (!sampler_get(sequence, &timestamp_ns, &state_words))
+        {
+            break;
+        }
+
+        void * const sample_cookie = blobmsg_open_table(&reply_buf, NULL);
+
+        blobmsg_add_u64(&reply_buf, "timestamp", timestamp_ns);
+        add_bitmap(&reply_buf, "binary-input", state_words, sampler_num_words());
+        blobmsg_close_table(&reply_buf, sample_cookie);
+    }
+
+    blobmsg_close_array(&reply_buf, samples_cookie);
+    /* Pass this as 'since' in the next request. */
+    blobmsg_add_u64(&reply_buf, "next", first < last ? last : first);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+static bool
+get_double(struct blob_attr * const attr, double * const value)
+{
+    bool success;
+    uint64_t integer;
+
+    if (blobmsg_type(attr) == BLOBMSG_TYPE_DOUBLE)
+    {
+        *value = blobmsg_get_double(attr);
+        success = true;
+        goto done;
+    }
+
+    success = get_integer(attr, &integer);
+    *value = integer;
+
+done:
+    return success;
+}
+
+enum
+{
+    PWM_INSTANCE,
+    PWM_DUTY,
+    PWM_PERIOD_MS,
+    PWM_MAX
+};
+
+static struct blobmsg_policy const pwm_policy[PWM_MAX] =
+{
+    [PWM_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_UNSPEC },
+    [PWM_DUTY] = { .name = "duty", .type = BLOBMSG_TYPE_UNSPEC },
+    [PWM_PERIOD_MS] = { .name = "period_ms", .type = BLOBMSG_TYPE_UNSPEC }
+};
+
+static int
+pwm_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[PWM_MAX];
+    uint64_t instance;
+    double duty_percent;
+    uint64_t period_ms = 0;
+
+    blobmsg_parse(pwm_policy, PWM_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[PWM_INSTANCE] == NULL || !get_integer(tb[PWM_INSTANCE], &instance)
+        || tb[PWM_DUTY] == NULL || !get_double(tb[PWM_DUTY], &duty_percent)
+        || (tb[PWM_PERIOD_MS] != NULL && !get_integer(tb[PWM_PERIOD_MS], &period_ms)))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    if (pwm_output_set_rejected(instance, period_ms, duty_percent))
+    {
+        status = UBUS_STATUS_PERMISSION_DENIED;
+        goto done;
+    }
+
+    bool const result = pwm_output_set(instance, period_ms, duty_percent);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u8(&reply_buf, "result", result);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+enum
+{
+    PULSE_INSTANCE,
+    PULSE_WIDTH_MS,
+    PULSE_VALUE,
+    PULSE_MAX
+};
+
+static struct blobmsg_policy const pulse_policy[PULSE_MAX] =
+{
+    [PULSE_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_UNSPEC },
+    [PULSE_WIDTH_MS] = { .name = "width_ms", .type = BLOBMSG_TYPE_UNSPEC },
+    [PULSE_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_BOOL }
+};
+
+static int
+pulse_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[PULSE_MAX];
+    uint64_t instance;
+    uint64_t width_ms;
+
+    blobmsg_parse(pulse_policy, PULSE_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[PULSE_INSTANCE] == NULL || !get_integer(tb[PULSE_INSTANCE], &instance)
+        || tb[PULSE_WIDTH_MS] == NULL || !get_integer(tb[PULSE_WIDTH_MS], &width_ms))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    if (pwm_output_pulse_rejected(instance))
+    {
+        status = UBUS_STATUS_PERMISSION_DENIED;
+        goto done;
+    }
+
+    bool const state = tb[PULSE_VALUE] == NULL || blobmsg_get_bool(tb[PULSE_VALUE]);
+    bool const result = pwm_output_pulse(instance, state, width_ms);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u8(&reply_buf, "result", result);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+static int
+pwm_jitter_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    pwm_output_jitter_st jitter;
+
+    pwm_output_jitter(&jitter);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u64(&reply_buf, "edges", jitter.edges);
+    blobmsg_add_u64(&reply_buf, "mean_late_ns",
+                    jitter.edges > 0 ? jitter.total_late_ns / jitter.edges : 0);
+    blobmsg_add_u64(&reply_buf, "max_late_ns", jitter.max_late_ns);
+    blobmsg_add_u64(&reply_buf, "missed_cycles", jitter.missed_cycles);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+
+    return UBUS_STATUS_OK;
+}
+
+enum
+{
+    SEQUENCE_STEPS,
+    SEQUENCE_MAX
+};
+
+static struct blobmsg_policy const sequence_policy[SEQUENCE_MAX] =
+{
+    [SEQUENCE_STEPS] = { .name = "steps", .type = BLOBMSG_TYPE_ARRAY }
+};
+
+enum
+{
+    STEP_INSTANCE,
+    STEP_VALUE,
+    STEP_WAIT_MS,
+    STEP_MAX
+};
+
+static struct blobmsg_policy const step_policy[STEP_MAX] =
+{
+    [STEP_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_UNSPEC },
+    [STEP_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_BOOL },
+    [STEP_WAIT_MS] = { .name = "wait_ms", .type = BLOBMSG_TYPE_UNSPEC }
+};
+
+/*
+ * Each step either waits for "wait_ms", or sets output "instance" to
+ * "value". Waits are converted to the time of each write from the start
+ * of the sequence.
+ */
+static bool
+parse_sequence_steps(
+    struct blob_attr * const steps_attr,
+    output_sequence_step_st * const steps,
+    size_t * const num_steps)
+{
+    bool success;
+    struct blob_attr * cur;
+    int rem;
+    uint64_t at_ms = 0;
+
+    *num_steps = 0;
+    blobmsg_for_each_attr(cur, steps_attr, rem)
+    {
+        struct blob_attr * tb[STEP_MAX];
+        uint64_t value;
+
+        if (blobmsg_type(cur) != BLOBMSG_TYPE_TABLE)
+        {
+            success = false;
+            goto done;
+        }
+
+        blobmsg_parse(step_policy, STEP_MAX, tb, blobmsg_data(cur), blobmsg_data_len(cur));
+
+        if (tb[STEP_WAIT_MS] != NULL)
+        {
+            if (!get_integer(tb[STEP_WAIT_MS], &value) || at_ms + value > UINT32_MAX)
+            {
+                success = false;
+                goto done;
+            }
+            at_ms += value;
+            continue;
+        }
+
+        if (tb[STEP_INSTANCE] == NULL || !get_integer(tb[STEP_INSTANCE], &value)
+            || tb[STEP_VALUE] == NULL || *num_steps >= OUTPUT_SEQUENCE_MAX_STEPS)
+        {
+            success = false;
+            goto done;
+        }
+
+        steps[*num_steps].at_ms = at_ms;
+        steps[*num_steps].instance = value;
+        steps[*num_steps].state = blobmsg_get_bool(tb[STEP_VALUE]);
+        (*num_steps)++;
+    }
+
+    success = true;
+
+done:
+    return success;
+}
+
+static int
+sequence_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[SEQUENCE_MAX];
+    static output_sequence_step_st steps[OUTPUT_SEQUENCE_MAX_STEPS];
+    size_t num_steps;
+    uint32_t id;
+
+    blobmsg_parse(sequence_policy, SEQUENCE_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[SEQUENCE_STEPS] == NULL
+        || !parse_sequence_steps(tb[SEQUENCE_STEPS], steps, &num_steps))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    bool const result = output_sequence_run(steps, num_steps, &id);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u8(&reply_buf, "result", result);
+    if (result)
+    {
+        blobmsg_add_u32(&reply_buf, "id", id);
+    }
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+enum
+{
+    SEQUENCE_CANCEL_ID,
+    SEQUENCE_CANCEL_MAX
+};
+
+static struct blobmsg_policy const sequence_cancel_policy[SEQUENCE_CANCEL_MAX] =
+{
+    [SEQUENCE_CANCEL_ID] = { .name = "id", .type = BLOBMSG_TYPE_UNSPEC }
+};
+
+static int
+sequence_cancel_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[SEQUENCE_CANCEL_MAX];
+    uint64_t id;
+
+    blobmsg_parse(sequence_cancel_policy, SEQUENCE_CANCEL_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[SEQUENCE_CANCEL_ID] == NULL || !get_integer(tb[SEQUENCE_CANCEL_ID], &id))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    bool const result = output_sequence_cancel(id);
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u8(&reply_buf, "result", result);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+enum
+{
+    STATS_RESET,
+    STATS_MAX
+};
+
+static struct blobmsg_policy const stats_policy[STATS_MAX] =
+{
+    [STATS_RESET] = { .name = "reset", .type = BLOBMSG_TYPE_BOOL }
+};
+
+static void
+add_stats(struct blob_buf * const buf, gpio_stats_snapshot_st const * const snapshot)
+{
+    blobmsg_add_u64(buf, "calls", snapshot->calls);
+    blobmsg_add_u64(buf, "errors", snapshot->errors);
+    blobmsg_add_u64(buf, "mean_ns", snapshot->calls > 0 ? snapshot->total_ns / snapshot->calls : 0);
+    blobmsg_add_u64(buf, "max_ns", snapshot->max_ns);
+
+    /* Bucket N counts latencies below 2^N ns. Trailing empty buckets are left out. */
+    size_t num_buckets = GPIO_STATS_BUCKETS;
+
+    while (num_buckets > 0 && snapshot->histogram[num_buckets - 1] == 0)
+    {
+        num_buckets--;
+    }
+
+    void * const histogram_cookie = blobmsg_open_array(buf, "histogram");
+
+    for (size_t bucket = 0; bucket < num_buckets; bucket++)
+    {
+        blobmsg_add_u64(buf, NULL, snapshot->histogram[bucket]);
+    }
+    blobmsg_close_array(buf, histogram_cookie);
+}
+
+/* Whether a pin has been used by any of the operations kept per pin. */
+static bool
+pin_used(size_t const gpio_number)
+{
+    bool used = false;
+    gpio_stats_snapshot_st snapshot;
+
+    for (gpio_stats_op_t op = 0; op < gpio_stats_op_count && !used; op++)
+    {
+        used = gpio_stats_pin(gpio_number, op, &snapshot) && snapshot.calls > 0;
+    }
+
+    return used;
+}
+
+static int
+stats_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    struct blob_attr * tb[STATS_MAX];
+    gpio_stats_snapshot_st snapshot;
+    output_write_counters_st counters;
+
+    blobmsg_parse(stats_policy, STATS_MAX, tb, blob_data(msg), blob_len(msg));
+
+    blob_buf_init(&reply_buf, 0);
+
+    void * const ops_cookie = blobmsg_open_table(&reply_buf, "operations");
+
+    for (gpio_stats_op_t op = 0; op < gpio_stats_op_count; op++)
+    {
+        gpio_stats_op(op, &snapshot);
+        if (snapshot.calls == 0)
+        {
+            continue;
+        }
+
+        void * const op_cookie = blobmsg_open_table(&reply_buf, gpio_stats_op_name(op));
+
+        add_stats(&reply_buf, &snapshot);
+        blobmsg_close_table(&reply_buf, op_cookie);
+    }
+    blobmsg_close_table(&reply_buf, ops_cookie);
+
+    void * const pins_cookie = blobmsg_open_array(&reply_buf, "pins");
+
+    for (size_t gpio_number = 0; gpio_number < gpio_stats_num_pins(); gpio_number++)
+    {
+        if (!pin_used(gpio_number))
+        {
+            continue;
+        }
+
+        void * const pin_cookie = blobmsg_open_table(&reply_buf, NULL);
+
+        blobmsg_add_u32(&reply_buf, "gpio", gpio_number);
+        for (gpio_stats_op_t op = 0; op < gpio_stats_op_count; op++)
+        {
+            if (!gpio_stats_pin(gpio_number, op, &snapshot) || snapshot.calls == 0)
+            {
+                continue;
+            }
+
+            void * const op_cookie = blobmsg_open_table(&reply_buf, gpio_stats_op_name(op));
+
+            add_stats(&reply_buf, &snapshot);
+            blobmsg_close_table(&reply_buf, op_cookie);
+        }
+        blobmsg_close_table(&reply_buf, pin_cookie);
+    }
+    blobmsg_close_array(&reply_buf, pins_cookie);
+
+    output_state_write_counters(&counters);
+
+    void * const writes_cookie = blobmsg_open_table(&reply_buf, "output_writes");
+
+    blobmsg_add_u64(&reply_buf, "issued", counters.issued);
+    blobmsg_add_u64(&reply_buf, "suppressed", counters.suppressed);
+    blobmsg_add_u64(&reply_buf, "rejected", counters.rejected);
+    blobmsg_close_table(&reply_buf, writes_cookie);
+
+    blobmsg_add_u32(&reply_buf, "worker_threads", gpio_worker_pool_num_threads());
+
+    gpio_startup_st startup;
+
+    gpio_backend_startup(&startup);
+
+    void * const startup_cookie = blobmsg_open_table(&reply_buf, "startup");
+
+    blobmsg_add_u64(&reply_buf, "duration_ns", startup.duration_ns);
+    blobmsg_add_u32(&reply_buf, "pins", startup.num_pins);
+    blobmsg_add_u32(&reply_buf, "already_exported", startup.num_already_exported);
+    blobmsg_add_u32(&reply_buf, "failed", startup.num_failed);
+    blobmsg_add_u32(&reply_buf, "chips", startup.num_chips);
+    blobmsg_add_u32(&reply_buf, "deferred", startup.num_deferred);
+    blobmsg_add_u32(&reply_buf, "pending", startup.num_pending);
+    blobmsg_close_table(&reply_buf, startup_cookie);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+
+    if (tb[STATS_RESET] != NULL && blobmsg_get_bool(tb[STATS_RESET]))
+    {
+        gpio_stats_reset();
+        output_state_reset_write_counters();
+    }
+
+    return UBUS_STATUS_OK;
+}
+
+static int
+reload_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    gpio_reload_st reload = { 0 };
+    bool const reloaded = ext_reload != NULL && ext_reload(&reload);
+
+    /* A failed reload is only worth a reply if the old pins were lost. */
+    if (!reloaded && !reload.restore_failed)
+    {
+        status = UBUS_STATUS_UNKNOWN_ERROR;
+        goto done;
+    }
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u32(&reply_buf, "added", reload.num_added);
+    blobmsg_add_u32(&reply_buf, "removed", reload.num_removed);
+    blobmsg_add_u32(&reply_buf, "changed", reload.num_changed);
+    blobmsg_add_u32(&reply_buf, "kept", reload.num_kept);
+    blobmsg_add_u32(&reply_buf, "failed", reload.num_failed);
+    blobmsg_add_u8(&reply_buf, "reopened", reload.reopened);
+    blobmsg_add_u8(&reply_buf, "restore_failed", reload.restore_failed);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+
+    status = reloaded ? UBUS_STATUS_OK : UBUS_STATUS_UNKNOWN_ERROR;
+
+done:
+    return status;
+}
+
+enum
+{
+    SIMULATE_INPUT_INSTANCE,
+    SIMULATE_INPUT_VALUE,
+    SIMULATE_INPUT_MAX
+};
+
+static struct blobmsg_policy const simulate_input_policy[SIMULATE_INPUT_MAX] =
+{
+    [SIMULATE_INPUT_INSTANCE] = { .name = "instance", .type = BLOBMSG_TYPE_UNSPEC },
+    [SIMULATE_INPUT_VALUE] = { .name = "value", .type = BLOBMSG_TYPE_BOOL }
+};
+
+/*
+ * Drive a binary-input of the memory backend, as the hardware would. Edge
+ * events, debouncing and interlocks follow as they would for a real pin.
+ */
+static int
+simulate_input_handler(
+    struct ubus_context * const ctx,
+    struct ubus_object * const obj,
+    struct ubus_request_data * const req,
+    char const * const method,
+    struct blob_attr * const msg)
+{
+    int status;
+    struct blob_attr * tb[SIMULATE_INPUT_MAX];
+    uint64_t instance;
+    size_t gpio_number;
+
+    if (strcmp(gpio_backend_name(), memory_gpio_backend.name) != 0)
+    {
+        status = UBUS_STATUS_NOT_SUPPORTED;
+        goto done;
+    }
+
+    blobmsg_parse(
+        simulate_input_policy, SIMULATE_INPUT_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[SIMULATE_INPUT_INSTANCE] == NULL
+        || !get_integer(tb[SIMULATE_INPUT_INSTANCE], &instance)
+        || tb[SIMULATE_INPUT_VALUE] == NULL
+        || !input_monitor_gpio_number(instance, &gpio_number))
+    {
+        status = UBUS_STATUS_INVALID_ARGUMENT;
+        goto done;
+    }
+
+    bool const state = blobmsg_get_bool(tb[SIMULATE_INPUT_VALUE]);
+    bool const result = memory_gpio_backend_set_input(gpio_number, state) == 0;
+
+    blob_buf_init(&reply_buf, 0);
+    blobmsg_add_u8(&reply_buf, "result", result);
+
+    ubus_send_reply(ctx, req, reply_buf.head);
+    status = UBUS_STATUS_OK;
+
+done:
+    return status;
+}
+
+static struct ubus_method const ext_methods[] =
+{
+    UBUS_METHOD_NOARG("cache", cache_handler),
+    UBUS_METHOD_NOARG("write_counters", write_counters_handler),
+    UBUS_METHOD_NOARG("get_all", get_all_handler),
+    UBUS_METHOD("set_mask", set_mask_handler, set_mask_policy),
+    UBUS_METHOD("history", history_handler, history_policy),
+    UBUS_METHOD("pwm", pwm_handler, pwm_policy),
+    UBUS_METHOD("pulse", pulse_handler, pulse_policy),
+    UBUS_METHOD_NOARG("pwm_jitter", pwm_jitter_handler),
+    UBUS_METHOD("sequence", sequence_handler, sequence_policy),
+    UBUS_METHOD("sequence_cancel", sequence_cancel_handler, sequence_cancel_policy),
+    UBUS_METHOD("stats", stats_handler, stats_policy),
+    UBUS_METHOD_NOARG("reload", reload_handler),
+    UBUS_METHOD("simulate_input", simulate_input_handler, simulate_input_policy)
+};
+
+static struct ubus_object_type ext_object_type =
+    UBUS_OBJECT_TYPE(UBUS_EXT_OBJECT_NAME, ext_methods);
+
+static struct ubus_object ext_object =
+{
+    .name = UBUS_EXT_OBJECT_NAME,
+    .type = &ext_object_type,
+    .methods = ext_methods,
+    .n_methods = ARRAY_SIZE(ext_methods)
+};
+
+bool
+ubus_ext_initialise(struct ubus_context * const ubus_ctx, ubus_ext_reload_fn const reload)
+{
+    bool success;
+
+    if (ubus_add_object(ubus_ctx, &ext_object) != 0)
+    {
+        DPRINTF("Failed to add UBUS object: %s\n", UBUS_EXT_OBJECT_NAME);
+        success = false;
+        goto done;
+    }
+
+    ext_ubus_ctx = ubus_ctx;
+    ext_reload = reload;
+    success = true;
+
+done:
+    return success;
+}
+
+void
+ubus_ext_done(void)
+{
+    if (ext_ubus_ctx != NULL)
+    {
+        ubus_remove_object(ext_ubus_ctx, &ext_object);
+        ext_ubus_ctx = NULL;
+    }
+    ext_reload = NULL;
+    blob_buf_free(&reply_buf);
+}
@@ -0,0 +1,26 @@
+#ifndef __UBUS_EXT_H__
+#define __UBUS_EXT_H__
+
+#include "gpio_backend.h"
+
+#include <libubus.h>
+
+#include <stdbool.h>
+
+/*
+ * UBUS methods beyond the get/set/counts methods provided by libubusgpio.
+ * These are published on a separate object as libubusgpio owns the
+ * sysfs.gpio object.
+ */
+
+/* Reloads the configuration file for the "reload" method. */
+typedef bool (*ubus_ext_reload_fn)(gpio_reload_st * reload);
+
+bool
+ubus_ext_initialise(struct ubus_context * const ubus_ctx, ubus_ext_reload_fn const reload);
+
+void
+ubus_ext_done(void);
+
+
+#endif /* __UBUS_EXT_H__ */
@@ -0,0 +1,252 @@
+#include "uring_batch.h"
+
+#include <linux/io_uring.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct uring_batch_st
+{
+    int ring_fd;
+    unsigned int entries;
+
+    void * sq_mapping;
+    size_t sq_mapping_size;
+    void * cq_mapping;
+    size_t cq_mapping_size;
+    struct io_uring_sqe * sqes;
+    size_t sqes_size;
+
+    unsigned int * sq_tail;
+    unsigned int sq_mask;
+    unsigned int * sq_array;
+
+    unsigned int * cq_head;
+    unsigned int * cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe * cqes;
+};
+
+static int
+io_uring_setup(unsigned int const entries, struct io_uring_params * const params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter(int const ring_fd, unsigned int const to_submit, unsigned int const min_complete)
+{
+    return syscall(
+        __NR_io_uring_enter, ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void *
+ring_map(int const ring_fd, size_t const size, off_t const offset)
+{
+    void * const mapping =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+
+    return mapping == MAP_FAILED ? NULL : mapping;
+}
+
+uring_batch_st * uring_batch_open(unsigned int const entries)
+{
+    struct io_uring_params params = { 0 };
+    uring_batch_st * batch = calloc(1, sizeof *batch);
+
+    if (batch == NULL)
+    {
+        goto done;
+    }
+
+    batch->ring_fd = io_uring_setup(entries, &params);
+    if (batch->ring_fd < 0)
+    {
+        free(batch);
+        batch = NULL;
+        goto done;
+    }
+    batch->entries = params.sq_entries;
+
+    batch->sq_mapping_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    batch->cq_mapping_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+        /* Both rings share one mapping. */
+        if (batch->cq_mapping_size > batch->sq_mapping_size)
+        {
+            batch->sq_mapping_size = batch->cq_mapping_size;
+        }
+        batch->cq_mapping_size = 0;
+    }
+
+    batch->sq_mapping = ring_map(batch->ring_fd, batch->sq_mapping_size, IORING_OFF_SQ_RING);
+    if (batch->sq_mapping == NULL)
+    {
+        uring_batch_close(batch);
+        batch = NULL;
+        goto done;
+    }
+
+    if (batch->cq_mapping_size == 0)
+    {
+        batch->cq_mapping = batch->sq_mapping;
+    }
+    else
+    {
+        batch->cq_mapping = ring_map(batch->ring_fd, batch->cq_mapping_size, IORING_OFF_CQ_RING);
+        if (batch->cq_mapping == NULL)
+        {
+            uring_batch_close(batch);
+            batch = NULL;
+            goto done;
+        }
+    }
+
+    batch->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    batch->sqes = ring_map(batch->ring_fd, batch->sqes_size, IORING_OFF_SQES);
+    if (batch->sqes == NULL)
+    {
+        uring_batch_close(batch);
+        batch = NULL;
+        goto done;
+    }
+
+    uint8_t * const sq = batch->sq_mapping;
+    uint8_t * const cq = batch->cq_mapping;
+
+    batch->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    batch->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    batch->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    batch->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    batch->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    batch->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    batch->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+done:
+    return batch;
+}
+
+void uring_batch_close(uring_batch_st * const batch)
+{
+    if (batch == NULL)
+    {
+        goto done;
+    }
+
+    if (batch->sqes != NULL)
+    {
+        munmap(batch->sqes, batch->sqes_size);
+    }
+    if (batch->cq_mapping != NULL && batch->cq_mapping != batch->sq_mapping)
+    {
+        munmap(batch->cq_mapping, batch->cq_mapping_size);
+    }
+    if (batch->sq_mapping != NULL)
+    {
+        munmap(batch->sq_mapping, batch->sq_mapping_size);
+    }
+    close(batch->ring_fd);
+    free(batch);
+
+done:
+    return;
+}
+
+static void
+queue_ops(uring_batch_st * const batch, uring_batch_op_st const * const ops, size_t const count)
+{
+    /* Only this thread adds entries, so the tail needn't be read atomically. */
+    unsigned int tail = *batch->sq_tail;
+
+    for (size_t index = 0; index < count; index++)
+    {
+        unsigned int const slot = tail & batch->sq_mask;
+        struct io_uring_sqe * const sqe = &batch->sqes[slot];
+
+        memset(sqe, 0, sizeof *sqe);
+        sqe->opcode = ops[index].write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = ops[index].fd;
+        sqe->addr = (uintptr_t)ops[index].buffer;
+        sqe->len = ops[index].length;
+        sqe->off = 0;
+        sqe->user_data = index;
+        batch->sq_array[slot] = slot;
+        tail++;
+    }
+
+    __atomic_store_n(batch->sq_tail, tail, __ATOMIC_RELEASE);
+}
+
+static size_t
+reap_completions(uring_batch_st * const batch, uring_batch_op_st * const ops)
+{
+    size_t reaped = 0;
+    unsigned int head = *batch->cq_head;
+    unsigned int const tail = __atomic_load_n(batch->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe const * const cqe = &batch->cqes[head & batch->cq_mask];
+
+        ops[cqe->user_data].result = cqe->res;
+        reaped++;
+    }
+
+    __atomic_store_n(batch->cq_head, head, __ATOMIC_RELEASE);
+
+    return reaped;
+}
+
+/* Run up to a ring's worth of operations. */
+static int
+run_chunk(uring_batch_st * const batch, uring_batch_op_st * const ops, size_t const count)
+{
+    int result;
+    size_t submitted = 0;
+    size_t completed = 0;
+
+    queue_ops(batch, ops, count);
+
+    while (completed < count)
+    {
+        int const entered = io_uring_enter(batch->ring_fd, count - submitted, 1);
+
+        if (entered < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            result = -1;
+            goto done;
+        }
+
+        submitted += entered;
+        completed += reap_completions(batch, ops);
+    }
+
+    result = 0;
+
+done:
+    return result;
+}
+
+int uring_batch_run(uring_batch_st * const batch, uring_batch_op_st * const ops, size_t const count)
+{
+    int result = 0;
+
+    for (size_t first = 0; first < count && result == 0; first += batch->entries)
+    {
+        size_t const chunk = count - first < batch->entries ? count - first : batch->entries;
+
+        result = run_chunk(batch, ops + first, chunk);
+    }
+
+    return result;
+}
@@ -0,0 +1,37 @@
+#ifndef __URING_BATCH_H__
+#define __URING_BATCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Runs a batch of positional reads and writes with io_uring, so that many
+ * small file operations cost a single system call. Uses the raw io_uring
+ * system calls, so doesn't need liburing.
+ */
+typedef struct uring_batch_st uring_batch_st;
+
+typedef struct uring_batch_op_st
+{
+    int fd;
+    bool write;
+    void * buffer;
+    unsigned int length;
+    /* Set by uring_batch_run(): bytes transferred, or -errno. */
+    int result;
+} uring_batch_op_st;
+
+/* NULL if the kernel doesn't support io_uring, or it isn't permitted. */
+uring_batch_st * uring_batch_open(unsigned int const entries);
+
+void uring_batch_close(uring_batch_st * const batch);
+
+/*
+ * Run count operations at offset 0 of their files, and wait for all of
+ * them. Returns 0 once every operation has a result, or -1 if the ring
+ * failed, after which it shouldn't be used again.
+ */
+int uring_batch_run(uring_batch_st * const batch, uring_batch_op_st * const ops, size_t const count);
+
+
+#endif /* __URING_BATCH_H__ */